@@ -0,0 +1,179 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "src/batch-reader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+
+#if HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include <kj/debug.h>
+
+#include "src/thread-pool.h"
+#include "src/util.h"
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+namespace {
+
+#if HAVE_LIBURING
+// The maximum number of reads in flight in one ring.
+constexpr unsigned kMaxQueueDepth = 256;
+
+// Set once io_uring has been found to be unsupported or forbidden, so that we
+// don't try to set up a ring for every batch.
+std::atomic<bool> io_uring_unavailable{false};
+#endif
+
+}  // namespace
+
+void BatchReader::Add(int fd, uint64_t offset, size_t size, void* buffer,
+                      std::function<void()> completion) {
+  Request request;
+  request.fd = fd;
+  request.offset = offset;
+  request.size = size;
+  request.buffer = static_cast<char*>(buffer);
+  request.completion = std::move(completion);
+  requests_.emplace_back(std::move(request));
+}
+
+void BatchReader::Run() {
+  if (requests_.empty()) return;
+
+  try {
+    if (!RunIOUring()) RunThreadPool();
+  } catch (...) {
+    requests_.clear();
+    throw;
+  }
+
+  requests_.clear();
+}
+
+#if HAVE_LIBURING
+
+bool BatchReader::RunIOUring() {
+  if (io_uring_unavailable.load(std::memory_order_relaxed)) return false;
+
+  const auto depth = static_cast<unsigned>(
+      std::min<size_t>(requests_.size(), kMaxQueueDepth));
+
+  struct io_uring ring;
+  auto ret = io_uring_queue_init(depth, &ring, 0);
+  if (ret < 0) {
+    // Old kernels lack io_uring, and seccomp policies may forbid it.  Other
+    // errors, such as running out of locked memory, may be temporary.
+    if (ret == -ENOSYS || ret == -EPERM) io_uring_unavailable = true;
+    return false;
+  }
+
+  struct RingCloser {
+    ~RingCloser() { io_uring_queue_exit(ring); }
+    struct io_uring* ring;
+  } ring_closer{&ring};
+
+  // Queues the unread part of request `i'.  Never fails, since we never have
+  // more reads in flight than the ring has entries.
+  auto submit = [this, &ring](size_t i) {
+    auto& request = requests_[i];
+    auto sqe = io_uring_get_sqe(&ring);
+    KJ_ASSERT(sqe != nullptr);
+    io_uring_prep_read(sqe, request.fd, request.buffer + request.done,
+                       request.size - request.done,
+                       request.offset + request.done);
+    io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(i));
+  };
+
+  size_t next = 0;
+  size_t in_flight = 0;
+  std::exception_ptr error;
+
+  // After a failure, we stop submitting reads, but we must still wait for
+  // the reads in flight, since they write to the callers' buffers.
+  while (in_flight > 0 || (!error && next < requests_.size())) {
+    while (!error && next < requests_.size() && in_flight < depth) {
+      submit(next++);
+      ++in_flight;
+    }
+
+    ret = io_uring_submit_and_wait(&ring, 1);
+    if (ret < 0) {
+      if (ret == -EINTR) continue;
+      KJ_FAIL_SYSCALL("io_uring_submit_and_wait", -ret);
+    }
+
+    struct io_uring_cqe* cqe;
+    while (0 == io_uring_peek_cqe(&ring, &cqe)) {
+      const auto i = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe));
+      const auto result = cqe->res;
+      io_uring_cqe_seen(&ring, cqe);
+      --in_flight;
+
+      if (error) continue;
+
+      auto& request = requests_[i];
+
+      try {
+        if (result == -EINTR || result == -EAGAIN) {
+          submit(i);
+          ++in_flight;
+          continue;
+        }
+
+        if (result < 0) KJ_FAIL_SYSCALL("read", -result, request.offset);
+
+        KJ_REQUIRE(result > 0, "unexpectedly reached end of file",
+                   request.offset, request.size);
+
+        // Short reads are rare, but allowed.
+        request.done += result;
+        if (request.done < request.size) {
+          submit(i);
+          ++in_flight;
+          continue;
+        }
+
+        request.completion();
+      } catch (...) {
+        error = std::current_exception();
+      }
+    }
+  }
+
+  if (error) std::rethrow_exception(error);
+
+  return true;
+}
+
+#else  // !HAVE_LIBURING
+
+bool BatchReader::RunIOUring() { return false; }
+
+#endif  // !HAVE_LIBURING
+
+void BatchReader::RunThreadPool() {
+  TaskGroup tasks(ThreadPool::Default());
+
+  for (auto& request : requests_) {
+    tasks.Launch([&request] {
+      ReadWithOffset(request.fd, request.buffer, request.size, request.offset);
+      request.completion();
+    });
+  }
+
+  tasks.Wait();
+}
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
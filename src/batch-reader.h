@@ -0,0 +1,71 @@
+#ifndef STORAGE_CA_TABLE_BATCH_READER_H_
+#define STORAGE_CA_TABLE_BATCH_READER_H_ 1
+
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+#include <kj/common.h>
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+// Reads many byte ranges of files at once.  The ranges are added with Add(),
+// and Run() then issues all of their reads together, calling each range's
+// completion function as soon as that range has been read.  Example use:
+//
+//   BatchReader reader;
+//   for (auto& block : blocks)
+//     reader.Add(fd, block.offset, block.size, block.data, [&block] {
+//       Decode(block);
+//     });
+//   reader.Run();
+//
+// The reads are done with io_uring when ca-table is built with liburing and
+// the kernel allows it.  Otherwise they are done with pread() on the default
+// thread pool.
+class BatchReader {
+ public:
+  BatchReader() {}
+
+  KJ_DISALLOW_COPY(BatchReader);
+
+  // Adds a read of `size' bytes at `offset' in `fd' into `buffer', which must
+  // stay valid until Run() returns.
+  void Add(int fd, uint64_t offset, size_t size, void* buffer,
+           std::function<void()> completion);
+
+  // Reads all the ranges added so far, then forgets them.  Completion
+  // functions are called as their reads finish, in any order, either from the
+  // calling thread, or concurrently from worker threads.  If a read or a
+  // completion function fails, the remaining completion functions may be
+  // skipped, and the first exception is rethrown once no read is in flight.
+  void Run();
+
+ private:
+  struct Request {
+    int fd;
+    uint64_t offset;
+    size_t size;
+    char* buffer;
+    std::function<void()> completion;
+
+    // The number of bytes read so far.
+    size_t done = 0;
+  };
+
+  // Returns false if io_uring is not available, before reading anything.
+  bool RunIOUring();
+
+  void RunThreadPool();
+
+  std::vector<Request> requests_;
+};
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !STORAGE_CA_TABLE_BATCH_READER_H_
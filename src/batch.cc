@@ -0,0 +1,180 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "src/batch.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include <kj/debug.h>
+
+#include "src/query.h"
+
+namespace cantera {
+namespace table {
+
+namespace {
+
+// The session parameters, which are thread local.  Statements executed by
+// worker threads get a copy of the parameters of the parsing thread.
+struct Session {
+  static Session Current() {
+    Session result;
+    result.output = CA_output;
+    memcpy(result.time_format, CA_time_format, sizeof(CA_time_format));
+    result.output_format = CA_output_format;
+    result.memory_limit = CA_memory_limit;
+    result.timeout = CA_timeout;
+    return result;
+  }
+
+  void Apply() const {
+    CA_output = output;
+    memcpy(CA_time_format, time_format, sizeof(CA_time_format));
+    CA_output_format = output_format;
+    CA_memory_limit = memory_limit;
+    CA_timeout = timeout;
+  }
+
+  FILE* output;
+  char time_format[sizeof(CA_time_format)];
+  RuntimeParameterValue output_format;
+  size_t memory_limit;
+  uint64_t timeout;
+};
+
+// Returns true if `stmt' neither changes nor depends on anything changed by
+// other statements of the script, other than through the session parameters.
+bool IsIndependent(const QueryParseContext* context, const Statement* stmt) {
+  switch (stmt->type) {
+    case kStatementCorrelate:
+    case kStatementExplain:
+    case kStatementFacet:
+    case kStatementParse:
+    case kStatementQuery:
+    case kStatementSelect:
+      return true;
+
+    case kStatementExecute: {
+      // Prepared statements can't change while other statements run, since
+      // PREPARE and DEALLOCATE wait for them.
+      auto i = context->prepared_statements.find(stmt->u.execute.name);
+      return i != context->prepared_statements.end() &&
+             IsIndependent(context, i->second.statement);
+    }
+
+    case kStatementDeallocate:
+    case kStatementPrepare:
+    case kStatementReload:
+    case kStatementSet:
+    case kStatementWarmUp:
+      return false;
+  }
+
+  return false;
+}
+
+}  // namespace
+
+BatchExecutor::BatchExecutor(QueryParseContext* context, size_t jobs,
+                             FILE* output)
+    : context_(context), output_(output), max_pending_(jobs * 4), pool_(jobs) {}
+
+BatchExecutor::~BatchExecutor() { Discard(); }
+
+void BatchExecutor::Submit(Statement* stmt) {
+  if (!IsIndependent(context_, stmt)) {
+    WriteResults(true);
+
+    CA_process_statement(context_, stmt);
+    fflush(CA_output);
+    return;
+  }
+
+  while (pending_.size() >= max_pending_) {
+    pending_.front().wait();
+    WriteResults(false);
+  }
+
+  auto session = Session::Current();
+
+  // The statement must outlive the parsing of later statements.
+  pending_.emplace_back(pool_.Launch([
+    context = context_, stmt, arena = context_->arena, session
+  ] {
+    Result result;
+
+    char* data = nullptr;
+    size_t size = 0;
+
+#if HAVE_OPEN_MEMSTREAM
+    auto output = open_memstream(&data, &size);
+#else
+    FILE* output = nullptr;
+    errno = ENOSYS;
+#endif
+    if (!output) {
+      try {
+        KJ_FAIL_SYSCALL("open_memstream", errno);
+      } catch (...) {
+        result.error = std::current_exception();
+      }
+      return result;
+    }
+
+    // A full queue makes the pool run the statement in the submitting thread,
+    // whose own session must be left alone.
+    const auto saved_session = Session::Current();
+    session.Apply();
+    CA_output = output;
+
+    try {
+      CA_process_statement(context, stmt);
+    } catch (...) {
+      result.error = std::current_exception();
+    }
+
+    saved_session.Apply();
+
+    fclose(output);
+    result.output.assign(data, size);
+    free(data);
+
+    return result;
+  }));
+
+  WriteResults(false);
+}
+
+void BatchExecutor::Finish() { WriteResults(true); }
+
+void BatchExecutor::WriteResults(bool wait) {
+  while (!pending_.empty()) {
+    auto& next = pending_.front();
+    if (!wait &&
+        next.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      break;
+
+    auto result = next.get();
+    pending_.pop_front();
+
+    fwrite(result.output.data(), 1, result.output.size(), output_);
+    fflush(output_);
+
+    if (result.error) {
+      Discard();
+      std::rethrow_exception(result.error);
+    }
+  }
+}
+
+void BatchExecutor::Discard() {
+  for (auto& result : pending_) result.wait();
+  pending_.clear();
+}
+
+}  // namespace table
+}  // namespace cantera
@@ -0,0 +1,77 @@
+#ifndef STORAGE_CA_TABLE_BATCH_H_
+#define STORAGE_CA_TABLE_BATCH_H_ 1
+
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <future>
+#include <string>
+
+#include <kj/common.h>
+
+#include "src/thread-pool.h"
+
+namespace cantera {
+namespace table {
+
+struct QueryParseContext;
+struct Statement;
+
+// Executes the statements of a script on several threads, while the parser
+// reads ahead, and writes their results in the order of the script.
+// Statements that only read, such as QUERY and SELECT, run concurrently.
+// Statements that change the session or the schema, such as SET, PREPARE and
+// RELOAD, wait for all earlier statements, and then run on the calling thread,
+// before later statements start.
+//
+// As when statements are executed one at a time, a failing statement ends the
+// script: its partial output is written after the output of all earlier
+// statements, and the results of later statements are discarded.
+class BatchExecutor {
+ public:
+  // Runs up to `jobs' statements at once, writing results to `output'.
+  BatchExecutor(QueryParseContext* context, size_t jobs, FILE* output);
+
+  KJ_DISALLOW_COPY(BatchExecutor);
+
+  // Discards the results of unfinished statements.  Call Finish() first to
+  // keep them.
+  ~BatchExecutor();
+
+  // Executes `stmt', or schedules it for execution.  Throws the exception of
+  // the first failed statement whose results are due.
+  void Submit(Statement* stmt);
+
+  // Waits for all submitted statements, and writes their results.
+  void Finish();
+
+ private:
+  struct Result {
+    std::string output;
+    std::exception_ptr error;
+  };
+
+  // Writes the results of finished statements at the front of the queue.  If
+  // `wait' is true, waits for all statements first.
+  void WriteResults(bool wait);
+
+  // Waits for all pending statements, ignoring their results.
+  void Discard();
+
+  QueryParseContext* const context_;
+  FILE* const output_;
+
+  // The maximum number of pending statements.  Bounds the memory used by the
+  // results of statements waiting for a slow statement before them.
+  const size_t max_pending_;
+
+  internal::ThreadPool pool_;
+
+  // Results of submitted statements, in script order.
+  std::deque<std::future<Result>> pending_;
+};
+
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !STORAGE_CA_TABLE_BATCH_H_
@@ -0,0 +1,76 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "src/block-cache.h"
+
+#include <kj/debug.h>
+
+namespace cantera {
+namespace table {
+
+namespace {
+
+// Capacity of the default block cache, unless set otherwise before it is
+// created.
+std::atomic<size_t> default_capacity{256 << 20};
+
+std::atomic<bool> default_created{false};
+
+}  // namespace
+
+namespace internal {
+
+BlockCache::BlockCache(size_t capacity)
+    : capacity_(capacity), cache_(leveldb::NewLRUCache(capacity)) {}
+
+// Never destroyed, since tables held by static objects may release their
+// blocks after static destructors have run.
+BlockCache& BlockCache::Default() {
+  static auto* cache =
+      new BlockCache((default_created = true, default_capacity.load()));
+  return *cache;
+}
+
+void BlockCache::Erase(uint64_t file_id, uint64_t count) {
+  for (uint64_t num = 0; num < count; ++num) {
+    const auto key = MakeKey(file_id, num);
+    cache_->Erase(leveldb::Slice(key.data, sizeof(key.data)));
+  }
+}
+
+BlockCacheStats BlockCache::Stats() const {
+  BlockCacheStats result;
+  result.capacity = capacity_;
+  result.usage = cache_->TotalCharge();
+  result.hits = hits_.load(std::memory_order_relaxed);
+  result.misses = misses_.load(std::memory_order_relaxed);
+  return result;
+}
+
+void BlockCache::RecordLookup(bool hit) {
+  auto& io_stats = ThreadTableIOStats();
+
+  if (hit) {
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    ++io_stats.block_cache_hits;
+  } else {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    ++io_stats.block_cache_misses;
+  }
+}
+
+}  // namespace internal
+
+void SetBlockCacheCapacity(size_t capacity) {
+  KJ_REQUIRE(!default_created.load(),
+             "the block cache capacity must be set before opening any table");
+  default_capacity = capacity;
+}
+
+BlockCacheStats GetBlockCacheStats() {
+  return internal::BlockCache::Default().Stats();
+}
+
+}  // namespace table
+}  // namespace cantera
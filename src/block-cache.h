@@ -0,0 +1,142 @@
+#ifndef STORAGE_CA_TABLE_BLOCK_CACHE_H_
+#define STORAGE_CA_TABLE_BLOCK_CACHE_H_ 1
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
+
+#include <kj/common.h>
+#include <leveldb/cache.h>
+
+#include "src/ca-table.h"
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+// A cache of decoded table blocks, shared by all tables and threads of the
+// process, and bounded by the memory used by the blocks.  Blocks are keyed by
+// a file ID, obtained from NewId() when a table is opened, and a block number
+// within the file.  The cache is split into shards with separate locks, and
+// evicts the least recently used blocks of each shard.  Example use:
+//
+//   auto block = BlockCache::Default().Lookup<Block>(file_id, num);
+//   if (!block) block = BlockCache::Default().Insert(file_id, num, Decode());
+//   Use(*block);
+class BlockCache {
+ public:
+  // A reference to a cached block.  The block is neither evicted nor changed
+  // while referenced.
+  template <typename T>
+  class Pin {
+   public:
+    Pin() {}
+
+    Pin(Pin&& rhs) : cache_(rhs.cache_), handle_(rhs.handle_) {
+      rhs.handle_ = nullptr;
+    }
+
+    Pin& operator=(Pin&& rhs) {
+      std::swap(cache_, rhs.cache_);
+      std::swap(handle_, rhs.handle_);
+      return *this;
+    }
+
+    KJ_DISALLOW_COPY(Pin);
+
+    ~Pin() {
+      if (handle_) cache_->Release(handle_);
+    }
+
+    explicit operator bool() const { return handle_ != nullptr; }
+
+    const T& operator*() const { return *get(); }
+    const T* operator->() const { return get(); }
+
+    const T* get() const {
+      return static_cast<const T*>(cache_->Value(handle_));
+    }
+
+   private:
+    friend class BlockCache;
+
+    Pin(leveldb::Cache* cache, leveldb::Cache::Handle* handle)
+        : cache_(cache), handle_(handle) {}
+
+    leveldb::Cache* cache_ = nullptr;
+    leveldb::Cache::Handle* handle_ = nullptr;
+  };
+
+  explicit BlockCache(size_t capacity);
+
+  KJ_DISALLOW_COPY(BlockCache);
+
+  // Returns the cache shared by all tables, creating it with the capacity set
+  // by SetBlockCacheCapacity() on first use.
+  static BlockCache& Default();
+
+  // Returns a new file ID, unique within this cache.
+  uint64_t NewId() { return cache_->NewId(); }
+
+  // Returns block `num' of file `file_id', or an empty reference if the block
+  // is not cached.  The block must have been inserted with the same type.
+  template <typename T>
+  Pin<T> Lookup(uint64_t file_id, uint64_t num) {
+    const auto key = MakeKey(file_id, num);
+    auto handle = cache_->Lookup(leveldb::Slice(key.data, sizeof(key.data)));
+    RecordLookup(handle != nullptr);
+    return Pin<T>(cache_.get(), handle);
+  }
+
+  // Adds block `num' of file `file_id' to the cache, replacing any block
+  // inserted under the same key meanwhile, and returns a reference to it.
+  // `T' must have a MemoryUsage() member returning its size in bytes.
+  template <typename T>
+  Pin<T> Insert(uint64_t file_id, uint64_t num, std::unique_ptr<T> block) {
+    const auto key = MakeKey(file_id, num);
+    const auto charge = block->MemoryUsage();
+    auto handle = cache_->Insert(leveldb::Slice(key.data, sizeof(key.data)),
+                                 block.release(), charge, &Delete<T>);
+    return Pin<T>(cache_.get(), handle);
+  }
+
+  // Removes blocks 0 to `count' - 1 of file `file_id' from the cache.  Blocks
+  // still referenced are freed once released.
+  void Erase(uint64_t file_id, uint64_t count);
+
+  BlockCacheStats Stats() const;
+
+ private:
+  struct Key {
+    char data[2 * sizeof(uint64_t)];
+  };
+
+  static Key MakeKey(uint64_t file_id, uint64_t num) {
+    Key result;
+    memcpy(result.data, &file_id, sizeof(file_id));
+    memcpy(result.data + sizeof(file_id), &num, sizeof(num));
+    return result;
+  }
+
+  template <typename T>
+  static void Delete(const leveldb::Slice&, void* value) {
+    delete static_cast<T*>(value);
+  }
+
+  void RecordLookup(bool hit);
+
+  const size_t capacity_;
+
+  std::unique_ptr<leveldb::Cache> cache_;
+
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+};
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !STORAGE_CA_TABLE_BLOCK_CACHE_H_
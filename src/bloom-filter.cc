@@ -0,0 +1,131 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "src/bloom-filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <sys/mman.h>
+
+#include <kj/debug.h>
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+namespace {
+
+constexpr size_t kBitsPerBlock = 512;
+constexpr size_t kWordsPerBlock = kBitsPerBlock / 64;
+
+constexpr size_t kHeaderSize = 2 * sizeof(uint32_t);
+
+// 64-bit FNV-1a, followed by the MurmurHash3 finalizer, which spreads the
+// bits of short keys.
+uint64_t Hash(const string_view& key) {
+  uint64_t h = UINT64_C(0xcbf29ce484222325);
+  for (const auto ch : key) {
+    h ^= static_cast<unsigned char>(ch);
+    h *= UINT64_C(0x100000001b3);
+  }
+
+  h ^= h >> 33;
+  h *= UINT64_C(0xff51afd7ed558ccd);
+  h ^= h >> 33;
+  h *= UINT64_C(0xc4ceb9fe1a85ec53);
+  h ^= h >> 33;
+
+  return h;
+}
+
+// Calls `f' with the word and bit mask of each probe of `hash'.  The upper
+// half of the hash selects the block, and each probe takes the top 9 bits of
+// the hash after one more multiplication by an odd constant.
+template <typename Function>
+void ForEachProbe(uint64_t hash, uint32_t num_probes, uint32_t num_blocks,
+                  Function&& f) {
+  const uint64_t block = ((hash >> 32) * num_blocks) >> 32;
+
+  uint64_t h = hash;
+  for (uint32_t i = 0; i < num_probes; ++i) {
+    h *= UINT64_C(0x9e3779b97f4a7c15);
+    const uint32_t bit = h >> 55;
+    f(block * kWordsPerBlock + bit / 64, UINT64_C(1) << (bit % 64));
+  }
+}
+
+}  // namespace
+
+BloomFilter::BloomFilter(const std::string& data) {
+  KJ_REQUIRE(data.size() >= kHeaderSize, "truncated Bloom filter");
+  memcpy(&num_probes_, data.data(), sizeof(num_probes_));
+  memcpy(&num_blocks_, data.data() + sizeof(num_probes_), sizeof(num_blocks_));
+  KJ_REQUIRE(num_blocks_ > 0 &&
+                 data.size() ==
+                     kHeaderSize + num_blocks_ * kWordsPerBlock * 8,
+             "corrupt Bloom filter", num_blocks_, data.size());
+
+  words_.resize(num_blocks_ * kWordsPerBlock);
+  memcpy(words_.data(), data.data() + kHeaderSize,
+         words_.size() * sizeof(uint64_t));
+}
+
+bool BloomFilter::MayContain(const string_view& key) const {
+  if (!num_blocks_) return true;
+
+  bool result = true;
+  ForEachProbe(Hash(key), num_probes_, num_blocks_,
+               [this, &result](size_t word, uint64_t mask) {
+                 if (!(words_[word] & mask)) result = false;
+               });
+  return result;
+}
+
+void BloomFilter::LockMemory() const {
+  if (words_.empty()) return;
+  KJ_SYSCALL(mlock(words_.data(), words_.size() * sizeof(uint64_t)));
+}
+
+// The size of a standard Bloom filter with the given false positive rate,
+// plus 10% to make up for the uneven filling of blocks.
+BloomFilterBuilder::BloomFilterBuilder(double false_positive_rate)
+    : bits_per_key_(-std::log(false_positive_rate) / (M_LN2 * M_LN2) * 1.1),
+      num_probes_(std::min(
+          30U, std::max(1U, static_cast<unsigned>(
+                                std::lround(bits_per_key_ * M_LN2))))) {
+  KJ_REQUIRE(false_positive_rate > 0 && false_positive_rate < 1,
+             "invalid false positive rate", false_positive_rate);
+}
+
+void BloomFilterBuilder::AddKey(const string_view& key) {
+  hashes_.emplace_back(Hash(key));
+}
+
+std::string BloomFilterBuilder::Finish() const {
+  const auto num_bits = static_cast<uint64_t>(
+      std::ceil(hashes_.size() * bits_per_key_));
+  const uint64_t blocks = std::max<uint64_t>(
+      1, (num_bits + kBitsPerBlock - 1) / kBitsPerBlock);
+  KJ_REQUIRE(blocks <= UINT32_MAX, "too many keys for a Bloom filter");
+  const uint32_t num_blocks = blocks;
+
+  std::vector<uint64_t> words(num_blocks * kWordsPerBlock);
+  for (const auto hash : hashes_) {
+    ForEachProbe(hash, num_probes_, num_blocks,
+                 [&words](size_t word, uint64_t mask) { words[word] |= mask; });
+  }
+
+  std::string result(kHeaderSize + words.size() * sizeof(uint64_t), 0);
+  memcpy(&result[0], &num_probes_, sizeof(num_probes_));
+  memcpy(&result[sizeof(num_probes_)], &num_blocks, sizeof(num_blocks));
+  memcpy(&result[kHeaderSize], words.data(), words.size() * sizeof(uint64_t));
+
+  return result;
+}
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
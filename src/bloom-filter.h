@@ -0,0 +1,65 @@
+#ifndef STORAGE_CA_TABLE_BLOOM_FILTER_H_
+#define STORAGE_CA_TABLE_BLOOM_FILTER_H_ 1
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "src/ca-table.h"
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+// A blocked Bloom filter over the keys of a table.  Each key sets and tests
+// bits within a single 64 byte block, so that a test touches one cache line.
+// This costs a slightly higher false positive rate than a standard Bloom
+// filter of the same size.
+//
+// The serialized filter holds the number of probes per key and the number of
+// blocks, as 32-bit integers in host byte order, followed by the blocks.
+class BloomFilter {
+ public:
+  // Creates a filter that contains every key.
+  BloomFilter() {}
+
+  // Reads a filter serialized by BloomFilterBuilder::Finish().
+  explicit BloomFilter(const std::string& data);
+
+  // Returns false if `key' is certainly not in the table.
+  bool MayContain(const string_view& key) const;
+
+  size_t MemoryUsage() const { return words_.capacity() * sizeof(uint64_t); }
+
+  // Locks the filter in memory.
+  void LockMemory() const;
+
+ private:
+  uint32_t num_probes_ = 0;
+  uint32_t num_blocks_ = 0;
+  std::vector<uint64_t> words_;
+};
+
+// Collects the keys of a table, and builds a filter for them.
+class BloomFilterBuilder {
+ public:
+  // Builds a filter with the given rate of false positives, between 0 and 1.
+  explicit BloomFilterBuilder(double false_positive_rate);
+
+  void AddKey(const string_view& key);
+
+  // Returns the serialized filter.
+  std::string Finish() const;
+
+ private:
+  const double bits_per_key_;
+  const uint32_t num_probes_;
+
+  std::vector<uint64_t> hashes_;
+};
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !STORAGE_CA_TABLE_BLOOM_FILTER_H_
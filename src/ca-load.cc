@@ -70,12 +70,17 @@ enum Option {
   kDateFormatOption,
   kDelimiterOption,
   kInputFormatOption,
+  kInputSortBuffer,
   kInputUnsorted,
   kKeyFilterOption,
   kMergeModeMotion,
   kOutputBackend,
+  kOutputBlockSize,
+  kOutputBloomFilter,
   kOutputCompression,
+  kOutputCompressionDictionary,
   kOutputCompressionLevel,
+  kOutputCompressionThreads,
   kOutputSeekable,
   kOutputTypeOption,
   kSchemaOption,
@@ -90,14 +95,21 @@ struct option kLongOptions[] = {
     {"date-format", required_argument, nullptr, kDateFormatOption},
     {"delimiter", required_argument, nullptr, kDelimiterOption},
     {"input-format", required_argument, nullptr, kInputFormatOption},
+    {"input-sort-buffer", required_argument, nullptr, kInputSortBuffer},
     {"input-unsorted", no_argument, nullptr, kInputUnsorted},
     {"key-filter", required_argument, nullptr, kKeyFilterOption},
     {"merge-mode", required_argument, nullptr, kMergeModeMotion},
     {"no-unescape", no_argument, &no_unescape, 1},
     {"output-backend", required_argument, nullptr, kOutputBackend},
+    {"output-block-size", required_argument, nullptr, kOutputBlockSize},
+    {"output-bloom-filter", required_argument, nullptr, kOutputBloomFilter},
     {"output-compression", required_argument, nullptr, kOutputCompression},
+    {"output-compression-dictionary", required_argument, nullptr,
+     kOutputCompressionDictionary},
     {"output-compression-level", required_argument, nullptr,
      kOutputCompressionLevel},
+    {"output-compression-threads", required_argument, nullptr,
+     kOutputCompressionThreads},
     {"output-seekable", no_argument, nullptr, kOutputSeekable},
     {"output-type", required_argument, nullptr, kOutputTypeOption},
     {"output-format", required_argument, nullptr, kOutputTypeOption},
@@ -577,6 +589,11 @@ int main(int argc, char** argv) try {
   ca_table::TableCompression output_compression =
       ca_table::kTableCompressionDefault;
   uint64_t output_compression_level = 0;
+  uint64_t output_compression_dictionary = 0;
+  uint64_t output_compression_threads = 0;
+  uint64_t output_block_size = 0;
+  uint64_t input_sort_buffer = 0;
+  double output_bloom_filter = 0;
   bool output_seekable = false;
 
   const char* schema_path = NULL;
@@ -622,6 +639,10 @@ int main(int argc, char** argv) try {
         }
         break;
 
+      case kInputSortBuffer:
+        input_sort_buffer = ca_table::internal::StringToUInt64(optarg);
+        break;
+
       case kInputUnsorted:
         input_unsorted = true;
         break;
@@ -658,9 +679,23 @@ int main(int argc, char** argv) try {
         output_backend = optarg;
         break;
 
+      case kOutputBlockSize:
+        output_block_size = ca_table::internal::StringToUInt64(optarg);
+        break;
+
+      case kOutputBloomFilter: {
+        char* endptr;
+        output_bloom_filter = strtod(optarg, &endptr);
+        if (*endptr || !(output_bloom_filter >= 0 && output_bloom_filter < 1))
+          errx(EX_USAGE, "Invalid Bloom filter false positive rate '%s'",
+               optarg);
+      } break;
+
       case kOutputCompression:
         if (!strcmp(optarg, "none")) {
           output_compression = ca_table::kTableCompressionNone;
+        } else if (!strcmp(optarg, "lz4")) {
+          output_compression = ca_table::kTableCompressionLZ4;
         } else if (!strcmp(optarg, "zstd")) {
           output_compression = ca_table::kTableCompressionZSTD;
         } else if (strcmp(optarg, "default")) {
@@ -668,10 +703,20 @@ int main(int argc, char** argv) try {
         }
         break;
 
+      case kOutputCompressionDictionary:
+        output_compression_dictionary =
+            ca_table::internal::StringToUInt64(optarg);
+        break;
+
       case kOutputCompressionLevel:
         output_compression_level = ca_table::internal::StringToUInt64(optarg);
         break;
 
+      case kOutputCompressionThreads:
+        output_compression_threads =
+            ca_table::internal::StringToUInt64(optarg);
+        break;
+
       case kOutputSeekable:
         output_seekable = true;
         break;
@@ -710,6 +755,9 @@ int main(int argc, char** argv) try {
         "      --date=DATE            use DATE as timestamp\n"
         "      --delimiter=DELIMITER  input delimiter [%c]\n"
         "      --input-format=FORMAT  format of input data\n"
+        "      --input-sort-buffer=SIZE\n"
+        "                             memory for sorting unsorted input, in\n"
+        "                               bytes (write-once only)\n"
         "      --input-unsorted       input data is not sorted\n"
         "      --key=KEY              use KEY as key\n"
         "      --key-filter=REGEX     skip input keys matching REGEX\n"
@@ -717,11 +765,26 @@ int main(int argc, char** argv) try {
         "      --no-unescape          don't apply any unescaping logic\n"
         "      --output-backend=TYPE  type of output storage backend\n"
         "                               (leveldb-table|write-once)\n"
+        "      --output-block-size=SIZE\n"
+        "                             target size of output table blocks, in\n"
+        "                               bytes; smaller blocks make lookups\n"
+        "                               faster, larger ones scans\n"
+        "      --output-bloom-filter=RATE\n"
+        "                             store a Bloom filter of the keys that\n"
+        "                               accepts RATE of absent keys, e.g.\n"
+        "                               0.01 (write-once only)\n"
         "      --output-compression=TYPE\n"
         "                             output compression method\n"
-        "                               (default|none|zstd)\n"
+        "                               (default|none|lz4|zstd)\n"
+        "      --output-compression-dictionary=SIZE\n"
+        "                             train a zstd dictionary of up to SIZE\n"
+        "                               bytes for the output table\n"
         "      --output-compression-level=LEVEL\n"
-        "                             output compression level\n"
+        "                             output compression level; for lz4,\n"
+        "                               0 is fast and 1-12 are HC levels\n"
+        "      --output-compression-threads=N\n"
+        "                             compress output blocks in N threads;\n"
+        "                               0 uses one per CPU (write-once only)\n"
         "      --output-seekable      output needs to be seekable\n"
         "      --output-type=TYPE     type of output table\n"
         "                               (index|summaries|time-series)\n"
@@ -775,7 +838,12 @@ int main(int argc, char** argv) try {
   output_options.SetFileMode(0444)
       .SetCompression(output_compression)
       .SetCompressionLevel(output_compression_level)
+      .SetCompressionDictionarySize(output_compression_dictionary)
+      .SetCompressionThreads(output_compression_threads)
+      .SetBlockSize(output_block_size)
+      .SetBloomFilterFalsePositiveRate(output_bloom_filter)
       .SetInputUnsorted(input_unsorted)
+      .SetSortBufferSize(input_sort_buffer)
       .SetOutputSeekable(output_seekable);
 
   if (!output_backend) output_backend = "leveldb-table";
@@ -957,6 +1025,28 @@ int main(int argc, char** argv) try {
   if (!values.empty()) FlushValues(current_key);
 
   table_handle->Sync();
+
+  if (output_compression_dictionary) {
+    const auto stats = table_handle->GetCompressionStats();
+    if (stats.dictionary_bytes) {
+      fprintf(stderr,
+              "Compression dictionary: %llu bytes; sample blocks compress to "
+              "%llu bytes, %llu without it (%.1f%% smaller)\n",
+              static_cast<unsigned long long>(stats.dictionary_bytes),
+              static_cast<unsigned long long>(
+                  stats.sample_bytes_with_dictionary),
+              static_cast<unsigned long long>(
+                  stats.sample_bytes_without_dictionary),
+              100.0 * (1.0 - double(stats.sample_bytes_with_dictionary) /
+                                 stats.sample_bytes_without_dictionary));
+    } else {
+      fprintf(stderr,
+              "Compression dictionary: too little data to train, not used\n");
+    }
+    fprintf(stderr, "Table blocks: %llu bytes, %llu compressed\n",
+            static_cast<unsigned long long>(stats.uncompressed_bytes),
+            static_cast<unsigned long long>(stats.compressed_bytes));
+  }
 } catch (kj::Exception e) {
   KJ_LOG(FATAL, e);
   return EXIT_FAILURE;
@@ -22,6 +22,8 @@
 #endif
 
 #include <cerrno>
+#include <cinttypes>
+#include <csignal>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -41,8 +43,12 @@
 #include <readline/history.h>
 #include <readline/readline.h>
 
+#include "src/batch.h"
 #include "src/ca-table.h"
 #include "src/query.h"
+#include "src/schema.h"
+#include "src/server.h"
+#include "src/warmup.h"
 
 namespace ca_table = cantera::table;
 
@@ -50,16 +56,26 @@ namespace {
 
 enum Option : int {
   kOptionCommand = 'c',
+  kOptionJobs = 'j',
+  kOptionListen = 'l',
+  kOptionWarmUp = 'w',
   kOptionUnknown = '?',
+  kOptionBlockCache = 256,
 };
 
 int print_version;
 int print_help;
+int lock_memory;
 
 const char kDefaultSchemaPath[] = "/data/index/current/schema.txt";
 
 struct option kLongOptions[] = {
+    {"block-cache", required_argument, NULL, kOptionBlockCache},
     {"command", required_argument, NULL, kOptionCommand},
+    {"jobs", required_argument, NULL, kOptionJobs},
+    {"listen", required_argument, NULL, kOptionListen},
+    {"warmup", optional_argument, NULL, kOptionWarmUp},
+    {"mlock", no_argument, &lock_memory, 1},
     {"version", no_argument, &print_version, 1},
     {"help", no_argument, &print_help, 1},
     {nullptr, 0, nullptr, 0}};
@@ -98,18 +114,44 @@ int main(int argc, char** argv) try {
   ca_table::QueryParseContext context;
   const char* schema_path = nullptr;
   const char* command = nullptr;
+  const char* listen_path = nullptr;
+  const char* warm_up_keys_path = nullptr;
+  bool warm_up = false;
+  size_t jobs = 1;
   int i;
 
-  strcpy(ca_table::CA_time_format, "%Y-%m-%dT%H:%M:%S");
-
-  while (-1 != (i = getopt_long(argc, argv, "c:", kLongOptions, 0))) {
+  while (-1 != (i = getopt_long(argc, argv, "c:j:l:w::", kLongOptions, 0))) {
     if (!i) continue;
 
     switch (static_cast<Option>(i)) {
+      case kOptionBlockCache: {
+        char* endptr;
+        const auto megabytes = strtoul(optarg, &endptr, 0);
+        if (*endptr)
+          errx(EX_USAGE, "Invalid block cache size: %s", optarg);
+        ca_table::SetBlockCacheCapacity(size_t(megabytes) << 20);
+      } break;
+
       case kOptionCommand:
         command = optarg;
         break;
 
+      case kOptionJobs: {
+        char* endptr;
+        jobs = strtoul(optarg, &endptr, 0);
+        if (*endptr || !jobs)
+          errx(EX_USAGE, "Invalid number of jobs: %s", optarg);
+      } break;
+
+      case kOptionListen:
+        listen_path = optarg;
+        break;
+
+      case kOptionWarmUp:
+        warm_up = true;
+        warm_up_keys_path = optarg;
+        break;
+
       case kOptionUnknown:
         errx(EX_USAGE, "Try '%s --help' for more information.", argv[0]);
     }
@@ -119,7 +161,20 @@ int main(int argc, char** argv) try {
     printf(
         "Usage: %s [OPTION]... [SCHEMA]\n"
         "\n"
+        "      --block-cache=MB       keep up to MB megabytes of decoded\n"
+        "                             table blocks in memory (default 256)\n"
         "  -c, --command=STRING       execute commands in STRING and exit\n"
+        "  -j, --jobs=N               execute up to N independent statements\n"
+        "                             read from standard input at once, still\n"
+        "                             printing the results in order\n"
+        "  -l, --listen=PATH          serve clients connecting to the Unix\n"
+        "                             socket PATH\n"
+        "  -w, --warmup[=FILE]        read the block indexes of all tables,\n"
+        "                             and the keys listed in FILE, at startup\n"
+        "                             and on every reload; keys ending in '*'\n"
+        "                             are prefixes\n"
+        "      --mlock                lock the block indexes in memory;\n"
+        "                             implies --warmup\n"
         "      --help     display this help and exit\n"
         "      --version  display version information and exit\n"
         "\n"
@@ -144,9 +199,39 @@ int main(int argc, char** argv) try {
     errx(EX_USAGE, "Usage: %s [OPTION]... [SCHEMA]", argv[0]);
   }
 
-  context.schema = std::make_unique<ca_table::Schema>(schema_path);
+  if (listen_path) {
+    // The server handles SIGHUP in a thread of its own.  Blocking it here,
+    // before warming up starts the thread pool, blocks it in every thread.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    const auto ret = pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    if (ret != 0) KJ_FAIL_SYSCALL("pthread_sigmask", ret);
+  }
 
-  if (command) {
+  context.schemas = std::make_shared<ca_table::SchemaGenerations>(schema_path);
+
+  if (warm_up || lock_memory) {
+    ca_table::WarmUpOptions options;
+    if (warm_up_keys_path)
+      options.keys = ca_table::ReadWarmUpKeys(warm_up_keys_path);
+    options.lock = lock_memory;
+
+    ca_table::WarmUp(context.schemas->Current().get(), options,
+                     [](const ca_table::WarmUpProgress& progress) {
+                       fprintf(stderr,
+                               "Warming up: %zu/%zu tables, %" PRIu64
+                               " index bytes, %" PRIu64 " hot rows\n",
+                               progress.tables_done, progress.tables_total,
+                               progress.index_bytes, progress.rows);
+                     });
+
+    context.schemas->SetWarmUpOptions(std::move(options));
+  }
+
+  if (listen_path) {
+    ca_table::RunServer(listen_path, context.schemas);
+  } else if (command) {
     KJ_CONTEXT(command);
 
     parse_string(context, command, true);
@@ -203,8 +288,21 @@ int main(int argc, char** argv) try {
 
     setvbuf(stdout, buf, _IOFBF, sizeof buf);
 
+    std::unique_ptr<ca_table::BatchExecutor> batch;
+    if (jobs > 1) {
+      batch = std::make_unique<ca_table::BatchExecutor>(&context, jobs, stdout);
+      context.batch = batch.get();
+    }
+
     try {
-      CA_parse_script(&context, stdin);
+      try {
+        CA_parse_script(&context, stdin);
+      } catch (...) {
+        // The results of the statements before a syntax error come first.
+        if (batch) batch->Finish();
+        throw;
+      }
+      if (batch) batch->Finish();
     } catch (kj::Exception e) {
       stdout_error(e.getDescription().cStr());
     }
@@ -0,0 +1,611 @@
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+#include <kj/debug.h>
+
+#include "src/ca-table.h"
+#include "src/schema.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace cantera::table;
+
+static constexpr char name_template[] = "/tmp/ca-table-test-XXXXXX";
+
+struct CaShellTest : testing::Test {
+
+ public:
+  void SetUp() override {
+    char name[sizeof(name_template)];
+    strcpy(name, name_template);
+    ASSERT_NE(mkdtemp(name), nullptr);
+    temp_directory_ = name;
+
+    // An empty schema, for statements that read no tables.
+    schema_path_ = temp_directory_ + "/schema.txt";
+    WriteSchema("");
+  }
+
+  void TearDown() override {
+    std::string cmd;
+    cmd.append("rm -rf ");
+    cmd.append(temp_directory_);
+    system(cmd.c_str());
+  }
+
+ protected:
+  void WriteSchema(const std::string& schema) {
+    FILE* output = fopen(schema_path_.c_str(), "w");
+    KJ_REQUIRE(output != nullptr, schema_path_);
+    fputs(schema.c_str(), output);
+    fclose(output);
+  }
+
+  // Executes `command' with ca-shell, and returns its standard output.
+  std::string Run(const std::string& command) {
+    const auto command_arg = "--command=" + command;
+    return Execute({command_arg.c_str()}, "/dev/null", command);
+  }
+
+  // Executes `script' with ca-shell, reading it from standard input and
+  // running up to `jobs' statements at once, and returns its standard output.
+  std::string RunScript(const std::string& script, size_t jobs = 1) {
+    const auto script_path = temp_directory_ + "/script";
+    FILE* input = fopen(script_path.c_str(), "w");
+    KJ_REQUIRE(input != nullptr, script_path);
+    fputs(script.c_str(), input);
+    fclose(input);
+
+    const auto jobs_arg = "--jobs=" + std::to_string(jobs);
+    return Execute({jobs_arg.c_str()}, script_path, script);
+  }
+
+  // Starts ca-shell reading statements from the returned stream, so that
+  // files can be changed between statements.  The stream must be closed with
+  // pclose().
+  FILE* Start() {
+    const auto command =
+        "exec ./ca-shell " + schema_path_ + " > " + OutputPath();
+    FILE* input = popen(command.c_str(), "w");
+    KJ_REQUIRE(input != nullptr, command);
+    return input;
+  }
+
+  // Waits for a ca-shell started by Start() to write `lines' lines, and
+  // returns its output.
+  std::string WaitForOutput(size_t lines) {
+    std::string result;
+    for (int i = 0; i < 1000; ++i) {
+      result = ReadOutput();
+      if (static_cast<size_t>(std::count(result.begin(), result.end(),
+                                         '\n')) >= lines)
+        break;
+      usleep(10000);
+    }
+    return result;
+  }
+
+  std::string temp_directory_;
+  std::string schema_path_;
+
+ private:
+  std::string OutputPath() const { return temp_directory_ + "/output"; }
+
+  std::string ReadOutput() {
+    std::string result;
+    FILE* output = fopen(OutputPath().c_str(), "r");
+    if (!output) return result;
+    char buffer[4096];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), output)) > 0)
+      result.append(buffer, size);
+    fclose(output);
+    return result;
+  }
+
+  // Runs ca-shell with `args' and the schema, reading standard input from
+  // `input_path', and returns its standard output.
+  std::string Execute(std::vector<const char*> args,
+                      const std::string& input_path,
+                      const std::string& description) {
+    const auto output_path = OutputPath();
+    args.insert(args.begin(), "./ca-shell");
+    args.emplace_back(schema_path_.c_str());
+    args.emplace_back(nullptr);
+
+    pid_t child;
+    KJ_SYSCALL(child = fork());
+    if (!child) {
+      const int in = open(input_path.c_str(), O_RDONLY);
+      if (in == -1 || dup2(in, STDIN_FILENO) == -1) _exit(EXIT_FAILURE);
+      const int fd = creat(output_path.c_str(), 0666);
+      if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1) _exit(EXIT_FAILURE);
+      execve(args[0], const_cast<char* const*>(&args[0]), nullptr);
+      _exit(EXIT_FAILURE);
+    }
+
+    int status;
+    KJ_SYSCALL(waitpid(child, &status, 0));
+    EXPECT_EQ(0, status) << description;
+
+    return ReadOutput();
+  }
+};
+
+TEST_F(CaShellTest, ExecutesPreparedStatements) {
+  EXPECT_EQ("a\nb\n", Run("PREPARE p AS PARSE $1; EXECUTE p(a); "
+                          "EXECUTE p(b);"));
+}
+
+// Parameters only have values in prepared statements, and are rejected
+// elsewhere rather than executed without one.
+TEST_F(CaShellTest, RejectsParametersOutsidePreparedStatements) {
+  for (const auto& command : {"PARSE $1;", "QUERY ($1);", "QUERY (KEY=$1);"}) {
+    const auto output = Run(command);
+    EXPECT_NE(std::string::npos,
+              output.find("parameters are only allowed in prepared"))
+        << command << ": " << output;
+  }
+}
+
+// Writes an index with the keys "a" to "h", where the key at position `i' in
+// the alphabet lists every (i + 1)th offset below 20000.  If `shard_count' is
+// greater than one, only the offsets equal to `shard' modulo `shard_count' are
+// written.
+void WriteIndex(const std::string& path, uint64_t shard = 0,
+                uint64_t shard_count = 1) {
+  auto builder =
+      TableFactory::Create("write-once", path.c_str(), TableOptions());
+  for (char key = 'a'; key <= 'h'; ++key) {
+    std::vector<ca_offset_score> values;
+    for (uint64_t offset = 0; offset < 20000; offset += key - 'a' + 1) {
+      if (offset % shard_count == shard) values.emplace_back(offset, 1.0f);
+    }
+    ca_table_write_offset_score(builder.get(), std::string(1, key),
+                                values.data(), values.size());
+  }
+  builder->Sync();
+}
+
+// Writes a summary table at `summary_path' with `count' documents, whose keys
+// are "doc000", "doc001", ..., and an index at `index_path' in which the key at
+// position `i' in the alphabet lists every (i + 1)th document.  The score of a
+// document is its number.  Returns the offsets of the documents.
+std::vector<uint64_t> WriteDocuments(const std::string& summary_path,
+                                     const std::string& index_path,
+                                     size_t count) {
+  {
+    auto builder =
+        TableFactory::Create("write-once", summary_path.c_str(),
+                             TableOptions::Create().SetOutputSeekable(true));
+    for (size_t i = 0; i < count; ++i) {
+      char key[16];
+      snprintf(key, sizeof(key), "doc%03zu", i);
+      builder->InsertRow(key, "{\"n\":" + std::to_string(i) + "}");
+    }
+    builder->Sync();
+  }
+
+  // The index refers to documents by their position in the summary table.
+  std::vector<uint64_t> offsets;
+  auto summary = TableFactory::OpenSeekable(nullptr, summary_path.c_str());
+  cantera::string_view row_key, data;
+  for (;;) {
+    const auto offset = summary->Offset();
+    if (!summary->ReadRow(row_key, data)) break;
+    offsets.emplace_back(offset);
+  }
+  KJ_REQUIRE(offsets.size() == count, offsets.size());
+
+  auto builder =
+      TableFactory::Create("write-once", index_path.c_str(), TableOptions());
+  for (char key = 'a'; key <= 'h'; ++key) {
+    std::vector<ca_offset_score> values;
+    for (size_t i = 0; i < count; i += key - 'a' + 1)
+      values.emplace_back(offsets[i], i);
+    ca_table_write_offset_score(builder.get(), std::string(1, key),
+                                values.data(), values.size());
+  }
+  builder->Sync();
+
+  return offsets;
+}
+
+// Returns the number following `"field":' in the JSON `output', or -1 if
+// there is none.
+int64_t JSONNumber(const std::string& output, const std::string& field) {
+  const auto i = output.find("\"" + field + "\":");
+  if (i == std::string::npos) return -1;
+  return std::stoll(output.substr(i + field.size() + 3));
+}
+
+// Returns true if `output' is a single JSON error object containing
+// `message'.
+bool IsError(const std::string& output, const std::string& message) {
+  return !output.compare(0, 10, "{\"error\":\"") &&
+         output.find('\n') == output.size() - 1 &&
+         output.find(message) != std::string::npos;
+}
+
+static constexpr char kMemoryQuery[] =
+    "EXPLAIN ANALYZE QUERY (a OR b OR c AND d OR e AND f - g OR h);";
+
+TEST_F(CaShellTest, QueryMemoryLimit) {
+  const auto index_path = temp_directory_ + "/index";
+  WriteIndex(index_path);
+  WriteSchema("index\t" + index_path + "\n");
+
+  auto output = Run("SET MEMORY LIMIT 1000; " + std::string(kMemoryQuery));
+  EXPECT_TRUE(IsError(output, "query memory limit exceeded")) << output;
+
+  output = Run("SET MEMORY LIMIT 0; " + std::string(kMemoryQuery));
+  EXPECT_EQ(3499, JSONNumber(output, "result-count")) << output;
+  EXPECT_GT(JSONNumber(output, "peak-memory-bytes"), 0) << output;
+
+  // Intermediate results are uncharged exactly as they were charged, so a
+  // query either completes within the limit or fails cleanly.
+  for (const int64_t limit : {50000, 200000, 500000, 2000000}) {
+    output = Run("SET MEMORY LIMIT " + std::to_string(limit) + "; " +
+                 kMemoryQuery +
+                 " EXPLAIN ANALYZE QUERY ((a AND b) OR (a AND b) OR c);");
+    if (IsError(output, "query memory limit exceeded")) continue;
+    EXPECT_EQ(3499, JSONNumber(output, "result-count")) << output;
+    const auto peak = JSONNumber(output, "peak-memory-bytes");
+    EXPECT_GT(peak, 0) << output;
+    EXPECT_LE(peak, limit) << output;
+  }
+}
+
+// The offsets of a key found in several index tables are merged, and the
+// lists they replace are no longer charged.
+TEST_F(CaShellTest, QueryMemoryWithSplitIndex) {
+  const auto index_path = temp_directory_ + "/index";
+  WriteIndex(index_path);
+  WriteSchema("index\t" + index_path + "\n");
+  const auto single = Run(kMemoryQuery);
+  const auto single_peak = JSONNumber(single, "peak-memory-bytes");
+  ASSERT_GT(single_peak, 0) << single;
+
+  std::string schema;
+  for (uint64_t shard = 0; shard < 8; ++shard) {
+    const auto path = index_path + std::to_string(shard);
+    WriteIndex(path, shard, 8);
+    schema += "index\t" + path + "\n";
+  }
+  WriteSchema(schema);
+  const auto split = Run(kMemoryQuery);
+  EXPECT_EQ(JSONNumber(single, "result-count"),
+            JSONNumber(split, "result-count"))
+      << split;
+  EXPECT_LE(JSONNumber(split, "peak-memory-bytes"), 2 * single_peak) << split;
+}
+
+TEST_F(CaShellTest, ExplainAnalyzeAppliesFetchAndOffset) {
+  const auto index_path = temp_directory_ + "/index";
+  WriteIndex(index_path);
+  WriteSchema("index\t" + index_path + "\n");
+
+  const std::vector<std::pair<std::string, int64_t>> cases{
+      {"", 20000},
+      {" LIMIT 10", 10},
+      {" LIMIT 10 OFFSET 19995 ROWS", 5},
+      {" OFFSET 20000 ROWS", 0}};
+  for (const auto& c : cases) {
+    const auto output = Run("EXPLAIN ANALYZE QUERY (a)" + c.first + ";");
+    EXPECT_EQ(20000, JSONNumber(output, "result-count")) << output;
+    EXPECT_EQ(c.second, JSONNumber(output, "rows")) << output;
+  }
+
+  const auto output =
+      Run("SET OUTPUT FORMAT CSV; EXPLAIN ANALYZE QUERY (a) LIMIT 10;");
+  EXPECT_NE(std::string::npos, output.find(" result-count=20000 rows=10 "))
+      << output;
+}
+
+TEST_F(CaShellTest, ExplainAnalyzeRejectsOutputClauses) {
+  const auto index_path = temp_directory_ + "/index";
+  WriteIndex(index_path);
+  WriteSchema("index\t" + index_path + "\n");
+
+  EXPECT_TRUE(IsError(
+      Run("EXPLAIN ANALYZE QUERY (a) THRESHOLDS 1, 2 FOR KEY 'b';"),
+      "THRESHOLDS"));
+  EXPECT_TRUE(
+      IsError(Run("EXPLAIN ANALYZE QUERY KEYS FOR (a);"), "KEYS FOR"));
+}
+
+// A key that appears in several leaves is looked up once, and the other
+// leaves say so instead of reporting no I/O.
+TEST_F(CaShellTest, ExplainAnalyzeMarksSharedLookups) {
+  const auto index_path = temp_directory_ + "/index";
+  WriteIndex(index_path);
+  WriteSchema("index\t" + index_path + "\n");
+
+  const auto output = Run("EXPLAIN ANALYZE QUERY (a AND b OR a);");
+  const auto shared = output.find("shared-lookup");
+  EXPECT_NE(std::string::npos, shared) << output;
+  EXPECT_EQ(std::string::npos, output.find("shared-lookup", shared + 1))
+      << output;
+}
+
+// Statements run concurrently with --jobs, but their results are written in
+// the order of the script.
+TEST_F(CaShellTest, BatchPreservesStatementOrder) {
+  const auto summary_path = temp_directory_ + "/summary";
+  const auto index_path = temp_directory_ + "/index";
+  WriteDocuments(summary_path, index_path, 100);
+  WriteSchema("summary\t" + summary_path + "\nindex\t" + index_path + "\n");
+
+  std::string script;
+  for (char key = 'a'; key <= 'h'; ++key) {
+    const std::string k(1, key);
+    script += "QUERY (" + k + " OR h) LIMIT 3; QUERY COUNT (a AND " + k +
+              "); PARSE " + k + ";\n";
+  }
+
+  const auto serial = RunScript(script);
+  // Three rows, a count, and the parsed key for each line of the script.
+  EXPECT_EQ(8 * 5, std::count(serial.begin(), serial.end(), '\n')) << serial;
+  EXPECT_EQ(serial, RunScript(script, 4));
+}
+
+// A failing statement ends the script.  The results of the statements before
+// it are written first, and the later statements are not executed.
+TEST_F(CaShellTest, BatchStopsAtFailedStatement) {
+  const auto summary_path = temp_directory_ + "/summary";
+  const auto index_path = temp_directory_ + "/index";
+  WriteDocuments(summary_path, index_path, 100);
+  WriteSchema("summary\t" + summary_path + "\nindex\t" + index_path + "\n");
+
+  const auto script =
+      "SET MEMORY LIMIT 1000; QUERY COUNT (a); QUERY COUNT (b); PARSE c;" +
+      std::string(kMemoryQuery) + " QUERY COUNT (d); PARSE e;";
+
+  const auto output = RunScript(script, 4);
+  EXPECT_EQ(0, output.find("{\"result-count\":100}\n"
+                           "{\"result-count\":50}\n"
+                           "c\n"
+                           "{\"error\":"))
+      << output;
+  EXPECT_TRUE(IsError(output.substr(output.find("{\"error\":")),
+                      "query memory limit exceeded"))
+      << output;
+  EXPECT_EQ(RunScript(script), output);
+}
+
+// SET only applies to the statements after it, even if earlier statements
+// are still running.
+TEST_F(CaShellTest, BatchAppliesSetInOrder) {
+  const auto summary_path = temp_directory_ + "/summary";
+  const auto index_path = temp_directory_ + "/index";
+  WriteDocuments(summary_path, index_path, 100);
+  WriteSchema("summary\t" + summary_path + "\nindex\t" + index_path + "\n");
+
+  const auto script =
+      "QUERY (a AND h) LIMIT 2; QUERY COUNT (a OR b OR c AND d OR e AND f);"
+      " SET OUTPUT FORMAT CSV; QUERY (a AND h) LIMIT 2;"
+      " SET MEMORY LIMIT 1000; QUERY COUNT (b);" +
+      std::string(kMemoryQuery);
+
+  const auto output = RunScript(script, 4);
+  EXPECT_EQ(0, output.find("{\"result-count\":13,\"result\":["
+                           "{\"_key\":\"doc096\",\"n\":96},\n"
+                           "{\"_key\":\"doc088\",\"n\":88}]}\n"
+                           "{\"result-count\":"))
+      << output;
+  EXPECT_NE(std::string::npos,
+            output.find("}\n"
+                        "13\n"
+                        "{\"_key\":\"doc096\",\"n\":96}\n"
+                        "{\"_key\":\"doc088\",\"n\":88}\n"
+                        "50\n"
+                        "{\"error\":"))
+      << output;
+  EXPECT_EQ(RunScript(script), output);
+}
+
+// QUERY COUNT counts without materializing results where it can, and must
+// agree with the result count of the same QUERY.
+TEST_F(CaShellTest, QueryCountMatchesQuery) {
+  const auto summary_path = temp_directory_ + "/summary";
+  const auto index_path = temp_directory_ + "/index";
+  const auto offsets = WriteDocuments(summary_path, index_path, 100);
+
+  // A second index listing "b" for every seventh document, half of which are
+  // also in the first index.
+  const auto extra_index_path = temp_directory_ + "/index-extra";
+  {
+    auto builder = TableFactory::Create("write-once", extra_index_path.c_str(),
+                                        TableOptions());
+    std::vector<ca_offset_score> values;
+    for (size_t i = 0; i < offsets.size(); i += 7)
+      values.emplace_back(offsets[i], i);
+    ca_table_write_offset_score(builder.get(), "b", values.data(),
+                                values.size());
+    builder->Sync();
+  }
+
+  WriteSchema("summary\t" + summary_path + "\nindex\t" + index_path +
+              "\nindex\t" + extra_index_path + "\n");
+
+  const std::vector<std::pair<std::string, int64_t>> cases{
+      {"(c)", 34},
+      {"(b)", 57},
+      {"(b AND c)", 19},
+      {"(b OR c)", 72},
+      {"(b - c)", 38},
+      {"(b AND c OR d - e)", 28}};
+  for (const auto& c : cases) {
+    const auto count = Run("QUERY COUNT " + c.first + ";");
+    EXPECT_EQ(c.second, JSONNumber(count, "result-count"))
+        << c.first << ": " << count;
+
+    const auto query = Run("QUERY " + c.first + ";");
+    EXPECT_EQ(c.second, JSONNumber(query, "result-count"))
+        << c.first << ": " << query;
+  }
+}
+
+// Documents are counted in the bucket [t_i, t_{i+1}) holding their value for
+// the facet key.
+TEST_F(CaShellTest, FacetCountsBuckets) {
+  const auto summary_path = temp_directory_ + "/summary";
+  const auto index_path = temp_directory_ + "/index";
+  const auto offsets = WriteDocuments(summary_path, index_path, 100);
+
+  // Document `i' has the value (i % 10) - 1 for the key "v".
+  const auto value_index_path = temp_directory_ + "/index-values";
+  {
+    auto builder = TableFactory::Create("write-once", value_index_path.c_str(),
+                                        TableOptions());
+    std::vector<ca_offset_score> values;
+    for (size_t i = 0; i < offsets.size(); ++i)
+      values.emplace_back(offsets[i], static_cast<float>(i % 10) - 1);
+    ca_table_write_offset_score(builder.get(), "v", values.data(),
+                                values.size());
+    builder->Sync();
+  }
+
+  WriteSchema("summary\t" + summary_path + "\nindex\t" + index_path +
+              "\nindex\t" + value_index_path + "\n");
+
+  // Documents with the value -1 are below the first threshold, and no
+  // document falls in the last bucket.  The scores are the document numbers.
+  EXPECT_EQ(
+      "90\n"
+      "0,3,30,1410,1,93\n"
+      "3,5,20,990,4,95\n"
+      "5,10,40,2100,6,99\n"
+      "10,20,0,0,nan,nan\n",
+      Run("SET OUTPUT FORMAT CSV; "
+          "FACET (a) BY 'v' THRESHOLDS (0, 3, 5, 10, 20) WITH SCORES;"));
+
+  // The number formatting of JSON output is up to jsoncpp, so only the
+  // counts are compared.  Empty buckets have no minimum or maximum score.
+  const auto output =
+      Run("FACET (a) BY 'v' THRESHOLDS (0, 3, 5, 10, 20) WITH SCORES;");
+  EXPECT_EQ(90, JSONNumber(output, "result-count")) << output;
+  size_t position = 0;
+  for (const auto count : {30, 20, 40, 0}) {
+    position = output.find("\"count\":" + std::to_string(count) + ",",
+                           position);
+    ASSERT_NE(std::string::npos, position) << count << ": " << output;
+  }
+  EXPECT_EQ(std::string::npos, output.find("score-min", position)) << output;
+}
+
+TEST_F(CaShellTest, SetTimeout) {
+  // An index whose keys together list a few million offsets, so that their
+  // union takes far longer than a millisecond.
+  const auto index_path = temp_directory_ + "/index";
+  std::string query;
+  {
+    auto builder =
+        TableFactory::Create("write-once", index_path.c_str(), TableOptions());
+    for (uint64_t key = 0; key < 32; ++key) {
+      std::vector<ca_offset_score> values;
+      for (uint64_t offset = key; offset < 32 * 50000; offset += 32)
+        values.emplace_back(offset, 1.0f);
+      char name[8];
+      snprintf(name, sizeof(name), "k%02" PRIu64, key);
+      ca_table_write_offset_score(builder.get(), name, values.data(),
+                                  values.size());
+      query += (key ? " OR " : "") + std::string(name);
+    }
+    builder->Sync();
+  }
+  WriteSchema("index\t" + index_path + "\n");
+  query = "EXPLAIN ANALYZE QUERY (" + query + ");";
+
+  auto output = Run("SET TIMEOUT 1; " + query);
+  EXPECT_TRUE(IsError(output, "statement timed out")) << output;
+
+  output = Run("SET TIMEOUT 1; SET TIMEOUT 0; " + query);
+  EXPECT_EQ(1600000, JSONNumber(output, "result-count")) << output;
+
+  output = Run("SET TIMEOUT -1; " + query);
+  EXPECT_TRUE(IsError(output, "timeout must not be negative")) << output;
+}
+
+// Repeated subtrees are evaluated once, and the shared result must not be
+// changed by any of its users.
+TEST_F(CaShellTest, RepeatedSubtreesGiveSameResults) {
+  const auto summary_path = temp_directory_ + "/summary";
+  const auto index_path = temp_directory_ + "/index";
+  WriteDocuments(summary_path, index_path, 100);
+  WriteSchema("summary\t" + summary_path + "\nindex\t" + index_path + "\n");
+
+  const std::vector<std::pair<std::string, std::string>> queries{
+      {"(a AND b) OR (a AND b) OR c", "(a AND b) OR c"},
+      {"(b OR c) - d OR (b OR c)", "b OR c"},
+      {"(b OR c) AND (b OR c) - (b OR c) OR (d AND e)", "(d AND e)"}};
+  for (const auto& q : queries) {
+    const auto expected = Run("QUERY (" + q.second + ") LIMIT 100;");
+    EXPECT_LT(0, JSONNumber(expected, "result-count")) << expected;
+    EXPECT_EQ(expected, Run("QUERY (" + q.first + ") LIMIT 100;")) << q.first;
+  }
+
+  // Fields that repeat the selection.
+  const auto expected = Run("SELECT (b AND a), (c), (c AND b) FROM (a AND b);");
+  EXPECT_EQ(50, std::count(expected.begin(), expected.end(), '\n'))
+      << expected;
+  EXPECT_EQ(expected, Run("SELECT (a AND b), (c), (c AND b) FROM (a AND b);"));
+  EXPECT_EQ(expected, Run("SELECT (a AND b), (c), (c AND b) FROM "
+                          "((a AND b) OR (a AND b));"));
+}
+
+// RELOAD publishes a new schema generation, which later statements use.
+TEST_F(CaShellTest, ReloadUsesChangedSchema) {
+  const auto summary_path = temp_directory_ + "/summary";
+  const auto index_path = temp_directory_ + "/index";
+  WriteDocuments(summary_path, index_path, 100);
+  WriteSchema("summary\t" + summary_path + "\nindex\t" + index_path + "\n");
+
+  const auto new_summary_path = temp_directory_ + "/summary-new";
+  const auto new_index_path = temp_directory_ + "/index-new";
+  WriteDocuments(new_summary_path, new_index_path, 50);
+
+  auto shell = Start();
+  fputs("QUERY COUNT (a);\n", shell);
+  fflush(shell);
+  EXPECT_EQ("{\"result-count\":100}\n", WaitForOutput(1));
+
+  WriteSchema("summary\t" + new_summary_path + "\nindex\t" + new_index_path +
+              "\n");
+  fputs("RELOAD;\nQUERY COUNT (a);\n", shell);
+  fflush(shell);
+  EXPECT_EQ(
+      "{\"result-count\":100}\n"
+      "{\"generation\":2}\n"
+      "{\"result-count\":50}\n",
+      WaitForOutput(3));
+
+  // A schema that can't be loaded fails the statement.
+  WriteSchema("index\t" + temp_directory_ + "/missing\n");
+  fputs("RELOAD;\n", shell);
+  EXPECT_EQ(0, pclose(shell));
+  const auto output = WaitForOutput(4);
+  EXPECT_TRUE(IsError(output.substr(output.rfind("{")), "open")) << output;
+}
+
+TEST_F(CaShellTest, FailedReloadKeepsGeneration) {
+  const auto summary_path = temp_directory_ + "/summary";
+  const auto index_path = temp_directory_ + "/index";
+  WriteDocuments(summary_path, index_path, 100);
+  WriteSchema("summary\t" + summary_path + "\nindex\t" + index_path + "\n");
+
+  SchemaGenerations schemas(schema_path_);
+  EXPECT_EQ(2U, schemas.Reload());
+  const auto current = schemas.Current();
+
+  WriteSchema("index\t" + temp_directory_ + "/missing\n");
+  EXPECT_THROW(schemas.Reload(), kj::Exception);
+  EXPECT_EQ(2U, schemas.Generation());
+  EXPECT_EQ(current, schemas.Current());
+  EXPECT_EQ(1U, current->IndexTables().size());
+}
@@ -10,7 +10,6 @@
 #include <memory>
 #include <string>
 #include <vector>
-#include <mutex>
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -146,8 +145,17 @@ enum TableCompression : uint8_t {
   // Backend-specific default compression.
   kTableCompressionDefault = uint8_t(-1),
 
-  // Zstandard compression. https://github.com/facebook/zstd
-  kTableCompressionZSTD = 1,
+  // LZ4 compression.  https://github.com/lz4/lz4
+  //
+  // Level 0 selects the fast compressor, and levels 1 to 12 the high
+  // compression compressor.  Tables compressed with "zstd" by earlier versions
+  // use this method.
+  kTableCompressionLZ4 = 1,
+
+  // Zstandard compression.  https://github.com/facebook/zstd
+  //
+  // Level 0 selects the default level.
+  kTableCompressionZSTD = 2,
 
   // Keep this equal to the numerically last compression method.
   kTableCompressionLast = kTableCompressionZSTD
@@ -177,6 +185,36 @@ class TableOptions {
     return *this;
   }
 
+  // Trains a compression dictionary of up to `size' bytes on the first blocks
+  // of the table, and compresses all blocks with it.  Requires zstd.
+  TableOptions& SetCompressionDictionarySize(size_t size) {
+    compression_dictionary_size_ = size;
+    return *this;
+  }
+
+  // Sets the number of threads compressing blocks while the table is built.
+  // Zero selects one per CPU, and one compresses blocks in the calling thread.
+  TableOptions& SetCompressionThreads(size_t threads) {
+    compression_threads_ = threads;
+    return *this;
+  }
+
+  // Sets the target size of table blocks, before compression.  Smaller blocks
+  // make point lookups cheaper, while larger blocks compress better and make
+  // scans faster.  Zero selects the backend's default.
+  TableOptions& SetBlockSize(size_t block_size) {
+    block_size_ = block_size;
+    return *this;
+  }
+
+  // Stores a Bloom filter of the keys, which lets point lookups of absent keys
+  // skip reading blocks.  `rate' is the fraction of absent keys the filter
+  // fails to reject; zero disables the filter.
+  TableOptions& SetBloomFilterFalsePositiveRate(double rate) {
+    bloom_filter_false_positive_rate_ = rate;
+    return *this;
+  }
+
   TableOptions& SetNoFSync(bool value = true) {
     no_fsync_ = value;
     return *this;
@@ -187,6 +225,14 @@ class TableOptions {
     return *this;
   }
 
+  // Sets the memory used to sort unsorted input, in bytes.  Input that does
+  // not fit is sorted in runs, which are merged from a temporary file.  Zero
+  // selects the backend's default.
+  TableOptions& SetSortBufferSize(size_t size) {
+    sort_buffer_size_ = size;
+    return *this;
+  }
+
   TableOptions& SetOutputSeekable(bool value = true) {
     output_seekable_ = value;
     return *this;
@@ -197,9 +243,19 @@ class TableOptions {
 
   TableCompression GetCompression() const { return compression_; }
   uint8_t GetCompressionLevel() const { return compression_level_; }
+  size_t GetCompressionDictionarySize() const {
+    return compression_dictionary_size_;
+  }
+  size_t GetCompressionThreads() const { return compression_threads_; }
+
+  size_t GetBlockSize() const { return block_size_; }
+  double GetBloomFilterFalsePositiveRate() const {
+    return bloom_filter_false_positive_rate_;
+  }
 
   bool GetNoFSync() const { return no_fsync_; }
   bool GetInputUnsorted() const { return input_unsorted_; }
+  size_t GetSortBufferSize() const { return sort_buffer_size_; }
   bool GetOutputSeekable() const { return output_seekable_; }
 
  private:
@@ -210,6 +266,15 @@ class TableOptions {
   // Data compression options.
   TableCompression compression_ = kTableCompressionDefault;
   uint8_t compression_level_ = 0;
+  size_t compression_dictionary_size_ = 0;
+  size_t compression_threads_ = 0;
+
+  // Data layout options.
+  size_t block_size_ = 0;
+  double bloom_filter_false_positive_rate_ = 0;
+
+  // Input options.
+  size_t sort_buffer_size_ = 0;
 
   // Miscellaneous flags.
   bool no_fsync_ = false;
@@ -219,6 +284,53 @@ class TableOptions {
 
 /*****************************************************************************/
 
+// Counters of table I/O performed by the calling thread.  Table backends
+// update these as they read and decompress data, so that callers can
+// attribute the cost of individual lookups by sampling them before and after.
+struct TableIOStats {
+  uint64_t bytes_read = 0;
+  uint64_t bytes_decompressed = 0;
+
+  // Lookups in the block cache.
+  uint64_t block_cache_hits = 0;
+  uint64_t block_cache_misses = 0;
+};
+
+TableIOStats& ThreadTableIOStats();
+
+// Usage of the cache of decoded blocks shared by all tables of the process.
+struct BlockCacheStats {
+  // In bytes.
+  uint64_t capacity = 0;
+  uint64_t usage = 0;
+
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+};
+
+// Sets the memory available for caching decoded blocks.  Must be called before
+// the first table is opened.
+void SetBlockCacheCapacity(size_t capacity);
+
+BlockCacheStats GetBlockCacheStats();
+
+/*****************************************************************************/
+
+// Compression statistics of a table, complete once the table is synced.
+struct TableCompressionStats {
+  // Size of the table blocks before and after compression.
+  uint64_t uncompressed_bytes = 0;
+  uint64_t compressed_bytes = 0;
+
+  // Size of the trained compression dictionary, or zero if none is used.
+  uint64_t dictionary_bytes = 0;
+
+  // Compressed size of the blocks the dictionary was trained on, with and
+  // without the dictionary.
+  uint64_t sample_bytes_with_dictionary = 0;
+  uint64_t sample_bytes_without_dictionary = 0;
+};
+
 class TableBuilder {
  public:
   virtual ~TableBuilder();
@@ -226,6 +338,11 @@ class TableBuilder {
   virtual void InsertRow(const string_view& key, const string_view& value) = 0;
 
   virtual void Sync() = 0;
+
+  // Returns compression statistics, if the backend keeps them.
+  virtual TableCompressionStats GetCompressionStats() const {
+    return TableCompressionStats();
+  }
 };
 
 class Table {
@@ -234,6 +351,14 @@ class Table {
 
   virtual ~Table();
 
+  // Returns an independent cursor over the same table, positioned at the first
+  // row.  Cursors share the immutable state of the table, such as the open
+  // file and the block index, and keep it alive.  Different cursors may be
+  // used from different threads at the same time without locking, and this
+  // function may be called concurrently too; a single cursor must only be
+  // used by one thread at a time.
+  virtual std::unique_ptr<Table> NewCursor() = 0;
+
   virtual int IsSorted() = 0;
 
   // Seeks to the first table row.
@@ -254,15 +379,35 @@ class Table {
   // Skips the given number of rows.
   virtual bool Skip(size_t count) = 0;
 
-  const struct stat st;
+  // Looks up all of `keys' at once, and calls `callback' with the position in
+  // `keys' and the value of every key found.  Backends may read the data of
+  // several keys concurrently, and call `callback' from other threads, but
+  // never concurrently.  Like NewCursor(), this may be called concurrently,
+  // and does not move the cursor.  The default implementation looks up one
+  // key at a time through a new cursor.
+  virtual void LookupKeys(
+      const std::vector<string_view>& keys,
+      const std::function<void(size_t, const string_view&)>& callback);
+
+  // Brings the structures used for finding keys, such as the block index, into
+  // memory, so that the first lookups do not wait for the disk.  If `lock' is
+  // true, they are also locked in memory.  Returns their size in bytes.  May
+  // be called while cursors of the table are in use.  The default
+  // implementation does nothing, and returns zero.
+  virtual uint64_t WarmUp(bool lock);
 
-  std::mutex lock;
+  const struct stat st;
 };
 
 class SeekableTable : public Table {
  public:
   SeekableTable(const struct stat& st);
 
+  // Like NewCursor(), but the cursor is also seekable.
+  virtual std::unique_ptr<SeekableTable> NewSeekableCursor() = 0;
+
+  std::unique_ptr<Table> NewCursor() override { return NewSeekableCursor(); }
+
   virtual off_t Offset() = 0;
 
   virtual void Seek(off_t offset, int whence) = 0;
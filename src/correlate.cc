@@ -45,6 +45,13 @@ const struct ca_offset_score* CA_offset_score_lower_bound(
   return begin;
 }
 
+// The output stream of a statement, shared by the worker threads producing
+// its results.
+struct CorrelateOutput {
+  FILE* file;
+  std::mutex mutex;
+};
+
 std::string DayToDate(float day) {
   const auto day_tt = static_cast<time_t>(day * 86400);
   tm day_tm;
@@ -71,7 +78,8 @@ std::string DayToDate(float day) {
 //   prior_logit: The log-odds of the prior probability of an item belonging to
 //                set A.
 //   do_timestamps: Set to true if we're doing event prediction.
-//   output_mutex: Mutex controlling access to stdout.
+//   output: The statement's output stream, and the mutex controlling access
+//           to it.
 //   min_score: The lower bound of the range of score values to accept from
 //              key_offsets.
 //   max_score: The upper bound of the range of score values to accept from
@@ -82,7 +90,7 @@ void ProcessRange(const string_view& key,
                   const std::vector<ca_offset_score>& key_offsets,
                   const size_t limit_A, const size_t limit_B,
                   const double prior_logit, const bool do_timestamps,
-                  std::mutex& output_mutex, const float min_score = -HUGE_VAL,
+                  CorrelateOutput& output, const float min_score = -HUGE_VAL,
                   const float max_score = HUGE_VAL) {
   const auto* A_begin = &offsets_A[0];
   const auto* B_begin = &offsets_B[0];
@@ -136,13 +144,13 @@ void ProcessRange(const string_view& key,
   // Cutoff at >55% and <45%.
   if (std::fabs(log_odds) < std::log(.55 / (1.0 - .55))) return;
 
-  std::unique_lock<std::mutex> lk(output_mutex);
+  std::unique_lock<std::mutex> lk(output.mutex);
 
   KJ_REQUIRE(match_count_A > 0 || match_count_B > 0, match_count_A,
              match_count_B);
 
-  printf("%.3f\t%zu\t%zu\t%.*s", log_odds, match_count_A, match_count_B,
-         static_cast<int>(key.size()), key.data());
+  fprintf(output.file, "%.3f\t%zu\t%zu\t%.*s", log_odds, match_count_A,
+          match_count_B, static_cast<int>(key.size()), key.data());
 
   std::string min_score_string, max_score_string;
   if (!Keywords::GetInstance().IsTimestamped(key)) {
@@ -161,17 +169,18 @@ void ProcessRange(const string_view& key,
   // Print range operator, if applicable.
   if (std::isfinite(min_score)) {
     if (std::isfinite(max_score)) {
-      printf("[%s,%s]", min_score_string.c_str(), max_score_string.c_str());
+      fprintf(output.file, "[%s,%s]", min_score_string.c_str(),
+              max_score_string.c_str());
     } else {
-      printf("≥%s", min_score_string.c_str());
+      fprintf(output.file, "≥%s", min_score_string.c_str());
     }
   } else if (std::isfinite(max_score)) {
-    printf("≤%s", max_score_string.c_str());
+    fprintf(output.file, "≤%s", max_score_string.c_str());
   }
 
-  putchar('\n');
+  putc('\n', output.file);
 
-  fflush(stdout);
+  fflush(output.file);
 }
 
 // Processes a single index entry.
@@ -188,13 +197,14 @@ void ProcessRange(const string_view& key,
 //            desired level of statistical significance.
 //   prior_logit: The log-odds of the prior probability of an item belonging to
 //                set A.
-//   output_mutex: Mutex controlling access to stdout.
+//   output: The statement's output stream, and the mutex controlling access
+//           to it.
 void ProcessSeries(std::string key, std::vector<ca_offset_score>&& key_offsets,
                    const std::vector<ca_offset_score>& offsets_A,
                    const std::vector<ca_offset_score>& offsets_B,
                    const size_t limit_A, const size_t limit_B,
                    const double prior_logit, const bool do_timestamps,
-                   std::mutex& output_mutex) {
+                   CorrelateOutput& output) {
   if ((offsets_A.back().offset < key_offsets.front().offset ||
        offsets_A.front().offset > key_offsets.back().offset) &&
       (offsets_B.back().offset < key_offsets.front().offset ||
@@ -215,7 +225,7 @@ void ProcessSeries(std::string key, std::vector<ca_offset_score>&& key_offsets,
     // This is simple boolean feature, so we treat it's mere presence as the
     // signal.
     ProcessRange(key, offsets_A, offsets_B, key_offsets, limit_A, limit_B,
-                 prior_logit, do_timestamps, output_mutex);
+                 prior_logit, do_timestamps, output);
     return;
   }
 
@@ -341,13 +351,13 @@ void ProcessSeries(std::string key, std::vector<ca_offset_score>&& key_offsets,
       best_mid_score < std::log(1.05)) {
     // No subrange was more predictive than including everything.
     ProcessRange(key, offsets_A, offsets_B, key_offsets, limit_A, limit_B,
-                 prior_logit, do_timestamps, output_mutex);
+                 prior_logit, do_timestamps, output);
   } else {
     ProcessRange(key, offsets_A, offsets_B, key_offsets, limit_A, limit_B,
-                 prior_logit, do_timestamps, output_mutex, -HUGE_VAL,
+                 prior_logit, do_timestamps, output, -HUGE_VAL,
                  std::get<0>(*best_mid));
     ProcessRange(key, offsets_A, offsets_B, key_offsets, limit_A, limit_B,
-                 prior_logit, do_timestamps, output_mutex,
+                 prior_logit, do_timestamps, output,
                  std::get<0>(*(best_mid + 1)), HUGE_VAL);
   }
 }
@@ -487,8 +497,12 @@ void ca_schema_query_correlate(Schema* schema, const Query* query_A,
 
   std::vector<ca_offset_score> offsets_A, offsets_B;
 
-  ProcessQuery(offsets_A, query_A, schema, false, false);
-  ProcessQuery(offsets_B, query_B, schema, false, false);
+  QueryExecution execution;
+  execution.subexpressions.Add(query_A);
+  execution.subexpressions.Add(query_B);
+
+  ProcessQuery(offsets_A, query_A, schema, false, false, execution);
+  ProcessQuery(offsets_B, query_B, schema, false, false, execution);
 
   offsets_B.resize(SubtractOffsets(&offsets_B[0], offsets_B.size(),
                                              &offsets_A[0], offsets_A.size()));
@@ -514,19 +528,23 @@ void ca_schema_query_correlate(Schema* schema, const Query* query_A,
 
   const auto now = time(nullptr) / 86400.0f;
 
-  ThreadPool thread_pool;
+  // Results are printed by the worker threads, which don't share the calling
+  // thread's output stream.
+  CorrelateOutput output;
+  output.file = CA_output;
 
-  std::vector<ca_offset_score> key_offsets;
+  TaskGroup tasks(ThreadPool::Default());
 
-  // Mutex controlling access to stdout.
-  std::mutex output_mutex;
+  std::vector<ca_offset_score> key_offsets;
 
   for (auto& index_table : schema->IndexTables()) {
-    index_table->SeekToFirst();
+    auto cursor = index_table->NewCursor();
 
     string_view key, data;
 
-    while (index_table->ReadRow(key, data)) {
+    while (cursor->ReadRow(key, data)) {
+      if (execution.cancellation.IsCancelled()) break;
+
       if (a_is_timestamped && keywords.IsEphemeral(key)) continue;
 
       key_offsets.clear();
@@ -536,7 +554,7 @@ void ca_schema_query_correlate(Schema* schema, const Query* query_A,
       if (key_offsets.size() < limit_A && key_offsets.size() < limit_B)
         continue;
 
-      thread_pool.Launch([
+      tasks.Launch([
         key = key.to_string(),
         key_offsets = std::move(key_offsets),
         &offsets_A,
@@ -548,8 +566,11 @@ void ca_schema_query_correlate(Schema* schema, const Query* query_A,
         a_is_timestamped,
         b_is_timestamped,
         now,
-        &output_mutex
+        &output,
+        &cancellation = execution.cancellation
       ]() mutable {
+        if (cancellation.IsCancelled()) return;
+
         if (a_is_timestamped && keywords.IsTimestamped(key)) {
           if (b_is_timestamped)
             FilterByTimestamp(key_offsets, offsets_A, offsets_B);
@@ -559,10 +580,15 @@ void ca_schema_query_correlate(Schema* schema, const Query* query_A,
 
         ProcessSeries(std::move(key), std::move(key_offsets), offsets_A,
                       offsets_B, limit_A, limit_B, prior_logit,
-                      a_is_timestamped, output_mutex);
+                      a_is_timestamped, output);
       });
     }
   }
+
+  tasks.Wait();
+
+  // Features printed so far are valid, but the list is incomplete.
+  execution.cancellation.Check();
 }
 
 }  // namespace table
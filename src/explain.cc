@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <chrono>
+
+#include <json/value.h>
+#include <json/writer.h>
+#include <kj/debug.h>
+
+#include "src/ca-table.h"
+#include "src/explain.h"
+#include "src/query.h"
+#include "src/schema.h"
+
+namespace cantera {
+namespace table {
+
+namespace {
+
+double Milliseconds(double seconds) { return seconds * 1000.0; }
+
+Json::Value ProfileToJSON(const Query* query, QueryProfile& profile) {
+  const auto& stats = profile.nodes[query];
+
+  Json::Value result(Json::objectValue);
+  result["operator"] = QueryNodeLabel(query);
+  result["time-ms"] = Milliseconds(stats.wall_time);
+  result["input-count"] = Json::UInt64(stats.input_count);
+  result["output-count"] = Json::UInt64(stats.output_count);
+  if (stats.reused) result["reused"] = true;
+
+  if (query->type == kQueryLeaf) {
+    result["bytes-read"] = Json::UInt64(stats.bytes_read);
+    result["bytes-decompressed"] = Json::UInt64(stats.bytes_decompressed);
+    result["block-cache-hits"] = Json::UInt64(stats.block_cache_hits);
+    result["block-cache-misses"] = Json::UInt64(stats.block_cache_misses);
+    result["decode-time-ms"] = Milliseconds(stats.decode_time);
+    if (stats.shared_lookup) result["shared-lookup"] = true;
+  }
+
+  for (auto child : {query->lhs, query->rhs}) {
+    if (child) result["children"].append(ProfileToJSON(child, profile));
+  }
+
+  return result;
+}
+
+void PrintProfile(const Query* query, QueryProfile& profile, int depth) {
+  const auto& stats = profile.nodes[query];
+
+  fprintf(CA_output, "%*s%s  time=%.3fms in=%zu out=%zu", depth * 2, "",
+          QueryNodeLabel(query).c_str(), Milliseconds(stats.wall_time),
+          stats.input_count, stats.output_count);
+
+  if (stats.reused) fprintf(CA_output, " reused");
+
+  if (query->type == kQueryLeaf) {
+    fprintf(CA_output,
+            " read=%llu decompressed=%llu cache-hits=%llu cache-misses=%llu"
+            " decode=%.3fms",
+            static_cast<unsigned long long>(stats.bytes_read),
+            static_cast<unsigned long long>(stats.bytes_decompressed),
+            static_cast<unsigned long long>(stats.block_cache_hits),
+            static_cast<unsigned long long>(stats.block_cache_misses),
+            Milliseconds(stats.decode_time));
+    if (stats.shared_lookup) fprintf(CA_output, " shared-lookup");
+  }
+
+  putc('\n', CA_output);
+
+  for (auto child : {query->lhs, query->rhs}) {
+    if (child) PrintProfile(child, profile, depth + 1);
+  }
+}
+
+}  // namespace
+
+void ExplainAnalyze(Schema* schema, const struct query_statement& stmt) {
+  // These shape the results that QUERY prints, which are not produced here.
+  KJ_REQUIRE(!stmt.thresholds,
+             "EXPLAIN ANALYZE does not support THRESHOLDS clauses");
+  KJ_REQUIRE(!stmt.keys_only, "EXPLAIN ANALYZE does not support KEYS FOR");
+
+  schema->Load();
+
+  QueryProfile profile;
+  QueryExecution execution;
+  execution.profile = &profile;
+
+  std::vector<ca_offset_score> offsets;
+
+  const auto start = std::chrono::steady_clock::now();
+  ProcessQuery(offsets, stmt.query, schema, false, true, execution);
+
+  // Select the rows that QUERY would return, in the same way.
+  size_t rows = 0;
+  if (stmt.offset < offsets.size()) {
+    rows = offsets.size() - stmt.offset;
+    if (stmt.limit >= 0 && static_cast<size_t>(stmt.limit) < rows)
+      rows = stmt.limit;
+
+    std::partial_sort(
+        offsets.begin(), offsets.begin() + stmt.offset + rows, offsets.end(),
+        [](const auto& lhs, const auto& rhs) { return lhs.score > rhs.score; });
+  }
+
+  const auto elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start);
+
+  if (CA_output_format == CA_PARAM_VALUE_JSON) {
+    Json::Value result(Json::objectValue);
+    result["time-ms"] = Milliseconds(elapsed.count());
+    result["result-count"] = Json::UInt64(offsets.size());
+    result["rows"] = Json::UInt64(rows);
+    result["peak-memory-bytes"] = Json::UInt64(execution.memory.Peak());
+    result["plan"] = ProfileToJSON(stmt.query, profile);
+    fputs(Json::FastWriter().write(result).c_str(), CA_output);
+  } else {
+    fprintf(CA_output,
+            "time=%.3fms result-count=%zu rows=%zu peak-memory=%zu\n",
+            Milliseconds(elapsed.count()), offsets.size(), rows,
+            execution.memory.Peak());
+    PrintProfile(stmt.query, profile, 0);
+  }
+}
+
+}  // namespace table
+}  // namespace cantera
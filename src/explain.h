@@ -0,0 +1,19 @@
+#ifndef STORAGE_CA_TABLE_EXPLAIN_H_
+#define STORAGE_CA_TABLE_EXPLAIN_H_ 1
+
+namespace cantera {
+namespace table {
+
+class Schema;
+struct query_statement;
+
+// Executes the query tree of `stmt', and prints the execution statistics of
+// every node instead of the query results.  Like QUERY, reports the number of
+// matches as the result count, and also the number of rows selected by the
+// FETCH and OFFSET clauses.
+void ExplainAnalyze(Schema* schema, const struct query_statement& stmt);
+
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !STORAGE_CA_TABLE_EXPLAIN_H_
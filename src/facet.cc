@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <json/value.h>
+#include <json/writer.h>
+#include <kj/debug.h>
+
+#include "src/ca-table.h"
+#include "src/facet.h"
+#include "src/query.h"
+#include "src/schema.h"
+
+namespace cantera {
+namespace table {
+
+namespace {
+
+// Number of joined values classified at a time.  Small enough for the batch
+// to stay in L1 cache.
+constexpr size_t kBatchSize = 1024;
+
+class FacetAccumulator {
+ public:
+  // `thresholds' must be sorted.  Bucket `i' holds values in the range
+  // [thresholds[i], thresholds[i + 1]).
+  explicit FacetAccumulator(std::vector<double> thresholds)
+      : thresholds_(std::move(thresholds)),
+        counts_(thresholds_.size() + 1, 0),
+        sums_(thresholds_.size() + 1, 0.0),
+        mins_(thresholds_.size() + 1, std::numeric_limits<float>::infinity()),
+        maxs_(thresholds_.size() + 1, -std::numeric_limits<float>::infinity()) {
+    values_.reserve(kBatchSize);
+    scores_.reserve(kBatchSize);
+  }
+
+  void Add(float value, float score) {
+    values_.emplace_back(value);
+    scores_.emplace_back(score);
+    if (values_.size() == kBatchSize) Flush();
+  }
+
+  void Flush();
+
+  size_t BucketCount() const { return thresholds_.size() - 1; }
+
+  double Min(size_t bucket) const { return thresholds_[bucket]; }
+  double Max(size_t bucket) const { return thresholds_[bucket + 1]; }
+
+  // Slot 0 collects values below the first threshold, and the last slot
+  // values at or above the last threshold, so bucket `i' lives in slot i + 1.
+  uint64_t Count(size_t bucket) const { return counts_[bucket + 1]; }
+  double ScoreSum(size_t bucket) const { return sums_[bucket + 1]; }
+  float ScoreMin(size_t bucket) const { return mins_[bucket + 1]; }
+  float ScoreMax(size_t bucket) const { return maxs_[bucket + 1]; }
+
+ private:
+  std::vector<double> thresholds_;
+
+  std::vector<uint64_t> counts_;
+  std::vector<double> sums_;
+  std::vector<float> mins_;
+  std::vector<float> maxs_;
+
+  std::vector<float> values_;
+  std::vector<float> scores_;
+  std::vector<uint32_t> slots_;
+};
+
+void FacetAccumulator::Flush() {
+  const auto count = values_.size();
+  slots_.resize(count);
+
+  // Classify the whole batch first.  The slot of a value is the number of
+  // thresholds it is not below, computed without branches so that the loop
+  // vectorizes.  NaN compares false against everything, and ends up in slot 0.
+  for (const auto threshold : thresholds_) {
+    for (size_t i = 0; i < count; ++i)
+      slots_[i] += (values_[i] >= threshold);
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    const auto slot = slots_[i];
+    const auto score = scores_[i];
+    ++counts_[slot];
+    sums_[slot] += score;
+    mins_[slot] = std::min(mins_[slot], score);
+    maxs_[slot] = std::max(maxs_[slot], score);
+  }
+
+  values_.clear();
+  scores_.clear();
+  std::fill(slots_.begin(), slots_.end(), 0);
+}
+
+}  // namespace
+
+void Facet(Schema* schema, const struct facet_statement& stmt) {
+  schema->Load();
+
+  std::vector<double> thresholds;
+  for (auto th = stmt.thresholds; th; th = th->next)
+    thresholds.emplace_back(th->value);
+  std::sort(thresholds.begin(), thresholds.end());
+  thresholds.erase(std::unique(thresholds.begin(), thresholds.end()),
+                   thresholds.end());
+
+  KJ_REQUIRE(thresholds.size() >= 2, "FACET needs at least two thresholds");
+
+  QueryExecution execution;
+
+  std::vector<ca_offset_score> offsets;
+  ProcessQuery(offsets, stmt.query, schema, false, true, execution);
+
+  // Documents having more than one value for the key, such as event lists,
+  // are placed according to their largest value.
+  Query key_query{};
+  key_query.type = kQueryLeaf;
+  key_query.identifier = stmt.key;
+
+  auto key_offsets = execution.memory.Acquire();
+  ProcessQuery(key_offsets, &key_query, schema, false, true, execution);
+
+  FacetAccumulator accumulator(std::move(thresholds));
+
+  auto o = offsets.begin();
+  auto k = key_offsets.begin();
+
+  while (o != offsets.end() && k != key_offsets.end()) {
+    if (o->offset < k->offset) {
+      ++o;
+    } else if (k->offset < o->offset) {
+      ++k;
+    } else {
+      accumulator.Add(k->score, o->score);
+      ++o;
+      ++k;
+    }
+  }
+
+  accumulator.Flush();
+
+  execution.memory.Release(std::move(key_offsets));
+
+  uint64_t result_count = 0;
+  for (size_t i = 0; i < accumulator.BucketCount(); ++i)
+    result_count += accumulator.Count(i);
+
+  if (CA_output_format == CA_PARAM_VALUE_JSON) {
+    Json::Value result(Json::objectValue);
+    result["result-count"] = Json::UInt64(result_count);
+
+    Json::Value& buckets = result["buckets"] = Json::Value(Json::arrayValue);
+    for (size_t i = 0; i < accumulator.BucketCount(); ++i) {
+      Json::Value bucket(Json::objectValue);
+      bucket["min"] = accumulator.Min(i);
+      bucket["max"] = accumulator.Max(i);
+      bucket["count"] = Json::UInt64(accumulator.Count(i));
+
+      if (stmt.with_scores) {
+        bucket["score-sum"] = accumulator.ScoreSum(i);
+        if (accumulator.Count(i)) {
+          bucket["score-min"] = accumulator.ScoreMin(i);
+          bucket["score-max"] = accumulator.ScoreMax(i);
+        }
+      }
+
+      buckets.append(bucket);
+    }
+
+    fputs(Json::FastWriter().write(result).c_str(), CA_output);
+  } else {
+    fprintf(CA_output, "%llu\n", static_cast<unsigned long long>(result_count));
+
+    for (size_t i = 0; i < accumulator.BucketCount(); ++i) {
+      fprintf(CA_output, "%.9g,%.9g,%llu", accumulator.Min(i),
+              accumulator.Max(i),
+              static_cast<unsigned long long>(accumulator.Count(i)));
+
+      if (stmt.with_scores) {
+        if (accumulator.Count(i)) {
+          fprintf(CA_output, ",%.9g,%.9g,%.9g", accumulator.ScoreSum(i),
+                  accumulator.ScoreMin(i), accumulator.ScoreMax(i));
+        } else {
+          fputs(",0,nan,nan", CA_output);
+        }
+      }
+
+      putc('\n', CA_output);
+    }
+  }
+}
+
+}  // namespace table
+}  // namespace cantera
@@ -0,0 +1,17 @@
+#ifndef STORAGE_CA_TABLE_FACET_H_
+#define STORAGE_CA_TABLE_FACET_H_ 1
+
+namespace cantera {
+namespace table {
+
+class Schema;
+struct facet_statement;
+
+// Prints the number of results of `stmt.query' falling within each threshold
+// range of `stmt.key', without reading any summaries.
+void Facet(Schema* schema, const struct facet_statement& stmt);
+
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !STORAGE_CA_TABLE_FACET_H_
@@ -0,0 +1,113 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "src/key-search-tree.h"
+
+#include <algorithm>
+
+#include <sys/mman.h>
+
+#include <kj/debug.h>
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+namespace {
+
+// Prefetching the node 3 levels below the current one fetches the cache line
+// holding all 8 of its descendants at that level.
+constexpr size_t kPrefetchFanout = 8;
+
+template <typename T>
+void LockVector(const std::vector<T>& v) {
+  if (v.empty()) return;
+  KJ_SYSCALL(mlock(v.data(), v.size() * sizeof(T)));
+}
+
+}  // namespace
+
+KeySearchTree::KeySearchTree(std::vector<string_view> keys)
+    : keys_(std::move(keys)) {
+  KJ_REQUIRE(keys_.size() < UINT32_MAX, "too many keys", keys_.size());
+  if (keys_.empty()) return;
+
+  // Since the keys are sorted, the prefix shared by the first and last keys
+  // is shared by all.
+  const auto& first = keys_.front();
+  const auto& last = keys_.back();
+  size_t common_size = 0;
+  while (common_size < std::min(first.size(), last.size()) &&
+         first[common_size] == last[common_size])
+    ++common_size;
+  common_prefix_ = first.substr(0, common_size);
+
+  prefixes_.resize(keys_.size() + 1);
+  positions_.resize(keys_.size() + 1);
+  Fill(0, 1);
+}
+
+size_t KeySearchTree::LowerBound(const string_view& key) const {
+  if (keys_.empty()) return 0;
+
+  // Keys not starting with the common prefix are less than all keys, or
+  // greater.
+  if (key.substr(0, common_prefix_.size()) != common_prefix_)
+    return key.compare(common_prefix_) < 0 ? 0 : keys_.size();
+
+  const uint64_t prefix = Prefix(key);
+
+  size_t node = 1;
+  while (node < prefixes_.size()) {
+    __builtin_prefetch(prefixes_.data() + kPrefetchFanout * node);
+    const uint64_t node_prefix = prefixes_[node];
+    const bool less = node_prefix < prefix ||
+                      (node_prefix == prefix && keys_[positions_[node]] < key);
+    node = 2 * node + less;
+  }
+
+  // Undo the right turns taken after the last left turn, which was at the
+  // first node not less than `key'.
+  node >>= __builtin_ffsll(~static_cast<unsigned long long>(node));
+
+  return node ? positions_[node] : keys_.size();
+}
+
+size_t KeySearchTree::MemoryUsage() const {
+  return keys_.capacity() * sizeof(keys_[0]) +
+         prefixes_.capacity() * sizeof(prefixes_[0]) +
+         positions_.capacity() * sizeof(positions_[0]);
+}
+
+void KeySearchTree::LockMemory() const {
+  LockVector(keys_);
+  LockVector(prefixes_);
+  LockVector(positions_);
+}
+
+uint64_t KeySearchTree::Prefix(const string_view& key) const {
+  const size_t offset = common_prefix_.size();
+  const size_t size = std::min<size_t>(key.size() - offset, 8);
+
+  uint64_t result = 0;
+  for (size_t i = 0; i < 8; ++i) {
+    result <<= 8;
+    if (i < size) result |= static_cast<unsigned char>(key[offset + i]);
+  }
+
+  return result;
+}
+
+size_t KeySearchTree::Fill(size_t num, size_t node) {
+  if (node >= prefixes_.size()) return num;
+
+  num = Fill(num, 2 * node);
+  prefixes_[node] = Prefix(keys_[num]);
+  positions_[node] = num;
+  return Fill(num + 1, 2 * node + 1);
+}
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
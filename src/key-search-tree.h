@@ -0,0 +1,66 @@
+#ifndef STORAGE_CA_TABLE_KEY_SEARCH_TREE_H_
+#define STORAGE_CA_TABLE_KEY_SEARCH_TREE_H_ 1
+
+#include <cstdint>
+#include <vector>
+
+#include "src/ca-table.h"
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+// Finds keys in a sorted array of keys with fewer cache misses than a binary
+// search over the keys themselves.
+//
+// The tree holds the 8 bytes following the prefix shared by all keys of each
+// key, as big-endian integers, in Eytzinger order: the children of node `k'
+// are nodes 2k and 2k+1.  A search thus walks a single contiguous array, whose
+// top levels stay cached, and can prefetch a few levels ahead.  Only when the
+// 8 bytes are equal to those of the key sought are the full keys compared.
+class KeySearchTree {
+ public:
+  KeySearchTree() {}
+
+  // Builds a tree over `keys', which must be sorted, and whose data must
+  // outlive the tree.
+  explicit KeySearchTree(std::vector<string_view> keys);
+
+  size_t size() const { return keys_.size(); }
+
+  // Returns key `num', in sorted order.
+  const string_view& key(size_t num) const { return keys_[num]; }
+
+  // Returns the position of the first key not less than `key', or size() if
+  // there is no such key.
+  size_t LowerBound(const string_view& key) const;
+
+  size_t MemoryUsage() const;
+
+  // Locks the tree in memory.
+  void LockMemory() const;
+
+ private:
+  // Returns the 8 bytes of `key' following the common prefix, zero padded.
+  uint64_t Prefix(const string_view& key) const;
+
+  // Assigns the keys from `num' onwards to the subtree at `node' and below,
+  // and returns the number of the first key not assigned.
+  size_t Fill(size_t num, size_t node);
+
+  std::vector<string_view> keys_;
+
+  // The prefix shared by all keys.
+  string_view common_prefix_;
+
+  // The key prefixes in Eytzinger order, and the positions of the keys they
+  // belong to.  Node 0 is unused.
+  std::vector<uint64_t> prefixes_;
+  std::vector<uint32_t> positions_;
+};
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !STORAGE_CA_TABLE_KEY_SEARCH_TREE_H_
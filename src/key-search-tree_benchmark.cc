@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "src/key-search-tree.h"
+
+using namespace cantera::table::internal;
+
+namespace {
+
+// Block index keys sharing a long prefix, as in most of our tables.
+std::string MakePrefixedKey(std::mt19937_64& rng) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "session/user-profile:%016llx",
+           static_cast<unsigned long long>(rng()));
+  return buffer;
+}
+
+// Keys sharing no prefix.
+std::string MakeRandomKey(std::mt19937_64& rng) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%016llx",
+           static_cast<unsigned long long>(rng()));
+  return buffer;
+}
+
+template <typename Function>
+double Measure(Function&& f) {
+  const auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+}  // namespace
+
+// Usage: key-search-tree_benchmark [MAX-KEYS] [LOOKUPS]
+//
+// Compares block index lookups with std::lower_bound over the keys and with
+// KeySearchTree, for growing numbers of keys, and checks that both agree.
+int main(int argc, char** argv) {
+  const size_t max_keys = (argc > 1) ? strtoul(argv[1], nullptr, 0) : 16 << 20;
+  const size_t lookups = (argc > 2) ? strtoul(argv[2], nullptr, 0) : 2000000;
+
+  printf("%-9s %10s %16s %16s\n", "Keys", "Count", "lower_bound (ns)",
+         "Tree (ns)");
+
+  for (const bool prefixed : {true, false}) {
+    for (size_t count = 1 << 16; count <= max_keys; count *= 4) {
+      std::mt19937_64 rng(1);
+
+      std::vector<std::string> key_data(count);
+      for (auto& key : key_data)
+        key = prefixed ? MakePrefixedKey(rng) : MakeRandomKey(rng);
+      std::sort(key_data.begin(), key_data.end());
+
+      std::vector<cantera::string_view> keys(key_data.begin(), key_data.end());
+      KeySearchTree tree(keys);
+
+      std::vector<std::string> queries(lookups);
+      for (auto& query : queries)
+        query = prefixed ? MakePrefixedKey(rng) : MakeRandomKey(rng);
+
+      std::vector<size_t> expected(lookups), found(lookups);
+
+      const auto binary_time = Measure([&] {
+        for (size_t i = 0; i < lookups; ++i) {
+          expected[i] = std::lower_bound(keys.begin(), keys.end(),
+                                         cantera::string_view(queries[i])) -
+                        keys.begin();
+        }
+      });
+
+      const auto tree_time = Measure([&] {
+        for (size_t i = 0; i < lookups; ++i)
+          found[i] = tree.LowerBound(queries[i]);
+      });
+
+      printf("%-9s %10zu %16.1f %16.1f\n", prefixed ? "prefixed" : "random",
+             count, binary_time * 1e9 / lookups, tree_time * 1e9 / lookups);
+
+      if (found != expected) {
+        fprintf(stderr, "KeySearchTree disagrees with std::lower_bound\n");
+        return EXIT_FAILURE;
+      }
+    }
+  }
+}
@@ -28,17 +28,20 @@
 namespace cantera {
 namespace table {
 
-char CA_time_format[64];
-enum RuntimeParameterValue CA_output_format = CA_PARAM_VALUE_JSON;
+thread_local FILE* CA_output = stdout;
+thread_local char CA_time_format[64] = "%Y-%m-%dT%H:%M:%S";
+thread_local enum RuntimeParameterValue CA_output_format = CA_PARAM_VALUE_JSON;
+thread_local size_t CA_memory_limit = 0;
+thread_local uint64_t CA_timeout = 0;
 
-void CA_output_char(int ch) { putchar(ch); }
+void CA_output_char(int ch) { putc(ch, CA_output); }
 
 void CA_output_string(const char* string) {
-  fwrite(string, 1, strlen(string), stdout);
+  fwrite(string, 1, strlen(string), CA_output);
 }
 
 void CA_output_json_string(const char* string, size_t length) {
-  putchar_unlocked('"');
+  putc_unlocked('"', CA_output);
 
   while (length--) {
     auto ch = static_cast<uint8_t>(*string++);
@@ -74,23 +77,23 @@ void CA_output_json_string(const char* string, size_t length) {
       default:
 
         if (ch < ' ')
-          printf("\\u%04x", ch);
+          fprintf(CA_output, "\\u%04x", ch);
         else
-          putchar_unlocked(ch);
+          putc_unlocked(ch, CA_output);
 
         continue;
     }
 
-    putchar_unlocked('\\');
-    putchar_unlocked(ch);
+    putc_unlocked('\\', CA_output);
+    putc_unlocked(ch, CA_output);
   }
 
-  putchar_unlocked('"');
+  putc_unlocked('"', CA_output);
 }
 
-void CA_output_float4(float number) { printf("%.9g", number); }
+void CA_output_float4(float number) { fprintf(CA_output, "%.9g", number); }
 
-void CA_output_float8(double number) { printf("%.17g", number); }
+void CA_output_float8(double number) { fprintf(CA_output, "%.17g", number); }
 
 void CA_output_uint64(uint64_t number) {
   char buffer[20];
@@ -104,7 +107,7 @@ void CA_output_uint64(uint64_t number) {
   }
 
   if (o == begin)
-    putchar('0');
+    putc('0', CA_output);
   else {
     size_t length = o-- - begin;
 
@@ -119,7 +122,7 @@ void CA_output_uint64(uint64_t number) {
       ++begin;
     }
 
-    fwrite(buffer, 1, length, stdout);
+    fwrite(buffer, 1, length, CA_output);
   }
 }
 
@@ -30,6 +30,7 @@
 #include <kj/debug.h>
 
 #include "src/ca-table.h"
+#include "src/query.h"
 #include "src/rle.h"
 
 #include "third_party/oroch/oroch/integer_codec.h"
@@ -537,7 +538,15 @@ uint64_t GetMaxOffsetWithPrediction(const uint8_t*& begin, const uint8_t* end) {
 
 void ca_offset_score_parse(string_view input,
                            std::vector<ca_offset_score>* output) {
+  ca_offset_score_parse(input, output, nullptr);
+}
+
+void ca_offset_score_parse(string_view input,
+                           std::vector<ca_offset_score>* output,
+                           const QueryCancellation* cancellation) {
   while (!input.empty()) {
+    if (cancellation && cancellation->IsCancelled()) return;
+
     auto begin = reinterpret_cast<const uint8_t*>(input.begin());
     auto end = reinterpret_cast<const uint8_t*>(input.end());
     auto begin_save = begin;
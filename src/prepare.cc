@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <vector>
+
+#include <kj/arena.h>
+#include <kj/debug.h>
+
+#include "src/prepare.h"
+#include "src/query.h"
+
+namespace cantera {
+namespace table {
+
+namespace {
+
+int MaxParameter(const Query* query) {
+  if (!query) return 0;
+  return std::max({query->parameter, MaxParameter(query->lhs),
+                   MaxParameter(query->rhs)});
+}
+
+// Returns `query' with all parameters replaced by their values.  Subtrees
+// without parameters are shared with the prepared statement rather than
+// copied, so only the paths leading to parameters are allocated.
+const Query* Bind(const Query* query, const std::vector<const char*>& values,
+                  kj::Arena& arena) {
+  if (!query) return query;
+
+  const auto lhs = Bind(query->lhs, values, arena);
+  const auto rhs = Bind(query->rhs, values, arena);
+  if (!query->parameter && lhs == query->lhs && rhs == query->rhs)
+    return query;
+
+  auto& result = arena.allocate<Query>(*query);
+
+  if (query->parameter) {
+    result.identifier = values[query->parameter - 1];
+    result.parameter = 0;
+  }
+
+  result.lhs = lhs;
+  result.rhs = rhs;
+
+  return &result;
+}
+
+}  // namespace
+
+int MaxParameter(const Statement* stmt) {
+  switch (stmt->type) {
+    case kStatementExplain:
+    case kStatementQuery:
+      return MaxParameter(stmt->u.query.query);
+
+    case kStatementCorrelate:
+      return std::max(MaxParameter(stmt->u.query_correlate.query_A),
+                      MaxParameter(stmt->u.query_correlate.query_B));
+
+    case kStatementFacet:
+      return MaxParameter(stmt->u.facet.query);
+
+    case kStatementParse:
+      return MaxParameter(stmt->u.parse.query);
+
+    case kStatementSelect: {
+      auto result = MaxParameter(stmt->u.select.query);
+      for (auto field = stmt->u.select.fields; field; field = field->next)
+        result = std::max(result, MaxParameter(field->query));
+      return result;
+    }
+
+    default:
+      return 0;
+  }
+}
+
+void Prepare(QueryParseContext* context, const struct prepare_statement& stmt) {
+  const auto body = stmt.statement;
+
+  switch (body->type) {
+    case kStatementCorrelate:
+    case kStatementExplain:
+    case kStatementFacet:
+    case kStatementParse:
+    case kStatementQuery:
+    case kStatementSelect:
+      break;
+
+    default:
+      KJ_FAIL_REQUIRE("statement type cannot be prepared", stmt.name);
+  }
+
+  PreparedStatement prepared;
+  prepared.statement = body;
+  prepared.arena = context->arena;
+  prepared.parameter_count = MaxParameter(body);
+
+  context->prepared_statements[stmt.name] = prepared;
+}
+
+void Execute(QueryParseContext* context, const struct execute_statement& stmt) {
+  auto i = context->prepared_statements.find(stmt.name);
+  KJ_REQUIRE(i != context->prepared_statements.end(),
+             "no such prepared statement", stmt.name);
+  const auto& prepared = i->second;
+
+  std::vector<const char*> values;
+  for (auto p = stmt.parameters; p; p = p->next) values.emplace_back(p->value);
+
+  KJ_REQUIRE(values.size() == static_cast<size_t>(prepared.parameter_count),
+             "wrong number of parameters", stmt.name, values.size(),
+             prepared.parameter_count);
+
+  if (values.empty()) {
+    CA_process_statement(context, const_cast<Statement*>(prepared.statement));
+    return;
+  }
+
+  // The bound statement only lives for the duration of this execution.
+  kj::Arena arena;
+
+  auto& bound = arena.allocate<Statement>(*prepared.statement);
+
+  switch (bound.type) {
+    case kStatementExplain:
+    case kStatementQuery:
+      bound.u.query.query = Bind(bound.u.query.query, values, arena);
+      break;
+
+    case kStatementCorrelate:
+      bound.u.query_correlate.query_A =
+          Bind(bound.u.query_correlate.query_A, values, arena);
+      bound.u.query_correlate.query_B =
+          Bind(bound.u.query_correlate.query_B, values, arena);
+      break;
+
+    case kStatementFacet:
+      bound.u.facet.query = Bind(bound.u.facet.query, values, arena);
+      break;
+
+    case kStatementParse:
+      bound.u.parse.query = Bind(bound.u.parse.query, values, arena);
+      break;
+
+    case kStatementSelect: {
+      bound.u.select.query = Bind(bound.u.select.query, values, arena);
+
+      QueryList** output = &bound.u.select.fields;
+      for (auto field = prepared.statement->u.select.fields; field;
+           field = field->next) {
+        auto& bound_field = arena.allocate<QueryList>();
+        bound_field.query = const_cast<Query*>(Bind(field->query, values, arena));
+        *output = &bound_field;
+        output = &bound_field.next;
+      }
+    } break;
+
+    default:
+      KJ_FAIL_ASSERT("unexpected prepared statement type", bound.type);
+  }
+
+  CA_process_statement(context, &bound);
+}
+
+void Deallocate(QueryParseContext* context,
+                const struct deallocate_statement& stmt) {
+  KJ_REQUIRE(context->prepared_statements.erase(stmt.name) == 1,
+             "no such prepared statement", stmt.name);
+}
+
+}  // namespace table
+}  // namespace cantera
@@ -0,0 +1,30 @@
+#ifndef STORAGE_CA_TABLE_PREPARE_H_
+#define STORAGE_CA_TABLE_PREPARE_H_ 1
+
+namespace cantera {
+namespace table {
+
+struct QueryParseContext;
+struct Statement;
+struct deallocate_statement;
+struct execute_statement;
+struct prepare_statement;
+
+// Returns the number of the highest parameter, such as $2, in `stmt', or zero
+// if it has no parameters.
+int MaxParameter(const Statement* stmt);
+
+// Stores a statement under a name, for later execution with Execute().
+void Prepare(QueryParseContext* context, const struct prepare_statement& stmt);
+
+// Binds the parameters of a prepared statement, and executes it.
+void Execute(QueryParseContext* context, const struct execute_statement& stmt);
+
+// Forgets a prepared statement.
+void Deallocate(QueryParseContext* context,
+                const struct deallocate_statement& stmt);
+
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !STORAGE_CA_TABLE_PREPARE_H_
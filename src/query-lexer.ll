@@ -8,8 +8,8 @@
 #include "src/query-parser.hh"
 #include "src/query.h"
 
-unsigned int character;
-unsigned int line = 0;
+thread_local unsigned int character;
+thread_local unsigned int line = 0;
 
 int
 yyparse();
@@ -23,7 +23,7 @@ comment(yyscan_t yyscanner);
 static int
 stringliteral(yyscan_t yyscanner);
 %}
-%option extra-type="kj::Arena*"
+%option extra-type="QueryParseContext*"
 %option reentrant
 %option noyywrap
 %option bison-bridge
@@ -59,10 +59,18 @@ Z [zZ]
 "/*"                               { character += 2; comment (yyscanner); }
 --[^\n]*
 
+{A}{N}{A}{L}{Y}{Z}{E}              { character += yyleng; return ANALYZE; }
 {A}{N}{D}                          { character += yyleng; return AND; }
 {A}{N}{D}\ {N}{O}{T}               { character += yyleng; return AND_NOT; }
+{A}{S}                             { character += yyleng; return AS; }
+{B}{Y}                             { character += yyleng; return BY; }
 {C}{O}{R}{R}{E}{L}{A}{T}{E}        { character += yyleng; return CORRELATE; }
+{C}{O}{U}{N}{T}                    { character += yyleng; return COUNT; }
 {C}{S}{V}                          { character += yyleng; return CSV; }
+{D}{E}{A}{L}{L}{O}{C}{A}{T}{E}     { character += yyleng; return DEALLOCATE; }
+{E}{X}{E}{C}{U}{T}{E}              { character += yyleng; return EXECUTE; }
+{E}{X}{P}{L}{A}{I}{N}              { character += yyleng; return EXPLAIN; }
+{F}{A}{C}{E}{T}                    { character += yyleng; return FACET; }
 {F}{A}{L}{S}{E}                    { character += yyleng; return FALSE; }
 {F}{E}{T}{C}{H}                    { character += yyleng; return FETCH; }
 {F}{I}{R}{S}{T}                    { character += yyleng; return FIRST; }
@@ -74,6 +82,7 @@ Z [zZ]
 {K}{E}{Y}{S}                       { character += yyleng; return KEYS; }
 {L}{I}{M}{I}{T}                    { character += yyleng; return LIMIT; }
 {M}{A}{X}                          { character += yyleng; return MAX; }
+{M}{E}{M}{O}{R}{Y}                 { character += yyleng; return MEMORY; }
 {M}{I}{N}                          { character += yyleng; return MIN; }
 {M}{O}{D}{I}{D}                    { character += yyleng; return MODID; }
 {N}{E}{X}{T}                       { character += yyleng; return NEXT; }
@@ -83,11 +92,14 @@ Z [zZ]
 {O}{R}                             { character += yyleng; return OR; }
 {O}{R}{D}{E}{R}\ {B}{Y}            { character += yyleng; return ORDER_BY; }
 {P}{A}{T}{H}                       { character += yyleng; return PATH; }
+{P}{R}{E}{P}{A}{R}{E}              { character += yyleng; return PREPARE; }
 {P}{A}{R}{S}{E}                    { character += yyleng; return PARSE; }
 {Q}{U}{E}{R}{Y}                    { character += yyleng; return QUERY; }
 {R}{A}{N}{D}{O}{M}_{S}{A}{M}{P}{L}{E} { character += yyleng; return RANDOM_SAMPLE; }
+{R}{E}{L}{O}{A}{D}                 { character += yyleng; return RELOAD; }
 {R}{O}{W}                          { character += yyleng; return ROW; }
 {R}{O}{W}{S}                       { character += yyleng; return ROWS; }
+{S}{C}{O}{R}{E}{S}                 { character += yyleng; return SCORES; }
 {S}{E}{L}{E}{C}{T}                 { character += yyleng; return SELECT; }
 {S}{E}{T}                          { character += yyleng; return SET; }
 {S}{H}{O}{W}                       { character += yyleng; return SHOW; }
@@ -95,18 +107,21 @@ Z [zZ]
 {T}{E}{X}{T}                       { character += yyleng; return TEXT; }
 {T}{H}{R}{E}{S}{H}{O}{L}{D}{S}     { character += yyleng; return THRESHOLDS; }
 {T}{I}{M}{E}                       { character += yyleng; return TIME; }
+{T}{I}{M}{E}{O}{U}{T}              { character += yyleng; return TIMEOUT; }
 {V}{A}{L}{U}{E}{S}                 { character += yyleng; return VALUES; }
+{W}{A}{R}{M}{U}{P}                 { character += yyleng; return WARMUP; }
 {W}{I}{T}{H}                       { character += yyleng; return WITH; }
 
+\$[1-9][0-9]*        { yylval->l = strtol (yytext + 1, 0, 10); character += yyleng; return Parameter; }
 0x[A-Fa-f0-9]*      { yylval->l = strtol (yytext + 2, 0, 16); character += yyleng; return Integer; }
-[1-9][0-9]*-[01][0-9]-[0123][0-9] { yylval->c = yyextra->copyString(kj::StringPtr(yytext, yyleng)).cStr(); character += yyleng; return Date; }
+[1-9][0-9]*-[01][0-9]-[0123][0-9] { yylval->c = yyextra->arena->copyString(kj::StringPtr(yytext, yyleng)).cStr(); character += yyleng; return Date; }
 -?[0-9]+            { yylval->l = strtol (yytext, 0, 0); character += yyleng; return Integer; }
--?[0-9]+\.[0-9]+    { yylval->c = yyextra->copyString(kj::StringPtr(yytext, yyleng)).cStr(); character += yyleng; return Numeric; }
+-?[0-9]+\.[0-9]+    { yylval->c = yyextra->arena->copyString(kj::StringPtr(yytext, yyleng)).cStr(); character += yyleng; return Numeric; }
 
 \' { return stringliteral (yyscanner); }
 \" { return stringliteral (yyscanner); }
 
-[A-Za-z_#.:%@/][A-Za-z0-9_.:%@/-]* { yylval->c = yyextra->copyString(kj::StringPtr(yytext, yyleng)).cStr(); character += yyleng; return Identifier; }
+[A-Za-z_#.:%@/][A-Za-z0-9_.:%@/-]* { yylval->c = yyextra->arena->copyString(kj::StringPtr(yytext, yyleng)).cStr(); character += yyleng; return Identifier; }
 [ \t\r\026]+                  { character += yyleng; }
 
 \n                       { ++line; character = 1; }
@@ -160,7 +175,7 @@ static int stringliteral(yyscan_t yyscanner) {
 
   unput(ch);
 
-  yylval->c = yyextra->copyString(kj::StringPtr(result.data(), result.size())).cStr();
+  yylval->c = yyextra->arena->copyString(kj::StringPtr(result.data(), result.size())).cStr();
 
   return (quote_char == '"') ? Identifier : StringLiteral;
 }
@@ -180,7 +195,7 @@ void CA_parse_script(QueryParseContext* context, FILE* input) {
     line = 1;
 
     yy_switch_to_buffer(buf, context->scanner);
-    yyset_extra(&context->arena, context->scanner);
+    yyset_extra(context, context->scanner);
     KJ_REQUIRE(0 == yyparse(context));
     yy_delete_buffer(buf, context->scanner);
   }
@@ -17,6 +17,7 @@ using namespace cantera::table;
 %union
 {
   LinkedList<double>* double_list;
+  LinkedList<const char*>* string_list;
   Query* query;
   QueryList* query_list;
   Statement* statement;
@@ -42,7 +43,7 @@ using namespace cantera::table;
 
 template <typename T>
 void Allocate(QueryParseContext* context, T*& t) {
-  t = &context->arena.allocate<T>();
+  t = &context->arena->allocate<T>();
 }
 
 #define ALLOC(t) do { Allocate(context, t); } while (0)
@@ -55,37 +56,41 @@ yyerror (YYLTYPE *loc, QueryParseContext *context, const char *message);
 #define scanner context->scanner
 %}
 
-%token AND CREATE FROM INDEX KEY LIMIT NOT OFFSET_SCORE OR PATH PRIMARY QUERY
+%token AND COUNT CREATE FROM INDEX KEY LIMIT NOT OFFSET_SCORE OR PATH PRIMARY QUERY
 %token AND_NOT SHOW TABLES TEXT TIME UTF8BOM KEYS
-%token WHERE WITH SUMMARIES
+%token WHERE WITH SUMMARIES SCORES
 %token OFFSET FETCH FIRST NEXT ROW ROWS ONLY
 %token TRUE FALSE
 %token INTO VALUES ORDER_BY
 %token SELECT MAX MIN RANDOM_SAMPLE MODID
-%token SET OUTPUT FORMAT CSV JSON
-%token CORRELATE PARSE
-%token THRESHOLDS FOR
+%token SET OUTPUT FORMAT CSV JSON MEMORY
+%token CORRELATE PARSE EXPLAIN ANALYZE
+%token PREPARE EXECUTE DEALLOCATE AS
+%token THRESHOLDS FOR FACET BY TIMEOUT RELOAD WARMUP
 
 %token Date
 %token Identifier
 %token Integer
 %token Numeric
+%token Parameter
 %token StringLiteral
 
 %type<d> number
 
-%type<c> StringLiteral Identifier Date Numeric
+%type<c> StringLiteral Identifier Date Numeric parameterValue
 
 %type<double_list> integerList
+%type<string_list> parameterValueList
 %type<query> query subQuery subQueryList
 %type<query_list> queryList
 %type<statement> statement
 %type<threshold_clause> thresholdClause
 
-%type<l> Integer
+%type<l> Integer Parameter
 %type<l> fetchClause
 %type<l> keysClause
 %type<l> offsetClause
+%type<l> optionalWithScores
 %type<l> optionalWithSummaries
 %type<runtime_parameter> runtimeParameter
 %type<runtime_parameter_value> runtimeParameterValue
@@ -100,13 +105,11 @@ document
 topStatements
     : topStatements statement ';'
       {
-        CA_process_statement (context, $2);
-        fflush (stdout);
+        CA_dispatch_statement (context, $2);
       }
     | statement ';'
       {
-        CA_process_statement (context, $1);
-        fflush (stdout);
+        CA_dispatch_statement (context, $1);
       }
     ;
 
@@ -129,6 +132,20 @@ statement
         query->limit = $5;
         query->offset = $6;
 
+        $$ = stmt;
+      }
+    | QUERY COUNT query
+      {
+        Statement *stmt;
+        struct query_statement *query;
+
+        ALLOC (stmt);
+        stmt->type = kStatementQuery;
+        query = &stmt->u.query;
+        query->count_only = 1;
+        query->query = $3;
+        query->limit = -1;
+
         $$ = stmt;
       }
     | CORRELATE QUERY query ',' query
@@ -142,6 +159,76 @@ statement
         query->query_A = $3;
         query->query_B = $5;
 
+        $$ = stmt;
+      }
+    | EXPLAIN ANALYZE QUERY keysClause query thresholdClause fetchClause offsetClause
+      {
+        Statement *stmt;
+        struct query_statement *query;
+
+        ALLOC (stmt);
+        stmt->type = kStatementExplain;
+        query = &stmt->u.query;
+        query->keys_only = $4;
+        query->query = $5;
+        query->thresholds = $6;
+        query->limit = $7;
+        query->offset = $8;
+
+        $$ = stmt;
+      }
+    | PREPARE Identifier AS statement
+      {
+        Statement *stmt;
+        ALLOC (stmt);
+        stmt->type = kStatementPrepare;
+        stmt->u.prepare.name = $2;
+        stmt->u.prepare.statement = $4;
+
+        $$ = stmt;
+      }
+    | EXECUTE Identifier
+      {
+        Statement *stmt;
+        ALLOC (stmt);
+        stmt->type = kStatementExecute;
+        stmt->u.execute.name = $2;
+        stmt->u.execute.parameters = nullptr;
+
+        $$ = stmt;
+      }
+    | EXECUTE Identifier '(' parameterValueList ')'
+      {
+        Statement *stmt;
+        ALLOC (stmt);
+        stmt->type = kStatementExecute;
+        stmt->u.execute.name = $2;
+        stmt->u.execute.parameters = $4;
+
+        $$ = stmt;
+      }
+    | DEALLOCATE Identifier
+      {
+        Statement *stmt;
+        ALLOC (stmt);
+        stmt->type = kStatementDeallocate;
+        stmt->u.deallocate.name = $2;
+
+        $$ = stmt;
+      }
+    | FACET query BY StringLiteral THRESHOLDS '(' integerList ')' optionalWithScores
+      {
+        Statement *stmt;
+        struct facet_statement *facet;
+
+        ALLOC (stmt);
+        stmt->type = kStatementFacet;
+        facet = &stmt->u.facet;
+        facet->query = $2;
+        facet->key = $4;
+        facet->thresholds = $7;
+        facet->with_scores = $9;
+
         $$ = stmt;
       }
     | PARSE subQueryList
@@ -151,6 +238,14 @@ statement
         stmt->type = kStatementParse;
         stmt->u.parse.query = $2;
 
+        $$ = stmt;
+      }
+    | RELOAD
+      {
+        Statement* stmt;
+        ALLOC(stmt);
+        stmt->type = kStatementReload;
+
         $$ = stmt;
       }
     | SELECT queryList FROM query optionalWithSummaries
@@ -191,6 +286,50 @@ statement
         set->parameter = CA_PARAM_TIME_FORMAT;
         set->v.string_value = $4;
 
+        $$ = stmt;
+      }
+    | SET MEMORY LIMIT Integer
+      {
+        Statement *stmt;
+        struct set_statement *set;
+
+        ALLOC (stmt);
+        stmt->type = kStatementSet;
+        set = &stmt->u.set;
+        set->parameter = CA_PARAM_MEMORY_LIMIT;
+        set->v.integer_value = $4;
+
+        $$ = stmt;
+      }
+    | SET TIMEOUT Integer
+      {
+        Statement *stmt;
+        struct set_statement *set;
+
+        ALLOC (stmt);
+        stmt->type = kStatementSet;
+        set = &stmt->u.set;
+        set->parameter = CA_PARAM_TIMEOUT;
+        set->v.integer_value = $3;
+
+        $$ = stmt;
+      }
+    | WARMUP
+      {
+        Statement *stmt;
+        ALLOC (stmt);
+        stmt->type = kStatementWarmUp;
+        stmt->u.warmup.keys = nullptr;
+
+        $$ = stmt;
+      }
+    | WARMUP KEYS '(' parameterValueList ')'
+      {
+        Statement *stmt;
+        ALLOC (stmt);
+        stmt->type = kStatementWarmUp;
+        stmt->u.warmup.keys = $4;
+
         $$ = stmt;
       }
     ;
@@ -229,6 +368,22 @@ subQuery
         q->identifier = $3;
         $$ = q;
       }
+    | Parameter
+      {
+        struct Query *q;
+        ALLOC(q);
+        q->type = kQueryLeaf;
+        q->parameter = $1;
+        $$ = q;
+      }
+    | KEY '=' Parameter
+      {
+        struct Query *q;
+        ALLOC(q);
+        q->type = kQueryKey;
+        q->parameter = $3;
+        $$ = q;
+      }
     | MAX '(' subQuery ')'
       {
         struct Query *q;
@@ -453,6 +608,11 @@ firstOrNext
     | NEXT
     ;
 
+optionalWithScores
+    :             { $$ = 0; }
+    | WITH SCORES { $$ = 1; }
+    ;
+
 optionalWithSummaries
     :                { $$ = 0; }
     | WITH SUMMARIES { $$ = 1; }
@@ -521,6 +681,29 @@ queryList
       }
     ;
 
+parameterValueList
+    : parameterValue ',' parameterValueList
+      {
+        LinkedList<const char*>* pl;
+        ALLOC(pl);
+        pl->value = $1;
+        pl->next = $3;
+        $$ = pl;
+      }
+    | parameterValue
+      {
+        LinkedList<const char*>* pl;
+        ALLOC(pl);
+        pl->value = $1;
+        $$ = pl;
+      }
+    ;
+
+parameterValue
+    : Identifier    { $$ = $1; }
+    | StringLiteral { $$ = $1; }
+    ;
+
 keysClause
     :          { $$ = 0; }
     | KEYS FOR { $$ = 1; }
@@ -539,8 +722,8 @@ fetchClause
 %%
 #include <stdio.h>
 
-extern unsigned int character;
-extern unsigned int line;
+extern thread_local unsigned int character;
+extern thread_local unsigned int line;
 
 void yyerror(YYLTYPE* loc, QueryParseContext* context, const char* message) {
   KJ_FAIL_REQUIRE(message, line, character);
@@ -23,9 +23,11 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstring>
 #include <ctime>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <memory>
 #include <random>
@@ -56,21 +58,26 @@ using namespace internal;
 
 namespace {
 
+std::mutex extra_data_mutex;
 std::unordered_map<uint64_t, Json::Value> extra_data;
 
-std::vector<ca_offset_score> UnionOffsets(
-    const std::vector<ca_offset_score>& lhs,
-    const std::vector<ca_offset_score>& rhs) {
-  std::vector<ca_offset_score> result;
-
-  result.reserve(lhs.size() + rhs.size());
+// Stores the union of `lhs' and `rhs' in `result', which must be empty and
+// have room for the elements of both.
+void UnionOffsets(std::vector<ca_offset_score>& result,
+                  const std::vector<ca_offset_score>& lhs,
+                  const std::vector<ca_offset_score>& rhs,
+                  const QueryCancellation& cancellation) {
+  KJ_ASSERT(result.empty());
+  KJ_ASSERT(result.capacity() >= lhs.size() + rhs.size());
 
   auto lhs_iter = lhs.begin();
   auto rhs_iter = rhs.begin();
   auto lhs_end = lhs.end();
   auto rhs_end = rhs.end();
 
-  while (lhs_iter != lhs_end && rhs_iter != rhs_end) {
+  for (size_t n = 1; lhs_iter != lhs_end && rhs_iter != rhs_end; ++n) {
+    if (!(n % QueryCancellation::kPollInterval)) cancellation.Check();
+
     if (lhs_iter->offset < rhs_iter->offset) {
       result.emplace_back(*lhs_iter++);
     } else {
@@ -82,12 +89,11 @@ std::vector<ca_offset_score> UnionOffsets(
 
   result.insert(result.end(), lhs_iter, lhs_end);
   result.insert(result.end(), rhs_iter, rhs_end);
-
-  return result;
 }
 
 size_t IntersectOffsets(struct ca_offset_score* lhs, size_t lhs_count,
-                        const struct ca_offset_score* rhs, size_t rhs_count) {
+                        const struct ca_offset_score* rhs, size_t rhs_count,
+                        const QueryCancellation& cancellation) {
   struct ca_offset_score* output, *o;
   const struct ca_offset_score* lhs_end, *rhs_end;
 
@@ -96,7 +102,9 @@ size_t IntersectOffsets(struct ca_offset_score* lhs, size_t lhs_count,
   lhs_end = lhs + lhs_count;
   rhs_end = rhs + rhs_count;
 
-  while (lhs != lhs_end && rhs != rhs_end) {
+  for (size_t n = 1; lhs != lhs_end && rhs != rhs_end; ++n) {
+    if (!(n % QueryCancellation::kPollInterval)) cancellation.Check();
+
     if (lhs->offset == rhs->offset) {
       const auto offset = lhs->offset;
       do {
@@ -190,29 +198,68 @@ void Join(std::vector<ca_offset_score>& lhs,
 
 }  // namespace
 
+// Looks up `key' in every index table, and calls `callback' once for every
+// table containing it.  If `profile' is not null, the I/O and decoding work is
+// added to the statistics of the query tree node `node'.  If `cancellation' is
+// set, lookups that have not started yet are skipped.
 void LookupIndexKey(
-    internal::ThreadPool& pool,
+    internal::TaskGroup& tasks,
     const std::vector<std::unique_ptr<Table>>& index_tables,
     const char* key,
-    std::function<void(std::vector<ca_offset_score>)>&& callback) {
+    std::function<void(std::vector<ca_offset_score>)>&& callback,
+    QueryProfile* profile = nullptr, const Query* node = nullptr,
+    const QueryCancellation* cancellation = nullptr) {
   const auto unescaped_key = DecodeURIComponent(key);
 
   for (size_t i = 0; i < index_tables.size(); ++i) {
     Table *index_table = index_tables[i].get();
-    pool.Launch(
+    tasks.Launch(
       [=]
       {
+        // The caller checks the token once all lookups have finished.
+        if (cancellation && cancellation->IsCancelled()) return;
+
+        using clock = std::chrono::steady_clock;
+
+        const auto start = clock::now();
+        const auto io_before = ThreadTableIOStats();
+        clock::duration decode_time{};
+
         std::vector<ca_offset_score> new_offsets;
+        bool found;
         {
           string_view key, data;
-          std::unique_lock<std::mutex> l(index_table->lock);
-          if (!index_table->SeekToKey(unescaped_key)) return;
+          auto cursor = index_table->NewCursor();
+          found = cursor->SeekToKey(unescaped_key);
 
-          KJ_REQUIRE(index_table->ReadRow(key, data));
+          if (found) {
+            KJ_REQUIRE(cursor->ReadRow(key, data));
 
-          ca_offset_score_parse(data, &new_offsets);
+            const auto decode_start = clock::now();
+            ca_offset_score_parse(data, &new_offsets, cancellation);
+            decode_time = clock::now() - decode_start;
+          }
+        }
+
+        if (profile) {
+          const auto& io_after = ThreadTableIOStats();
+          std::unique_lock<std::mutex> l(profile->mutex);
+          auto& stats = profile->nodes[node];
+          stats.wall_time +=
+              std::chrono::duration<double>(clock::now() - start).count();
+          stats.bytes_read += io_after.bytes_read - io_before.bytes_read;
+          stats.bytes_decompressed +=
+              io_after.bytes_decompressed - io_before.bytes_decompressed;
+          stats.block_cache_hits +=
+              io_after.block_cache_hits - io_before.block_cache_hits;
+          stats.block_cache_misses +=
+              io_after.block_cache_misses - io_before.block_cache_misses;
+          stats.decode_time +=
+              std::chrono::duration<double>(decode_time).count();
         }
-        callback(std::move(new_offsets));
+
+        if (cancellation && cancellation->IsCancelled()) return;
+        if (found) callback(std::move(new_offsets));
       }
     );
   }
@@ -223,19 +270,25 @@ void LookupIndexKey(
     const char* key,
     std::function<void(std::vector<ca_offset_score>)>&& callback) {
 
-  internal::ThreadPool pool(1);
+  // The tables are searched in parallel, but the callback is not reentrant.
+  std::mutex callback_mutex;
+  internal::TaskGroup tasks(internal::ThreadPool::Default());
 
   LookupIndexKey(
-    pool,
+    tasks,
     index_tables,
     key,
-    std::move(callback));
-  pool.Wait();
+    [&callback_mutex, &callback](auto new_offsets) {
+      std::unique_lock<std::mutex> l(callback_mutex);
+      callback(std::move(new_offsets));
+    });
+  tasks.Wait();
 }
 void LookupIndexKey(
     const std::unordered_map<std::string, std::vector<ca_offset_score>> &leaf_offset_cache,
     const std::vector<std::unique_ptr<Table>>& index_tables,
     const char* token, bool make_headers,
+    const QueryCancellation& cancellation,
     std::function<void(std::vector<ca_offset_score>)>&& callback) {
   const char *delimiter = strchr(token, ':');
 
@@ -306,6 +359,8 @@ void LookupIndexKey(
 
     // Look up one "name:X" token per potential hostname found.
     for (const auto& name : names) {
+      cancellation.Check();
+
       LookupIndexKey(
           index_tables, (field + name.first).c_str(),
           [&name, &header_key, &offset_buffer, make_headers](auto new_offsets) {
@@ -314,6 +369,7 @@ void LookupIndexKey(
 
               // Record headers.
               if (!name.second.first.empty() && !make_headers) {
+                std::unique_lock<std::mutex> l(extra_data_mutex);
                 extra_data[offset.offset]["_header"] =
                     Json::Value(name.second.first);
                 extra_data[offset.offset]["_header_key"] =
@@ -339,13 +395,15 @@ void LookupIndexKey(
     std::set<uint64_t> offset_buffer;
 
     for (size_t i = 0; i < index_tables.size(); ++i) {
-      index_tables[i]->SeekToFirst();
+      auto cursor = index_tables[i]->NewCursor();
 
       // Seek to first key in range.
-      index_tables[i]->SeekToKey(key);
+      cursor->SeekToKey(key);
 
       string_view row_key, data;
-      while (index_tables[i]->ReadRow(row_key, data)) {
+      while (cursor->ReadRow(row_key, data)) {
+        cancellation.Check();
+
         std::vector<ca_offset_score> new_offsets;
 
         if (!HasPrefix(row_key, key)) {
@@ -379,6 +437,12 @@ void LookupIndexKey(
 
 size_t SubtractOffsets(struct ca_offset_score* lhs, size_t lhs_count,
                        const struct ca_offset_score* rhs, size_t rhs_count) {
+  return SubtractOffsets(lhs, lhs_count, rhs, rhs_count, nullptr);
+}
+
+size_t SubtractOffsets(struct ca_offset_score* lhs, size_t lhs_count,
+                       const struct ca_offset_score* rhs, size_t rhs_count,
+                       const QueryCancellation* cancellation) {
   // We can't use std::set_difference() here, because it will not delete
   // duplicate offsets from `lhs' unless the same duplicate count exists in
   // `rhs'.
@@ -391,7 +455,10 @@ size_t SubtractOffsets(struct ca_offset_score* lhs, size_t lhs_count,
   lhs_end = lhs + lhs_count;
   rhs_end = rhs + rhs_count;
 
-  while (lhs != lhs_end && rhs != rhs_end) {
+  for (size_t n = 1; lhs != lhs_end && rhs != rhs_end; ++n) {
+    if (cancellation && !(n % QueryCancellation::kPollInterval))
+      cancellation->Check();
+
     if (lhs->offset == rhs->offset) {
       do
         ++lhs;
@@ -413,49 +480,204 @@ size_t SubtractOffsets(struct ca_offset_score* lhs, size_t lhs_count,
   return o - output;
 }
 
-void FillLeafOffsetCache(
-  internal::ThreadPool& pool,
+namespace {
+
+// Adds the offsets found for a key in one index table, `new_offsets', to those
+// found for it in other tables, `entry'.  `new_offsets' must be charged to the
+// statement's memory already.  The caller must hold the lock protecting
+// `entry'.  Since this runs in worker threads, exceeding the memory limit
+// cancels the statement instead of throwing.
+void AddLeafOffsets(std::vector<ca_offset_score>& entry,
+                    std::vector<ca_offset_score>&& new_offsets,
+                    QueryExecution& execution) {
+  auto& memory = execution.memory;
+
+  if (entry.empty()) {
+    memory.Uncharge(entry.capacity() * sizeof(ca_offset_score));
+    entry = std::move(new_offsets);
+    return;
+  }
+
+  std::vector<ca_offset_score> merged;
+  merged.reserve(entry.size() + new_offsets.size());
+  if (!memory.TryCharge(merged.capacity() * sizeof(ca_offset_score))) {
+    memory.Uncharge(new_offsets.capacity() * sizeof(ca_offset_score));
+    execution.cancellation.Cancel();
+    return;
+  }
+
+  std::merge(entry.begin(), entry.end(), new_offsets.begin(),
+             new_offsets.end(), std::back_inserter(merged),
+             [](const auto& lhs, const auto& rhs) {
+               return lhs.offset < rhs.offset;
+             });
+  memory.Uncharge((entry.capacity() + new_offsets.capacity()) *
+                  sizeof(ca_offset_score));
+  entry.swap(merged);
+}
+
+}  // namespace
+
+// Looks up the leaves of `query' one key and table at a time, so that the cost
+// of each lookup can be attributed to its query tree node.
+void FillProfiledLeafOffsetCache(
+  internal::TaskGroup& tasks,
   std::mutex& map_mutex,
   std::unordered_map<std::string, std::vector<ca_offset_score>> &leaf_offset_cache,
   const Query* query,
-  Schema* schema)
+  Schema* schema,
+  QueryExecution& execution)
 {
   if (query->type == kQueryLeaf)
   {
     std::vector<ca_offset_score> *cached;
     {
       std::unique_lock<std::mutex> l(map_mutex);
-      if (leaf_offset_cache.count(query->identifier)==1) return;
+      if (leaf_offset_cache.count(query->identifier)==1) {
+        std::unique_lock<std::mutex> pl(execution.profile->mutex);
+        execution.profile->nodes[query].shared_lookup = true;
+        return;
+      }
 
       // make sure it exists so multiple threads don't try at once
       cached = &(leaf_offset_cache[query->identifier] = {});
     }
 
     LookupIndexKey(
-      pool,
+      tasks,
       schema->IndexTables(), query->identifier,
-      [=](auto new_offsets) {
-        *cached = std::move(new_offsets);
-      });
+      [cached, &map_mutex, &execution](auto new_offsets) {
+        // Exceeding the memory limit is reported by CheckLimit() once all
+        // lookups have finished, since we can't throw from a worker thread.
+        // The remaining lookups would be wasted, so skip them.
+        if (!execution.memory.TryCharge(new_offsets.capacity() *
+                                        sizeof(ca_offset_score))) {
+          execution.cancellation.Cancel();
+          return;
+        }
+
+        std::unique_lock<std::mutex> l(map_mutex);
+        AddLeafOffsets(*cached, std::move(new_offsets), execution);
+      },
+      execution.profile, query, &execution.cancellation);
   }
   else
   {
     if (query->rhs)
-      FillLeafOffsetCache(pool, map_mutex, leaf_offset_cache, query->rhs, schema);
+      FillProfiledLeafOffsetCache(tasks, map_mutex, leaf_offset_cache, query->rhs, schema, execution);
     if (query->lhs)
-      FillLeafOffsetCache(pool, map_mutex, leaf_offset_cache, query->lhs, schema);
+      FillProfiledLeafOffsetCache(tasks, map_mutex, leaf_offset_cache, query->lhs, schema, execution);
+  }
+}
+
+namespace {
+
+// The leaves of a query tree which are looked up together.
+struct LeafBatch {
+  std::vector<std::string> unescaped_keys;
+  std::vector<string_view> keys;
+
+  // The leaf offset cache entry of each key.
+  std::vector<std::vector<ca_offset_score>*> entries;
+};
+
+// Adds an empty cache entry for every leaf of `query' not in the cache yet,
+// and adds the leaf to `batch'.
+void AddMissingLeaves(
+    std::unordered_map<std::string, std::vector<ca_offset_score>>&
+        leaf_offset_cache,
+    const Query* query, LeafBatch& batch) {
+  if (query->type == kQueryLeaf) {
+    if (leaf_offset_cache.count(query->identifier)) return;
+
+    batch.unescaped_keys.emplace_back(DecodeURIComponent(query->identifier));
+    batch.entries.emplace_back(&leaf_offset_cache[query->identifier]);
+    return;
   }
+
+  if (query->rhs) AddMissingLeaves(leaf_offset_cache, query->rhs, batch);
+  if (query->lhs) AddMissingLeaves(leaf_offset_cache, query->lhs, batch);
 }
+
+}  // namespace
+
+// Looks up all the leaves of `query' with one batch of reads per index table,
+// so that table backends can fetch all the blocks they need at once.
+void FillLeafOffsetCache(
+  internal::TaskGroup& tasks,
+  std::mutex& map_mutex,
+  std::unordered_map<std::string, std::vector<ca_offset_score>> &leaf_offset_cache,
+  const Query* query,
+  Schema* schema,
+  QueryExecution& execution)
+{
+  if (execution.profile) {
+    FillProfiledLeafOffsetCache(tasks, map_mutex, leaf_offset_cache, query,
+                                schema, execution);
+    return;
+  }
+
+  // Shared by the lookup tasks, which may outlive this call.
+  auto batch = std::make_shared<LeafBatch>();
+  {
+    std::unique_lock<std::mutex> l(map_mutex);
+    AddMissingLeaves(leaf_offset_cache, query, *batch);
+  }
+  if (batch->entries.empty()) return;
+
+  for (const auto& key : batch->unescaped_keys) batch->keys.emplace_back(key);
+
+  for (const auto& index_table : schema->IndexTables()) {
+    Table* table = index_table.get();
+    tasks.Launch([table, batch, &map_mutex, &execution] {
+      // The caller checks the token once all lookups have finished.
+      auto& cancellation = execution.cancellation;
+      if (cancellation.IsCancelled()) return;
+
+      table->LookupKeys(batch->keys, [&batch, &map_mutex, &execution,
+                                      &cancellation](size_t i,
+                                                     const string_view& data) {
+        if (cancellation.IsCancelled()) return;
+
+        std::vector<ca_offset_score> new_offsets;
+        ca_offset_score_parse(data, &new_offsets, &cancellation);
+        if (cancellation.IsCancelled()) return;
+
+        // Exceeding the memory limit is reported by CheckLimit() once all
+        // lookups have finished, since we can't throw from a worker thread.
+        if (!execution.memory.TryCharge(new_offsets.capacity() *
+                                        sizeof(ca_offset_score))) {
+          cancellation.Cancel();
+          return;
+        }
+
+        std::unique_lock<std::mutex> l(map_mutex);
+        AddLeafOffsets(*batch->entries[i], std::move(new_offsets), execution);
+      });
+    });
+  }
+}
+
 void ProcessSubQuery(
   const std::unordered_map<std::string, std::vector<ca_offset_score>> &leaf_offset_cache,
   std::vector<ca_offset_score>& offsets, const Query* query,
-  Schema* schema, bool make_headers) {
+  Schema* schema, bool make_headers, QueryExecution& execution);
+
+void EvaluateSubQuery(
+  const std::unordered_map<std::string, std::vector<ca_offset_score>> &leaf_offset_cache,
+  std::vector<ca_offset_score>& offsets, const Query* query,
+  Schema* schema, bool make_headers, QueryExecution& execution) {
+  auto& memory = execution.memory;
+  const auto& cancellation = execution.cancellation;
+
   switch (query->type) {
     case kQueryKey: {
       string_view key(query->identifier);
       for (const auto& st : schema->summary_tables) {
-        if (st.second->SeekToKey(key)) {
-          offsets.emplace_back(st.second->Offset() + std::get<uint64_t>(st),
+        auto cursor = st.second->NewSeekableCursor();
+        if (cursor->SeekToKey(key)) {
+          memory.Reserve(offsets, offsets.size() + 1);
+          offsets.emplace_back(cursor->Offset() + std::get<uint64_t>(st),
                                0.0f);
           break;
         }
@@ -466,45 +688,61 @@ void ProcessSubQuery(
       LookupIndexKey(
         leaf_offset_cache,
         schema->IndexTables(), query->identifier, make_headers,
-        [&offsets](auto new_offsets) { offsets = std::move(new_offsets); }
+        cancellation,
+        [&offsets, &memory](auto new_offsets) {
+          // The cached list was charged when it was looked up.  Only the
+          // copy kept in `offsets' is charged here.
+          memory.Reserve(offsets, new_offsets.size());
+          offsets.assign(new_offsets.begin(), new_offsets.end());
+        }
       );
       break;
 
     case kQueryBinaryOperator:
-      ProcessSubQuery(leaf_offset_cache, offsets, query->lhs, schema, make_headers);
+      ProcessSubQuery(leaf_offset_cache, offsets, query->lhs, schema, make_headers, execution);
 
       switch (query->operator_type) {
         case kOperatorOr: {
           if (offsets.empty()) {
-            ProcessSubQuery(leaf_offset_cache, offsets, query->rhs, schema, make_headers);
+            ProcessSubQuery(leaf_offset_cache, offsets, query->rhs, schema, make_headers, execution);
           } else {
-            std::vector<ca_offset_score> rhs;
-            ProcessSubQuery(leaf_offset_cache, rhs, query->rhs, schema, make_headers);
+            auto rhs = memory.Acquire();
+            ProcessSubQuery(leaf_offset_cache, rhs, query->rhs, schema, make_headers, execution);
+
+            auto result = memory.Acquire();
+            memory.Reserve(result, offsets.size() + rhs.size());
+            UnionOffsets(result, offsets, rhs, cancellation);
+            offsets.swap(result);
 
-            offsets = UnionOffsets(offsets, rhs);
+            memory.Release(std::move(result));
+            memory.Release(std::move(rhs));
           }
         } break;
 
         case kOperatorAnd: {
           if (offsets.empty()) return;
 
-          std::vector<ca_offset_score> rhs;
-          ProcessSubQuery(leaf_offset_cache, rhs, query->rhs, schema, make_headers);
+          auto rhs = memory.Acquire();
+          ProcessSubQuery(leaf_offset_cache, rhs, query->rhs, schema, make_headers, execution);
 
-          const auto new_size = IntersectOffsets(offsets.data(), offsets.size(),
-                                                 rhs.data(), rhs.size());
+          const auto new_size =
+              IntersectOffsets(offsets.data(), offsets.size(), rhs.data(),
+                               rhs.size(), cancellation);
           offsets.resize(new_size);
+          memory.Release(std::move(rhs));
         } break;
 
         case kOperatorSubtract: {
           if (offsets.empty()) return;
 
-          std::vector<ca_offset_score> rhs;
-          ProcessSubQuery(leaf_offset_cache, rhs, query->rhs, schema, make_headers);
+          auto rhs = memory.Acquire();
+          ProcessSubQuery(leaf_offset_cache, rhs, query->rhs, schema, make_headers, execution);
 
-          const auto new_size = SubtractOffsets(
-              offsets.data(), offsets.size(), rhs.data(), rhs.size());
+          const auto new_size =
+              SubtractOffsets(offsets.data(), offsets.size(), rhs.data(),
+                              rhs.size(), &cancellation);
           offsets.resize(new_size);
+          memory.Release(std::move(rhs));
         } break;
 
         case kOperatorEQ:
@@ -517,11 +755,12 @@ void ProcessSubQuery(
 
         case kOperatorGT:
           if (query->rhs) {
-            std::vector<ca_offset_score> rhs;
-            ProcessSubQuery(leaf_offset_cache, rhs, query->rhs, schema, make_headers);
+            auto rhs = memory.Acquire();
+            ProcessSubQuery(leaf_offset_cache, rhs, query->rhs, schema, make_headers, execution);
 
             Join(offsets, rhs,
                  [](const auto lhs, const auto rhs) { return lhs > rhs; });
+            memory.Release(std::move(rhs));
           } else {
             offsets.erase(std::remove_if(offsets.begin(), offsets.end(),
                                          [value = query->value](const auto& v) {
@@ -541,11 +780,12 @@ void ProcessSubQuery(
 
         case kOperatorLT:
           if (query->rhs) {
-            std::vector<ca_offset_score> rhs;
-            ProcessSubQuery(leaf_offset_cache, rhs, query->rhs, schema, make_headers);
+            auto rhs = memory.Acquire();
+            ProcessSubQuery(leaf_offset_cache, rhs, query->rhs, schema, make_headers, execution);
 
             Join(offsets, rhs,
                  [](const auto lhs, const auto rhs) { return lhs < rhs; });
+            memory.Release(std::move(rhs));
           } else {
             offsets.erase(std::remove_if(offsets.begin(), offsets.end(),
                                          [value = query->value](const auto& v) {
@@ -577,13 +817,15 @@ void ProcessSubQuery(
         case kOperatorOrderBy: {
           if (offsets.size() <= 1) break;
 
-          std::vector<ca_offset_score> rhs;
-          ProcessSubQuery(leaf_offset_cache, rhs, query->rhs, schema, make_headers);
+          auto rhs = memory.Acquire();
+          ProcessSubQuery(leaf_offset_cache, rhs, query->rhs, schema, make_headers, execution);
 
           auto l = offsets.begin();
           auto r = rhs.begin();
 
-          while (l != offsets.end() && r != rhs.end()) {
+          for (size_t n = 1; l != offsets.end() && r != rhs.end(); ++n) {
+            if (!(n % QueryCancellation::kPollInterval)) cancellation.Check();
+
             if (l->offset < r->offset) {
               l->score = -HUGE_VAL;
               ++l;
@@ -604,6 +846,8 @@ void ProcessSubQuery(
             l->score = -HUGE_VAL;
             ++l;
           }
+
+          memory.Release(std::move(rhs));
         } break;
 
         case kOperatorRandomSample: {
@@ -614,6 +858,8 @@ void ProcessSubQuery(
           std::mt19937_64 rng(1234);
 
           for (size_t i = count; i < offsets.size(); ++i) {
+            if (!(i % QueryCancellation::kPollInterval)) cancellation.Check();
+
             std::uniform_int_distribution<size_t> dist(0, i);
             const auto j = dist(rng);
             if (j < count) std::swap(offsets[i], offsets[j]);
@@ -632,7 +878,7 @@ void ProcessSubQuery(
       break;
 
     case kQueryUnaryOperator:
-      ProcessSubQuery(leaf_offset_cache, offsets, query->lhs, schema, make_headers);
+      ProcessSubQuery(leaf_offset_cache, offsets, query->lhs, schema, make_headers, execution);
 
       switch (query->operator_type) {
         case kOperatorMax:
@@ -665,28 +911,30 @@ void ProcessSubQuery(
           }
           break;
 
-        case kOperatorModId:
+        case kOperatorModId: {
+          auto& summary_tables = schema->summary_tables;
+          auto summary_cursors = schema->NewSummaryCursors();
+
           for (auto& v : offsets)
           {
-            auto& summary_tables = schema->summary_tables;
             auto summary_table_idx = summary_tables.size();
 
             while (--summary_table_idx &&
                   std::get<uint64_t>(summary_tables[summary_table_idx]) > v.offset)
               ;
 
-            summary_tables[summary_table_idx].second->Seek(
+            auto& cursor = summary_cursors[summary_table_idx];
+            cursor->Seek(
                 v.offset - std::get<uint64_t>(summary_tables[summary_table_idx]),
                 SEEK_SET);
 
             string_view row_key, data;
-            KJ_REQUIRE(summary_tables[summary_table_idx].second->ReadRow(
-                row_key, data));
+            KJ_REQUIRE(cursor->ReadRow(row_key, data));
 
             v.score = uint64_t(std::hash<string_view>()(row_key))
                   %uint64_t(query->value);
           }
-          break;
+        } break;
 
         case kOperatorNegate:
           for (auto& o : offsets) o.score = -o.score;
@@ -703,49 +951,504 @@ void ProcessSubQuery(
   }
 }
 
+void ProcessSubQuery(
+  const std::unordered_map<std::string, std::vector<ca_offset_score>> &leaf_offset_cache,
+  std::vector<ca_offset_score>& offsets, const Query* query,
+  Schema* schema, bool make_headers, QueryExecution& execution) {
+  auto profile = execution.profile;
+
+  execution.cancellation.Check();
+
+  const auto start = std::chrono::steady_clock::now();
+
+  const auto shared = execution.subexpressions.Find(query);
+
+  if (shared) {
+    execution.memory.Reserve(offsets, shared->size());
+    offsets.assign(shared->begin(), shared->end());
+  } else {
+    EvaluateSubQuery(leaf_offset_cache, offsets, query, schema, make_headers,
+                     execution);
+    execution.subexpressions.Store(query, offsets, execution.memory);
+  }
+
+  if (!profile) return;
+
+  const auto elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start);
+
+  std::unique_lock<std::mutex> l(profile->mutex);
+  auto& stats = profile->nodes[query];
+  stats.wall_time += elapsed.count();
+  stats.output_count = offsets.size();
+  stats.reused = (shared != nullptr);
+
+  // Children are evaluated before their parents, so their output counts are
+  // already known.  Children skipped due to short-circuiting count as zero.
+  stats.input_count = 0;
+  for (auto child : {query->lhs, query->rhs}) {
+    if (!child) continue;
+    auto i = profile->nodes.find(child);
+    if (i != profile->nodes.end()) stats.input_count += i->second.output_count;
+  }
+}
+
 void ProcessQuery(std::vector<ca_offset_score>& offsets, const Query* query,
-                  Schema* schema, bool make_headers, bool use_max) {
+                  Schema* schema, bool make_headers, bool use_max,
+                  QueryExecution& execution) {
+  auto& leaf_offset_cache = execution.leaf_offsets;
 
-  std::unordered_map<std::string, std::vector<ca_offset_score>> leaf_offset_cache;
+  execution.subexpressions.Add(query);
 
   {
-    internal::ThreadPool pool;
+    internal::TaskGroup tasks(internal::ThreadPool::Default());
     std::mutex map_mutex;
 
-    FillLeafOffsetCache(pool, map_mutex, leaf_offset_cache, query, schema);
-    pool.Wait();
+    FillLeafOffsetCache(tasks, map_mutex, leaf_offset_cache, query, schema,
+                        execution);
+    tasks.Wait();
   }
 
-  ProcessSubQuery(leaf_offset_cache, offsets, query, schema, make_headers);
+  execution.memory.CheckLimit();
+  execution.cancellation.Check();
+
+  ProcessSubQuery(leaf_offset_cache, offsets, query, schema, make_headers,
+                  execution);
   RemoveDuplicates(offsets, use_max);
 }
 
+namespace {
+
+// Returns true if `query' is a single key whose stored list can be counted
+// without decoding it.  Keys with special lookup semantics, and event lists,
+// which may contain an offset more than once, need to be decoded instead.
+bool IsCountableLeaf(const Query* query, Schema* schema) {
+  if (query->type != kQueryLeaf) return false;
+
+  // More than one table may contain the same offset.
+  if (schema->IndexTables().size() != 1) return false;
+
+  const auto token = query->identifier;
+  const char* delimiter = strchr(token, ':');
+  if (delimiter > token + 3 && !memcmp(delimiter - 3, "-in", 3)) return false;
+  if (!strncmp(token, "in-", 3)) return false;
+
+  return !Keywords::GetInstance().IsTimestamped(token);
+}
+
+// Counts the distinct offsets in the result of applying the set operation
+// `operator_type' to `lhs' and `rhs', without storing the result.
+size_t CountSetOperation(OperatorType operator_type,
+                         const std::vector<ca_offset_score>& lhs,
+                         const std::vector<ca_offset_score>& rhs) {
+  size_t result = 0;
+
+  auto l = lhs.begin();
+  auto r = rhs.begin();
+
+  // Advances `i' past every element with the same offset as `*i'.
+  auto skip = [](auto& i, const auto end) {
+    const auto offset = i->offset;
+    do {
+      ++i;
+    } while (i != end && i->offset == offset);
+  };
+
+  while (l != lhs.end() && r != rhs.end()) {
+    if (l->offset == r->offset) {
+      if (operator_type != kOperatorSubtract) ++result;
+      skip(l, lhs.end());
+      skip(r, rhs.end());
+    } else if (l->offset < r->offset) {
+      if (operator_type != kOperatorAnd) ++result;
+      skip(l, lhs.end());
+    } else {
+      if (operator_type == kOperatorOr) ++result;
+      skip(r, rhs.end());
+    }
+  }
+
+  if (operator_type == kOperatorAnd) return result;
+
+  while (l != lhs.end()) {
+    ++result;
+    skip(l, lhs.end());
+  }
+
+  if (operator_type == kOperatorSubtract) return result;
+
+  while (r != rhs.end()) {
+    ++result;
+    skip(r, rhs.end());
+  }
+
+  return result;
+}
+
+}  // namespace
+
+size_t CountQuery(const Query* query, Schema* schema,
+                  QueryExecution& execution) {
+  if (IsCountableLeaf(query, schema)) {
+    auto& index_table = schema->IndexTables().front();
+    const auto key = DecodeURIComponent(query->identifier);
+
+    auto cursor = index_table->NewCursor();
+    if (!cursor->SeekToKey(key)) return 0;
+
+    string_view row_key, data;
+    KJ_REQUIRE(cursor->ReadRow(row_key, data));
+
+    const auto begin = reinterpret_cast<const uint8_t*>(data.data());
+    return ca_offset_score_count(begin, begin + data.size());
+  }
+
+  if (query->type != kQueryBinaryOperator ||
+      (query->operator_type != kOperatorAnd &&
+       query->operator_type != kOperatorOr &&
+       query->operator_type != kOperatorSubtract)) {
+    std::vector<ca_offset_score> offsets;
+    ProcessQuery(offsets, query, schema, false, true, execution);
+    return offsets.size();
+  }
+
+  auto& leaf_offset_cache = execution.leaf_offsets;
+  auto& memory = execution.memory;
+
+  execution.subexpressions.Add(query);
+
+  {
+    internal::TaskGroup tasks(internal::ThreadPool::Default());
+    std::mutex map_mutex;
+
+    FillLeafOffsetCache(tasks, map_mutex, leaf_offset_cache, query, schema,
+                        execution);
+    tasks.Wait();
+  }
+
+  memory.CheckLimit();
+  execution.cancellation.Check();
+
+  auto lhs = memory.Acquire();
+  ProcessSubQuery(leaf_offset_cache, lhs, query->lhs, schema, false, execution);
+
+  size_t result = 0;
+
+  if (!lhs.empty() || query->operator_type == kOperatorOr) {
+    auto rhs = memory.Acquire();
+    ProcessSubQuery(leaf_offset_cache, rhs, query->rhs, schema, false,
+                    execution);
+
+    result = CountSetOperation(query->operator_type, lhs, rhs);
+
+    memory.Release(std::move(rhs));
+  }
+
+  memory.Release(std::move(lhs));
+
+  return result;
+}
+
+void ProcessQuery(std::vector<ca_offset_score>& offsets, const Query* query,
+                  Schema* schema, bool make_headers, bool use_max) {
+  QueryExecution execution;
+  ProcessQuery(offsets, query, schema, make_headers, use_max, execution);
+}
+
+/*****************************************************************************/
+
+CommonSubexpressions::CommonSubexpressions()
+    : subtrees_(0, SubtreeHash{this}, SubtreeEqual{this}) {}
+
+void CommonSubexpressions::Add(const Query* query) {
+  if (std::find(roots_.begin(), roots_.end(), query) != roots_.end()) return;
+  roots_.emplace_back(query);
+
+  AddSubtree(query);
+}
+
+void CommonSubexpressions::AddSubtree(const Query* query) {
+  // Leaves are shared through the leaf offset cache instead.
+  if (query->type != kQueryBinaryOperator &&
+      query->type != kQueryUnaryOperator)
+    return;
+
+  ++subtrees_[query].count;
+
+  if (query->lhs) AddSubtree(query->lhs);
+  if (query->rhs) AddSubtree(query->rhs);
+}
+
+const std::vector<ca_offset_score>* CommonSubexpressions::Find(
+    const Query* query) {
+  if (query->type != kQueryBinaryOperator &&
+      query->type != kQueryUnaryOperator)
+    return nullptr;
+
+  auto i = subtrees_.find(query);
+  if (i == subtrees_.end() || !i->second.evaluated) return nullptr;
+
+  return &i->second.offsets;
+}
+
+void CommonSubexpressions::Store(const Query* query,
+                                 const std::vector<ca_offset_score>& offsets,
+                                 QueryMemory& memory) {
+  if (query->type != kQueryBinaryOperator &&
+      query->type != kQueryUnaryOperator)
+    return;
+
+  auto i = subtrees_.find(query);
+  if (i == subtrees_.end() || i->second.count < 2 || i->second.evaluated)
+    return;
+
+  memory.Reserve(i->second.offsets, offsets.size());
+  i->second.offsets.assign(offsets.begin(), offsets.end());
+  i->second.evaluated = true;
+}
+
+size_t CommonSubexpressions::HashOf(const Query* query) {
+  if (!query) return 0;
+
+  auto i = hashes_.find(query);
+  if (i != hashes_.end()) return i->second;
+
+  uint64_t value_bits, value2_bits;
+  static_assert(sizeof(value_bits) == sizeof(query->value), "");
+  memcpy(&value_bits, &query->value, sizeof(value_bits));
+  memcpy(&value2_bits, &query->value2, sizeof(value2_bits));
+
+  uint64_t result = query->type;
+  result = result * 31 + query->operator_type;
+  if (query->identifier) result = result * 31 + Hash(query->identifier);
+  result = result * 31 + value_bits;
+  result = result * 31 + value2_bits;
+  result = result * 31 + HashOf(query->lhs);
+  result = result * 31 + HashOf(query->rhs);
+
+  hashes_.emplace(query, result);
+
+  return result;
+}
+
+bool CommonSubexpressions::Equivalent(const Query* lhs, const Query* rhs) {
+  if (lhs == rhs) return true;
+  if (!lhs || !rhs) return false;
+
+  if (lhs->type != rhs->type) return false;
+
+  // Operator types and values are only meaningful for operator nodes.
+  if (lhs->type == kQueryBinaryOperator || lhs->type == kQueryUnaryOperator) {
+    if (lhs->operator_type != rhs->operator_type) return false;
+    if (memcmp(&lhs->value, &rhs->value, sizeof(lhs->value)) ||
+        memcmp(&lhs->value2, &rhs->value2, sizeof(lhs->value2)))
+      return false;
+  }
+
+  if (!lhs->identifier != !rhs->identifier) return false;
+  if (lhs->identifier && strcmp(lhs->identifier, rhs->identifier)) return false;
+
+  if (HashOf(lhs) != HashOf(rhs)) return false;
+
+  return Equivalent(lhs->lhs, rhs->lhs) && Equivalent(lhs->rhs, rhs->rhs);
+}
+
+/*****************************************************************************/
+
+std::vector<ca_offset_score> QueryMemory::Acquire() {
+  std::unique_lock<std::mutex> lk(mutex_);
+
+  if (free_buffers_.empty()) return std::vector<ca_offset_score>();
+
+  auto result = std::move(free_buffers_.back());
+  free_buffers_.pop_back();
+
+  return result;
+}
+
+void QueryMemory::Release(std::vector<ca_offset_score>&& buffer) {
+  buffer.clear();
+
+  std::unique_lock<std::mutex> lk(mutex_);
+
+  if (free_buffers_.size() < kMaxFreeBuffers) {
+    free_buffers_.emplace_back(std::move(buffer));
+    return;
+  }
+
+  // Return the smallest buffer to the system.
+  auto smallest = std::min_element(
+      free_buffers_.begin(), free_buffers_.end(),
+      [](const auto& lhs, const auto& rhs) {
+        return lhs.capacity() < rhs.capacity();
+      });
+  if (smallest->capacity() < buffer.capacity()) std::swap(*smallest, buffer);
+
+  const auto charged = TakeCharge(buffer);
+
+  lk.unlock();
+
+  Uncharge(charged);
+  std::vector<ca_offset_score>().swap(buffer);
+}
+
+void QueryMemory::Reserve(std::vector<ca_offset_score>& buffer, size_t size) {
+  if (size <= buffer.capacity()) return;
+
+  // The old storage is freed, so its charge is carried over to the new one.
+  size_t charged;
+  {
+    std::unique_lock<std::mutex> lk(mutex_);
+    charged = TakeCharge(buffer);
+  }
+
+  const auto bytes = size * sizeof(ca_offset_score);
+  if (bytes > charged && !TryCharge(bytes - charged)) {
+    Uncharge(charged);
+    CheckLimit();
+  }
+
+  buffer.reserve(size);
+
+  std::unique_lock<std::mutex> lk(mutex_);
+  charged_[buffer.data()] = std::max(bytes, charged);
+}
+
+size_t QueryMemory::TakeCharge(const std::vector<ca_offset_score>& buffer) {
+  auto i = charged_.find(buffer.data());
+  if (i == charged_.end()) return 0;
+
+  const auto result = i->second;
+  charged_.erase(i);
+  return result;
+}
+
+bool QueryMemory::TryCharge(size_t bytes) {
+  auto in_use = in_use_.load();
+
+  do {
+    if (limit_ && in_use + bytes > limit_) {
+      limit_exceeded_ = true;
+      return false;
+    }
+  } while (!in_use_.compare_exchange_weak(in_use, in_use + bytes));
+
+  auto peak = peak_.load();
+  while (in_use + bytes > peak &&
+         !peak_.compare_exchange_weak(peak, in_use + bytes))
+    ;
+
+  return true;
+}
+
+void QueryMemory::Charge(size_t bytes) {
+  if (!TryCharge(bytes)) CheckLimit();
+}
+
+void QueryMemory::Uncharge(size_t bytes) {
+  KJ_ASSERT(bytes <= in_use_, bytes, in_use_.load());
+  in_use_ -= bytes;
+}
+
+void QueryMemory::CheckLimit() const {
+  KJ_REQUIRE(!limit_exceeded_, "query memory limit exceeded", limit_,
+             peak_.load());
+}
+
+/*****************************************************************************/
+
+QueryCancellation::QueryCancellation(uint64_t timeout)
+    : timeout_(timeout),
+      deadline_(std::chrono::steady_clock::now() +
+                std::chrono::milliseconds(timeout)) {}
+
+void QueryCancellation::Check() const {
+  if (!IsCancelled()) return;
+  KJ_REQUIRE(!timed_out_, "statement timed out", timeout_);
+  KJ_FAIL_REQUIRE("statement cancelled");
+}
+
+/*****************************************************************************/
+
+std::string QueryNodeLabel(const Query* query) {
+  switch (query->type) {
+    case kQueryKey:
+      return std::string("KEY=") + query->identifier;
+
+    case kQueryLeaf:
+      return query->identifier;
+
+    case kQueryUnaryOperator:
+      switch (query->operator_type) {
+        case kOperatorMax: return "MAX";
+        case kOperatorMin: return "MIN";
+        case kOperatorNegate: return "~";
+        case kOperatorModId:
+          return "MODID " + DoubleToString(query->value);
+        default: break;
+      }
+      break;
+
+    case kQueryBinaryOperator:
+      switch (query->operator_type) {
+        case kOperatorOr: return "OR";
+        case kOperatorAnd: return "AND";
+        case kOperatorSubtract: return "AND NOT";
+        case kOperatorEQ: return "=" + DoubleToString(query->value);
+        case kOperatorGT:
+          return query->rhs ? ">" : ">" + DoubleToString(query->value);
+        case kOperatorGE: return ">=" + DoubleToString(query->value);
+        case kOperatorLT:
+          return query->rhs ? "<" : "<" + DoubleToString(query->value);
+        case kOperatorLE: return "<=" + DoubleToString(query->value);
+        case kOperatorInRange:
+          return "[" + DoubleToString(query->value) + "," +
+                 DoubleToString(query->value2) + "]";
+        case kOperatorOrderBy: return "ORDER BY";
+        case kOperatorRandomSample:
+          return "RANDOM_SAMPLE " + DoubleToString(query->value);
+        default: break;
+      }
+      break;
+  }
+
+  KJ_FAIL_ASSERT("invalid query node", query->type, query->operator_type);
+}
+
 void PrintQuery(const Query* query) {
   switch (query->type) {
     case kQueryKey:
-      printf("KEY=%s", query->identifier);
+      fprintf(CA_output, "KEY=%s", query->identifier);
       break;
 
     case kQueryLeaf:
-      printf("%s", query->identifier);
+      fprintf(CA_output, "%s", query->identifier);
       break;
 
     case kQueryUnaryOperator:
       switch (query->operator_type) {
         case kOperatorMax:
-          printf("MAX(");
+          fprintf(CA_output, "MAX(");
           PrintQuery(query->lhs);
+          fprintf(CA_output, ")");
           break;
 
         case kOperatorMin:
-          printf("MIN(");
+          fprintf(CA_output, "MIN(");
+          PrintQuery(query->lhs);
+          fprintf(CA_output, ")");
+          break;
+
+        case kOperatorModId:
+          fprintf(CA_output, "MODID(");
           PrintQuery(query->lhs);
+          fprintf(CA_output, ", %.9g)", query->value);
           break;
 
         case kOperatorNegate:
-          printf("~(");
+          fprintf(CA_output, "~(");
           PrintQuery(query->lhs);
-          printf(")");
+          fprintf(CA_output, ")");
           break;
 
         default:
@@ -755,63 +1458,63 @@ void PrintQuery(const Query* query) {
 
     case kQueryBinaryOperator:
       if (query->operator_type == kOperatorRandomSample) {
-        printf("RANDOM_SAMPLE(");
+        fprintf(CA_output, "RANDOM_SAMPLE(");
         PrintQuery(query->lhs);
-        printf(", %.9g)", query->value);
+        fprintf(CA_output, ", %.9g)", query->value);
         break;
       }
 
-      printf("(");
+      fprintf(CA_output, "(");
       PrintQuery(query->lhs);
       bool scalar_rhs = false;
       bool range_rhs = false;
       switch (query->operator_type) {
         case kOperatorOr:
-          printf(" + ");
+          fprintf(CA_output, " + ");
           break;
         case kOperatorAnd:
-          printf(" AND ");
+          fprintf(CA_output, " AND ");
           break;
         case kOperatorSubtract:
-          printf(" - ");
+          fprintf(CA_output, " - ");
           break;
         case kOperatorEQ:
-          printf("=");
+          fprintf(CA_output, "=");
           if (!query->rhs) scalar_rhs = true;
           break;
         case kOperatorGT:
-          printf(">");
+          fprintf(CA_output, ">");
           if (!query->rhs) scalar_rhs = true;
           break;
         case kOperatorGE:
-          printf(">=");
+          fprintf(CA_output, ">=");
           if (!query->rhs) scalar_rhs = true;
           break;
         case kOperatorLT:
-          printf("<");
+          fprintf(CA_output, "<");
           if (!query->rhs) scalar_rhs = true;
           break;
         case kOperatorLE:
-          printf("<=");
+          fprintf(CA_output, "<=");
           if (!query->rhs) scalar_rhs = true;
           break;
         case kOperatorInRange:
           range_rhs = true;
           break;
         case kOperatorOrderBy:
-          printf(" ORDER BY ");
+          fprintf(CA_output, " ORDER BY ");
           break;
 
         default:
           KJ_FAIL_ASSERT("invalid operator", query->operator_type);
       }
       if (range_rhs)
-        printf("[%.9g,%.9g]", query->value, query->value2);
+        fprintf(CA_output, "[%.9g,%.9g]", query->value, query->value2);
       else if (scalar_rhs)
-        printf("%.9g", query->value);
+        fprintf(CA_output, "%.9g", query->value);
       else
         PrintQuery(query->rhs);
-      printf(")");
+      fprintf(CA_output, ")");
       break;
   }
 }
@@ -831,8 +1534,21 @@ void ca_schema_query(Schema* schema,
 
     KJ_REQUIRE(!summary_tables.empty());
 
-    ProcessQuery(offsets, stmt.query, schema,
-                           stmt.thresholds != nullptr);
+    QueryExecution execution;
+
+    if (stmt.count_only) {
+      const auto count = CountQuery(stmt.query, schema, execution);
+
+      if (CA_output_format == CA_PARAM_VALUE_JSON)
+        fprintf(CA_output, "{\"result-count\":%zu}\n", count);
+      else
+        fprintf(CA_output, "%zu\n", count);
+
+      return;
+    }
+
+    ProcessQuery(offsets, stmt.query, schema, stmt.thresholds != nullptr, true,
+                 execution);
 
     std::vector<double> thresholds;
     bool reverse_thresholds = false;
@@ -890,9 +1606,9 @@ void ca_schema_query(Schema* schema,
 
     if (stmt.offset >= offsets.size()) {
       if (CA_output_format == CA_PARAM_VALUE_JSON)
-        printf("[]\n");
+        fprintf(CA_output, "[]\n");
       else
-        printf("0\n");
+        fprintf(CA_output, "0\n");
 
       return;
     }
@@ -906,6 +1622,13 @@ void ca_schema_query(Schema* schema,
         offsets.begin(), offsets.begin() + stmt.offset + limit, offsets.end(),
         [](const auto& lhs, const auto& rhs) { return lhs.score > rhs.score; });
 
+    // Fail before any results are printed.
+    execution.cancellation.Check();
+
+    // The tables are shared with concurrent statements, so read them through
+    // cursors of our own.
+    auto summary_cursors = schema->NewSummaryCursors();
+
     if (stmt.keys_only) {
       for (auto i = stmt.offset; i < stmt.offset + limit; ++i) {
         const auto& v = offsets[i];
@@ -916,15 +1639,16 @@ void ca_schema_query(Schema* schema,
                std::get<uint64_t>(summary_tables[summary_table_idx]) > v.offset)
           ;
 
-        summary_tables[summary_table_idx].second->Seek(
+        auto& cursor = summary_cursors[summary_table_idx];
+        cursor->Seek(
             v.offset - std::get<uint64_t>(summary_tables[summary_table_idx]),
             SEEK_SET);
 
         string_view row_key, data;
-        KJ_REQUIRE(summary_tables[summary_table_idx].second->ReadRow(
-            row_key, data));
+        KJ_REQUIRE(cursor->ReadRow(row_key, data));
 
-        printf("%.*s\n", static_cast<int>(row_key.size()), row_key.data());
+        fprintf(CA_output, "%.*s\n", static_cast<int>(row_key.size()),
+                row_key.data());
       }
     } else {
       // First, order the results by their physical location in the `summaries`
@@ -937,6 +1661,11 @@ void ca_schema_query(Schema* schema,
         return lhs.first.offset < rhs.first.offset;
       });
 
+      std::vector<std::unique_ptr<Table>> summary_override_cursors;
+      for (auto& summary_override_table : summary_override_tables)
+        summary_override_cursors.emplace_back(
+            summary_override_table->NewCursor());
+
       std::vector<std::string> results;
       results.resize(sorted_offsets.size());
 
@@ -949,12 +1678,13 @@ void ca_schema_query(Schema* schema,
                std::get<uint64_t>(summary_tables[summary_table_idx]) > v.offset)
           ;
 
-        summary_tables[summary_table_idx].second->Seek(
+        auto& cursor = summary_cursors[summary_table_idx];
+        cursor->Seek(
             v.offset - std::get<uint64_t>(summary_tables[summary_table_idx]),
             SEEK_SET);
 
         string_view row_key, data;
-        KJ_REQUIRE(summary_tables[summary_table_idx].second->ReadRow(row_key, data));
+        KJ_REQUIRE(cursor->ReadRow(row_key, data));
         KJ_REQUIRE(row_key.size() < 100'000'000, row_key.size());
         KJ_REQUIRE(data.size() < 100'000'000, data.size());
 
@@ -973,11 +1703,11 @@ void ca_schema_query(Schema* schema,
           result.append(json.data(), json.size());
         }
 
-        for (auto& summary_override_table : summary_override_tables) {
-          if (!summary_override_table->SeekToKey(row_key)) break;
+        for (auto& summary_override_cursor : summary_override_cursors) {
+          if (!summary_override_cursor->SeekToKey(row_key)) break;
 
           string_view tmp_key, json_extra;
-          KJ_REQUIRE(summary_override_table->ReadRow(tmp_key, json_extra));
+          KJ_REQUIRE(summary_override_cursor->ReadRow(tmp_key, json_extra));
 
           result.push_back(',');
           // TODO(mortehu): Remove this logic when we're no longer producing
@@ -988,12 +1718,15 @@ void ca_schema_query(Schema* schema,
             result.append(json_extra.data(), json_extra.size());
         }
 
-        auto ed = extra_data.find(v.offset);
-        if (ed != extra_data.end()) {
-          result.push_back(',');
-          auto extra_json = Json::FastWriter().write(ed->second);
-          if (std::isspace(extra_json.back())) extra_json.pop_back();
-          result.append(extra_json.data() + 1, extra_json.size() - 2);
+        {
+          std::unique_lock<std::mutex> extra_data_lock(extra_data_mutex);
+          auto ed = extra_data.find(v.offset);
+          if (ed != extra_data.end()) {
+            result.push_back(',');
+            auto extra_json = Json::FastWriter().write(ed->second);
+            if (std::isspace(extra_json.back())) extra_json.pop_back();
+            result.append(extra_json.data() + 1, extra_json.size() - 2);
+          }
         }
 
         if (stmt.thresholds) {
@@ -1029,30 +1762,31 @@ void ca_schema_query(Schema* schema,
 
       if (CA_output_format == CA_PARAM_VALUE_JSON)
       {
-        printf("{\"result-count\":%zu,\"result\":[{", offsets.size());
+        fprintf(CA_output, "{\"result-count\":%zu,\"result\":[{",
+                offsets.size());
 
         for (size_t i = 0; i < results.size(); ++i) {
-          if (i > 0) fwrite_unlocked("},\n{", 1, 4, stdout);
+          if (i > 0) fwrite_unlocked("},\n{", 1, 4, CA_output);
 
-          fwrite_unlocked(results[i].data(), 1, results[i].size(), stdout);
+          fwrite_unlocked(results[i].data(), 1, results[i].size(), CA_output);
         }
 
-        printf("}]}\n");
+        fprintf(CA_output, "}]}\n");
       }
       else
       {
-        printf("%zu\n", offsets.size());
+        fprintf(CA_output, "%zu\n", offsets.size());
         for (size_t i = 0; i < results.size(); ++i) {
-          fwrite_unlocked("{", 1, 1, stdout);
-          fwrite_unlocked(results[i].data(), 1, results[i].size(), stdout);
-          fwrite_unlocked("}\n", 1, 2, stdout);
+          fwrite_unlocked("{", 1, 1, CA_output);
+          fwrite_unlocked(results[i].data(), 1, results[i].size(), CA_output);
+          fwrite_unlocked("}\n", 1, 2, CA_output);
         }
       }
     }
   } catch (kj::Exception e) {
     Json::Value error;
     error["error"] = e.getDescription().cStr();
-    std::cout << Json::FastWriter().write(error);
+    fputs(Json::FastWriter().write(error).c_str(), CA_output);
   }
 }
 
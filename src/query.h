@@ -1,32 +1,73 @@
 #ifndef CA_STORAGE_CA_TABLE_QUERY_H_
 #define CA_STORAGE_CA_TABLE_QUERY_H_ 1
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
 #include <memory>
 #include <limits>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <sys/uio.h>
 
 #include <kj/arena.h>
+#include <kj/debug.h>
 
+#include "src/ca-table.h"
 #include "src/schema.h"
 
 namespace cantera {
 namespace table {
 
+class BatchExecutor;
+struct Statement;
+
+// A statement stored by PREPARE, for later use by EXECUTE.
+struct PreparedStatement {
+  const Statement* statement = nullptr;
+
+  // Owns `statement'.
+  std::shared_ptr<kj::Arena> arena;
+
+  // The number of parameters ($1, $2, ...) that must be supplied.
+  int parameter_count = 0;
+};
+
 struct QueryParseContext {
   void* scanner = nullptr;
 
-  kj::Arena arena;
+  // If set, statements are handed to this executor as they are parsed,
+  // instead of being executed one at a time.
+  BatchExecutor* batch = nullptr;
 
-  std::unique_ptr<Schema> schema;
+  // Holds the statement being parsed.  Replaced once the statement has been
+  // dispatched, so that a session doesn't keep every statement it has run;
+  // statements that are still needed share ownership of their arena.
+  std::shared_ptr<kj::Arena> arena = std::make_shared<kj::Arena>();
+
+  // Shared by all sessions of a server.  Each statement runs on the schema
+  // generation that is current when it starts.
+  std::shared_ptr<SchemaGenerations> schemas;
+
+  std::unordered_map<std::string, PreparedStatement> prepared_statements;
 };
 
 enum StatementType {
   kStatementCorrelate,
+  kStatementDeallocate,
+  kStatementExecute,
+  kStatementExplain,
+  kStatementFacet,
+  kStatementPrepare,
   kStatementQuery,
   kStatementParse,
+  kStatementReload,
   kStatementSelect,
-  kStatementSet
+  kStatementSet,
+  kStatementWarmUp
 };
 
 enum QueryType {
@@ -61,6 +102,11 @@ struct Query {
   enum QueryType type;
   const char* identifier=nullptr;
 
+  // For kQueryKey and kQueryLeaf nodes in prepared statements: if non-zero,
+  // `identifier' is replaced by the value of this parameter ($1, $2, ...)
+  // when the statement is executed.
+  int parameter=0;
+
   enum OperatorType operator_type;
   const struct Query* lhs=nullptr;
   const struct Query* rhs=nullptr;
@@ -90,6 +136,9 @@ struct query_statement {
   // Set to non-zero to retrieve document keys instead of JSON summaries.
   int keys_only;
 
+  // Set to non-zero to retrieve only the number of matching documents.
+  int count_only;
+
   const struct Query* query;
 
   struct ThresholdClause* thresholds;
@@ -103,7 +152,12 @@ struct query_correlate_statement {
   const struct Query* query_B;
 };
 
-enum RuntimeParameter { CA_PARAM_OUTPUT_FORMAT, CA_PARAM_TIME_FORMAT };
+enum RuntimeParameter {
+  CA_PARAM_OUTPUT_FORMAT,
+  CA_PARAM_TIME_FORMAT,
+  CA_PARAM_MEMORY_LIMIT,
+  CA_PARAM_TIMEOUT
+};
 
 enum RuntimeParameterValue {
   /* OUTPUT FORMAT */
@@ -115,6 +169,18 @@ struct parse_statement {
   const struct Query* query;
 };
 
+// Counts the results of `query' in each of the ranges delimited by
+// `thresholds', according to the value of the keyword `key'.
+struct facet_statement {
+  const struct Query* query;
+  const char* key;
+  LinkedList<double>* thresholds;
+
+  // Set to non-zero to also report the sum, minimum and maximum of the query
+  // scores in each range.
+  int with_scores;
+};
+
 struct select_statement {
   QueryList* fields;
   const struct Query* query;
@@ -126,18 +192,47 @@ struct set_statement {
   union {
     RuntimeParameterValue enum_value;
     const char* string_value;
+    int64_t integer_value;
   } v;
 };
 
+struct prepare_statement {
+  const char* name;
+  const struct Statement* statement;
+};
+
+struct execute_statement {
+  const char* name;
+  LinkedList<const char*>* parameters;
+};
+
+struct deallocate_statement {
+  const char* name;
+};
+
+// Brings the tables of the current schema generation into memory, and reports
+// the progress after each table.
+struct warmup_statement {
+  // Hot keys and key prefixes to read, or nullptr for the keys given at
+  // startup.
+  LinkedList<const char*>* keys;
+};
+
 struct Statement {
   enum StatementType type;
 
   union {
     struct query_correlate_statement query_correlate;
+    // Used by both kStatementQuery and kStatementExplain.
     struct query_statement query;
+    struct facet_statement facet;
     struct parse_statement parse;
     struct select_statement select;
     struct set_statement set;
+    struct prepare_statement prepare;
+    struct execute_statement execute;
+    struct deallocate_statement deallocate;
+    struct warmup_statement warmup;
   } u;
 
   Statement* next;
@@ -145,8 +240,258 @@ struct Statement {
 
 /*****************************************************************************/
 
-extern char CA_time_format[64];
-extern enum RuntimeParameterValue CA_output_format;
+// Session state.  Each server connection is served by its own thread, so
+// these are thread local.
+
+// The stream receiving statement results.  Defaults to standard output.
+extern thread_local FILE* CA_output;
+
+extern thread_local char CA_time_format[64];
+extern thread_local enum RuntimeParameterValue CA_output_format;
+
+// The maximum number of bytes a statement may use for intermediate query
+// results, or zero for no limit.
+extern thread_local size_t CA_memory_limit;
+
+// The maximum number of milliseconds a statement may run, or zero for no
+// limit.
+extern thread_local uint64_t CA_timeout;
+
+/*****************************************************************************/
+
+// Execution statistics for a single query tree node, as reported by EXPLAIN
+// ANALYZE.  Times are in seconds, and include the time spent in child nodes.
+struct QueryNodeProfile {
+  double wall_time = 0.0;
+
+  // Number of offsets produced by the child nodes, and by this node.
+  size_t input_count = 0;
+  size_t output_count = 0;
+
+  // Index I/O performed on behalf of leaf nodes.
+  uint64_t bytes_read = 0;
+  uint64_t bytes_decompressed = 0;
+  uint64_t block_cache_hits = 0;
+  uint64_t block_cache_misses = 0;
+  double decode_time = 0.0;
+
+  // Set for leaves whose key was already looked up for an earlier leaf of the
+  // same statement.  The index I/O of the lookup is credited to that leaf.
+  bool shared_lookup = false;
+
+  // Set if the result was copied from an identical subtree evaluated earlier
+  // in the same statement.
+  bool reused = false;
+};
+
+struct QueryProfile {
+  std::mutex mutex;
+
+  std::unordered_map<const Query*, QueryNodeProfile> nodes;
+};
+
+// Accounts for, and recycles, the buffers holding intermediate results while
+// a statement is executed.  If a limit is set, growing the total beyond it
+// aborts the statement.
+class QueryMemory {
+ public:
+  // Constructs an accountant with the given limit in bytes, or with no limit
+  // if `limit' is zero.
+  explicit QueryMemory(size_t limit) : limit_(limit) {}
+
+  KJ_DISALLOW_COPY(QueryMemory);
+
+  // Returns an empty buffer, reusing the storage of a released one if any.
+  std::vector<ca_offset_score> Acquire();
+
+  // Takes back a buffer that is no longer needed.  The memory charged for its
+  // storage remains accounted for until it is freed.
+  void Release(std::vector<ca_offset_score>&& buffer);
+
+  // Grows the capacity of `buffer' to at least `size' elements, and charges
+  // for its storage.  Buffers must only grow through this function for their
+  // memory to be accounted for.
+  void Reserve(std::vector<ca_offset_score>& buffer, size_t size);
+
+  // Accounts for `bytes' allocated elsewhere.  If this would exceed the limit,
+  // nothing is charged and false is returned.  Safe to call from any thread.
+  bool TryCharge(size_t bytes);
+
+  // Like TryCharge(), but throws if the limit is exceeded.
+  void Charge(size_t bytes);
+
+  void Uncharge(size_t bytes);
+
+  // Throws if any previous attempt to charge memory failed.
+  void CheckLimit() const;
+
+  size_t Limit() const { return limit_; }
+  size_t Peak() const { return peak_; }
+
+ private:
+  // The maximum number of released buffers kept for reuse.
+  static constexpr size_t kMaxFreeBuffers = 8;
+
+  const size_t limit_;
+
+  std::atomic<size_t> in_use_{0};
+  std::atomic<size_t> peak_{0};
+  std::atomic<bool> limit_exceeded_{false};
+
+  // Removes the record of the memory charged for the storage of `buffer', and
+  // returns its size.  Called with `mutex_' held.
+  size_t TakeCharge(const std::vector<ca_offset_score>& buffer);
+
+  std::mutex mutex_;
+  std::vector<std::vector<ca_offset_score>> free_buffers_;
+
+  // The memory charged for the storage of each buffer grown by Reserve(), so
+  // that exactly that much is uncharged when the storage is freed.
+  std::unordered_map<const ca_offset_score*, size_t> charged_;
+};
+
+// Tells a running statement to stop.  The token is set either explicitly, or
+// implicitly once the statement's deadline has passed.  Long-running loops
+// poll it, worker tasks skip their work once it is set, and the statement's
+// own thread then throws from Check(), releasing its intermediate results.
+class QueryCancellation {
+ public:
+  // Constructs a token whose deadline is `timeout' milliseconds from now, or
+  // with no deadline if `timeout' is zero.
+  explicit QueryCancellation(uint64_t timeout);
+
+  KJ_DISALLOW_COPY(QueryCancellation);
+
+  // Loops over offset lists poll the token once per this many elements.
+  static constexpr size_t kPollInterval = 1 << 16;
+
+  // Safe to call from any thread.
+  void Cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+
+  // Returns true if the statement should stop.  Safe to call from any thread.
+  bool IsCancelled() const {
+    if (cancelled_.load(std::memory_order_relaxed)) return true;
+    if (!timeout_ || std::chrono::steady_clock::now() < deadline_)
+      return false;
+    timed_out_.store(true, std::memory_order_relaxed);
+    cancelled_.store(true, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Throws if the statement should stop.
+  void Check() const;
+
+ private:
+  const uint64_t timeout_;
+  const std::chrono::steady_clock::time_point deadline_;
+
+  mutable std::atomic<bool> cancelled_{false};
+  mutable std::atomic<bool> timed_out_{false};
+};
+
+// Finds structurally identical subtrees among the query trees of a statement,
+// and holds on to their results, so that each distinct subtree is evaluated
+// only once.
+class CommonSubexpressions {
+ public:
+  CommonSubexpressions();
+
+  KJ_DISALLOW_COPY(CommonSubexpressions);
+
+  // Registers every subtree of `query'.  All the query trees of a statement
+  // must be added before the first one is evaluated.  Adding the same tree
+  // more than once has no effect.
+  void Add(const Query* query);
+
+  // Returns the result of a subtree identical to `query' stored earlier, or
+  // null if there is none.
+  const std::vector<ca_offset_score>* Find(const Query* query);
+
+  // Stores the result of evaluating `query', if it has been registered more
+  // than once.
+  void Store(const Query* query, const std::vector<ca_offset_score>& offsets,
+             QueryMemory& memory);
+
+ private:
+  struct SubtreeHash {
+    size_t operator()(const Query* query) const { return owner->HashOf(query); }
+    CommonSubexpressions* owner;
+  };
+
+  struct SubtreeEqual {
+    bool operator()(const Query* lhs, const Query* rhs) const {
+      return owner->Equivalent(lhs, rhs);
+    }
+    CommonSubexpressions* owner;
+  };
+
+  struct Subtree {
+    size_t count = 0;
+    bool evaluated = false;
+    std::vector<ca_offset_score> offsets;
+  };
+
+  size_t HashOf(const Query* query);
+
+  bool Equivalent(const Query* lhs, const Query* rhs);
+
+  void AddSubtree(const Query* query);
+
+  // Memoized subtree hashes, by node.
+  std::unordered_map<const Query*, size_t> hashes_;
+
+  std::unordered_map<const Query*, Subtree, SubtreeHash, SubtreeEqual> subtrees_;
+
+  std::vector<const Query*> roots_;
+};
+
+// State shared by all the query trees evaluated on behalf of one statement.
+struct QueryExecution {
+  QueryExecution() : memory(CA_memory_limit), cancellation(CA_timeout) {}
+
+  KJ_DISALLOW_COPY(QueryExecution);
+
+  // If not null, per-node execution statistics are recorded here.
+  QueryProfile* profile = nullptr;
+
+  QueryMemory memory;
+
+  QueryCancellation cancellation;
+
+  // Decoded index entries, by keyword.
+  std::unordered_map<std::string, std::vector<ca_offset_score>> leaf_offsets;
+
+  CommonSubexpressions subexpressions;
+};
+
+// Like the ProcessQuery() declared in ca-table.h, but evaluates the query as
+// part of `execution'.
+void ProcessQuery(std::vector<ca_offset_score>& offsets, const Query* query,
+                  Schema* schema, bool make_headers, bool use_max,
+                  QueryExecution& execution);
+
+// Like the SubtractOffsets() declared in ca-table.h, but if `cancellation' is
+// set, it is checked periodically.
+size_t SubtractOffsets(struct ca_offset_score* lhs, size_t lhs_count,
+                       const struct ca_offset_score* rhs, size_t rhs_count,
+                       const QueryCancellation* cancellation);
+
+// Like the ca_offset_score_parse() declared in ca-table.h, but if
+// `cancellation' is set, it is polled between encoded lists, and parsing stops
+// early once the statement is cancelled, leaving `output' incomplete.
+void ca_offset_score_parse(string_view input,
+                           std::vector<ca_offset_score>* output,
+                           const QueryCancellation* cancellation);
+
+// Returns the number of distinct documents matched by `query'.  Single keys
+// are counted from their stored lists without decoding them, and for set
+// operations at the root only the operands are materialized.
+size_t CountQuery(const Query* query, Schema* schema,
+                  QueryExecution& execution);
+
+// Returns a short description of the operation performed by `query' itself,
+// not including its children.
+std::string QueryNodeLabel(const Query* query);
 
 /*****************************************************************************/
 
@@ -154,6 +499,10 @@ void CA_parse_script(QueryParseContext* context, FILE* input);
 
 void CA_process_statement(QueryParseContext* context, struct Statement* stmt);
 
+// Executes a statement read by the parser, either at once, or through the
+// batch executor of `context'.
+void CA_dispatch_statement(QueryParseContext* context, struct Statement* stmt);
+
 /*****************************************************************************/
 
 void CA_output_char(int ch);
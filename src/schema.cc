@@ -130,10 +130,11 @@ std::vector<std::unique_ptr<Table>>& Schema::IndexTables() {
     index_tables_.resize( index_table_paths_.size() );
 
     internal::ThreadPool pool;
+    internal::TaskGroup tasks(pool);
 
     for (size_t i=0; i < index_table_paths_.size(); i++)
     {
-      pool.Launch(
+      tasks.Launch(
         [&, i=i]
         {
           index_tables_[i] =
@@ -141,11 +142,64 @@ std::vector<std::unique_ptr<Table>>& Schema::IndexTables() {
         }
       );
     }
-    pool.Wait();
+
+    // A table that fails to open must fail the load, such as a RELOAD, rather
+    // than terminate the process from a worker thread.
+    try {
+      tasks.Wait();
+    } catch (...) {
+      index_tables_.clear();
+      throw;
+    }
   }
 
   return index_tables_;
 }
 
+SchemaGenerations::SchemaGenerations(std::string path)
+    : path_(std::move(path)), current_(LoadGeneration()) {}
+
+uint64_t SchemaGenerations::Reload() {
+  std::unique_lock<std::mutex> lock(reload_mutex_);
+
+  auto schema = LoadGeneration();
+  if (warm_up_) WarmUp(schema.get(), warm_up_options_);
+
+  std::atomic_store(&current_, std::move(schema));
+
+  return ++generation_;
+}
+
+void SchemaGenerations::SetWarmUpOptions(WarmUpOptions options) {
+  std::unique_lock<std::mutex> lock(reload_mutex_);
+  warm_up_options_ = std::move(options);
+  warm_up_ = true;
+}
+
+WarmUpOptions SchemaGenerations::GetWarmUpOptions() {
+  std::unique_lock<std::mutex> lock(reload_mutex_);
+  return warm_up_options_;
+}
+
+std::shared_ptr<Schema> SchemaGenerations::LoadGeneration() {
+  // Loading is lazy, and not safe to do from concurrent statements.
+  auto result = std::make_shared<Schema>(path_);
+  result->Load();
+  result->IndexTables();
+
+  return result;
+}
+
+std::vector<std::unique_ptr<SeekableTable>> Schema::NewSummaryCursors() {
+  Load();
+
+  std::vector<std::unique_ptr<SeekableTable>> result;
+  result.reserve(summary_tables.size());
+  for (const auto& summary_table : summary_tables)
+    result.emplace_back(summary_table.second->NewSeekableCursor());
+
+  return result;
+}
+
 }  // namespace table
 }  // namespace cantera
@@ -1,11 +1,15 @@
 #ifndef STORAGE_CA_TABLE_SCHEMA_H_
 #define STORAGE_CA_TABLE_SCHEMA_H_ 1
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include "src/warmup.h"
+
 namespace cantera {
 namespace table {
 
@@ -27,6 +31,11 @@ class Schema {
   // Lazy-loads the index tables.
   std::vector<std::unique_ptr<Table>>& IndexTables();
 
+  // Returns a new cursor for every summary table, in the same order as
+  // `summary_tables'.  The tables themselves must not be read from concurrent
+  // sessions; their cursors may.
+  std::vector<std::unique_ptr<SeekableTable>> NewSummaryCursors();
+
  private:
   std::string path_;
 
@@ -36,6 +45,53 @@ class Schema {
   std::vector<std::unique_ptr<Table>> index_tables_;
 };
 
+// Holds the current generation of a schema, which may be replaced by a newly
+// loaded generation while statements are running.  A statement takes a
+// reference to the current generation when it starts, and finishes on that
+// generation even if a new one is published meanwhile.  The tables of a
+// generation are closed when the last statement using it finishes.
+class SchemaGenerations {
+ public:
+  // Loads the first generation from the schema file `path'.
+  SchemaGenerations(std::string path);
+
+  // Returns the current generation.  Safe to call from any thread.
+  std::shared_ptr<Schema> Current() const {
+    return std::atomic_load(&current_);
+  }
+
+  // Loads a new generation from the schema file, opening all of its tables,
+  // then publishes it.  Running statements are not disturbed.  If loading
+  // fails, the exception is passed on, and the current generation is kept.
+  // Returns the number of the new generation; the first one is number 1.
+  uint64_t Reload();
+
+  uint64_t Generation() const { return generation_; }
+
+  // Makes Reload() warm up every new generation with `options' before
+  // publishing it, so that the first statements on it do not run cold.
+  void SetWarmUpOptions(WarmUpOptions options);
+
+  // Returns the options set by SetWarmUpOptions(), or the default options if
+  // none were set.
+  WarmUpOptions GetWarmUpOptions();
+
+ private:
+  // Returns a fully loaded schema, which is safe to share between threads.
+  std::shared_ptr<Schema> LoadGeneration();
+
+  const std::string path_;
+
+  std::shared_ptr<Schema> current_;
+  std::atomic<uint64_t> generation_{1};
+
+  // Serializes reloads, and guards the warm-up options.
+  std::mutex reload_mutex_;
+
+  bool warm_up_ = false;
+  WarmUpOptions warm_up_options_;
+};
+
 }  // namespace table
 }  // namespace cantera
 
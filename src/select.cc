@@ -19,16 +19,24 @@ void Select(Schema* schema, const struct select_statement& select) {
   const auto& summary_tables = schema->summary_tables;
   KJ_REQUIRE(summary_tables.size() >= 1);
 
+  QueryExecution execution;
+
+  // Register every query tree up front, so that subtrees shared between the
+  // selection and the fields are evaluated only once.
+  execution.subexpressions.Add(select.query);
+  for (auto field = select.fields; field; field = field->next)
+    execution.subexpressions.Add(field->query);
+
   std::vector<ca_offset_score> selection;
-  ProcessQuery(selection, select.query, schema, false, false);
+  ProcessQuery(selection, select.query, schema, false, false, execution);
 
   std::vector<std::vector<float>> values;
   values.resize(selection.size());
 
   for (auto field = select.fields; field; field = field->next) {
-    std::vector<ca_offset_score> field_offsets;
+    auto field_offsets = execution.memory.Acquire();
 
-    ProcessQuery(field_offsets, field->query, schema, false, false);
+    ProcessQuery(field_offsets, field->query, schema, false, false, execution);
 
     std::sort(field_offsets.begin(), field_offsets.end(),
               [](const auto& lhs, const auto& rhs) {
@@ -58,8 +66,12 @@ void Select(Schema* schema, const struct select_statement& select) {
 
       values[i].push_back(all_zero ? 1.0f : vi->score);
     }
+
+    execution.memory.Release(std::move(field_offsets));
   }
 
+  auto summary_cursors = schema->NewSummaryCursors();
+
   for (size_t i = 0; i < selection.size(); ++i) {
     const auto offset = selection[i].offset;
 
@@ -69,41 +81,43 @@ void Select(Schema* schema, const struct select_statement& select) {
            std::get<uint64_t>(summary_tables[summary_table_idx]) > offset)
       ;
 
-    summary_tables[summary_table_idx].second->Seek(
+    auto& cursor = summary_cursors[summary_table_idx];
+    cursor->Seek(
         offset - std::get<uint64_t>(summary_tables[summary_table_idx]),
         SEEK_SET);
 
     string_view key, data;
-    KJ_REQUIRE(
-        summary_tables[summary_table_idx].second->ReadRow(key, data));
+    KJ_REQUIRE(cursor->ReadRow(key, data));
 
     if (key.find('"') != std::string::npos) {
-        printf("\"\"%.*s\"\"", static_cast<int>(key.size()), key.data());
+        fprintf(CA_output, "\"\"%.*s\"\"", static_cast<int>(key.size()),
+                key.data());
     } else if (key.find(',') != std::string::npos) {
-        printf("\"%.*s\"", static_cast<int>(key.size()), key.data());
+        fprintf(CA_output, "\"%.*s\"", static_cast<int>(key.size()),
+                key.data());
     } else {
-        printf("%.*s", static_cast<int>(key.size()), key.data());
+        fprintf(CA_output, "%.*s", static_cast<int>(key.size()), key.data());
     }
 
     for (const auto v : values[i]) {
       if (std::isnan(v)) {
-        fputs_unlocked(",nan", stdout);
+        fputs_unlocked(",nan", CA_output);
       } else {
-        printf(",%.9g", v);
+        fprintf(CA_output, ",%.9g", v);
       }
     }
 
     if (select.with_summaries) {
-      printf(",\"");
+      fprintf(CA_output, ",\"");
       for (const auto ch : data) {
         if (ch == '"')
-          putchar('"');
-        putchar(ch);
+          putc('"', CA_output);
+        putc(ch, CA_output);
       }
-      putchar('"');
+      putc('"', CA_output);
     }
 
-    putchar_unlocked('\n');
+    putc_unlocked('\n', CA_output);
   }
 }
 
@@ -0,0 +1,156 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <json/value.h>
+#include <json/writer.h>
+#include <kj/debug.h>
+#include <kj/io.h>
+
+#include "src/query.h"
+#include "src/schema.h"
+#include "src/server.h"
+
+namespace cantera {
+namespace table {
+
+namespace {
+
+void WriteError(FILE* output, const char* message) {
+  Json::Value error;
+  error["error"] = message;
+  fputs(Json::FastWriter().write(error).c_str(), output);
+}
+
+// Executes the statements read from the connection `connection_fd' until the
+// client disconnects, or a statement fails.
+void ServeConnection(int connection_fd,
+                     std::shared_ptr<SchemaGenerations> schemas) {
+  kj::AutoCloseFd fd(connection_fd);
+
+  // The output stream gets its own descriptor, so that each stream can close
+  // the descriptor it owns.
+  std::unique_ptr<FILE, decltype(&fclose)> output{
+      fdopen(dup(fd.get()), "w"), fclose};
+  if (!output) {
+    KJ_LOG(ERROR, "fdopen failed", strerror(errno));
+    return;
+  }
+
+  std::unique_ptr<FILE, decltype(&fclose)> input{fdopen(fd.get(), "r"),
+                                                 fclose};
+  if (!input) {
+    KJ_LOG(ERROR, "fdopen failed", strerror(errno));
+    return;
+  }
+  fd.release();
+
+  CA_output = output.get();
+
+  QueryParseContext context;
+  context.schemas = std::move(schemas);
+
+  try {
+    CA_parse_script(&context, input.get());
+  } catch (kj::Exception e) {
+    WriteError(output.get(), e.getDescription().cStr());
+  } catch (std::exception& e) {
+    WriteError(output.get(), e.what());
+  }
+}
+
+// Reloads the schema whenever SIGHUP is received.  The signal must be blocked
+// in all threads.
+void ReloadOnHangup(std::shared_ptr<SchemaGenerations> schemas) {
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGHUP);
+
+  for (;;) {
+    int signal_number;
+    const auto ret = sigwait(&signals, &signal_number);
+    if (ret != 0) {
+      KJ_LOG(ERROR, "sigwait failed", strerror(ret));
+      return;
+    }
+
+    try {
+      const auto generation = schemas->Reload();
+      KJ_LOG(INFO, "schema reloaded", generation);
+    } catch (kj::Exception e) {
+      KJ_LOG(ERROR, "schema reload failed", e);
+    } catch (std::exception& e) {
+      KJ_LOG(ERROR, "schema reload failed", e.what());
+    }
+  }
+}
+
+}  // namespace
+
+void RunServer(const char* path, std::shared_ptr<SchemaGenerations> schemas) {
+  // A client disconnecting before it has read all results must not terminate
+  // the server.
+  signal(SIGPIPE, SIG_IGN);
+
+  // SIGHUP is handled by a dedicated thread.  The caller has blocked it in
+  // every thread.
+  std::thread(ReloadOnHangup, schemas).detach();
+
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  KJ_REQUIRE(strlen(path) < sizeof(address.sun_path), "socket path too long",
+             path);
+  strcpy(address.sun_path, path);
+
+  int listen_fd;
+  KJ_SYSCALL(listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  kj::AutoCloseFd listener(listen_fd);
+
+  // Remove any socket left behind by a previous server.
+  if (-1 == unlink(path) && errno != ENOENT)
+    KJ_FAIL_SYSCALL("unlink", errno, path);
+
+  KJ_SYSCALL(bind(listen_fd, reinterpret_cast<struct sockaddr*>(&address),
+                  sizeof(address)),
+             path);
+  KJ_SYSCALL(listen(listen_fd, SOMAXCONN), path);
+
+  for (;;) {
+    const auto fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+
+    if (fd == -1) {
+      switch (errno) {
+        case EINTR:
+        case ECONNABORTED:
+          continue;
+
+        case EMFILE:
+        case ENFILE:
+          // Wait for some of the existing sessions to finish.
+          KJ_LOG(WARNING, "out of file descriptors", strerror(errno));
+          sleep(1);
+          continue;
+
+        default:
+          KJ_FAIL_SYSCALL("accept4", errno, path);
+      }
+    }
+
+    std::thread(ServeConnection, fd, schemas).detach();
+  }
+}
+
+}  // namespace table
+}  // namespace cantera
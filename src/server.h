@@ -0,0 +1,24 @@
+#ifndef STORAGE_CA_TABLE_SERVER_H_
+#define STORAGE_CA_TABLE_SERVER_H_ 1
+
+#include <memory>
+
+namespace cantera {
+namespace table {
+
+class SchemaGenerations;
+
+// Listens for connections on the Unix domain socket `path', and executes the
+// statements read from each connection against `schemas', writing the results
+// back to the same connection.  Every connection is a separate session, with
+// its own runtime parameters and prepared statements, and is served by its own
+// thread.  The schema is reloaded when the process receives SIGHUP, which the
+// caller must block before starting any thread, including the workers of
+// ThreadPool::Default().  Never returns.
+[[noreturn]] void RunServer(const char* path,
+                            std::shared_ptr<SchemaGenerations> schemas);
+
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !STORAGE_CA_TABLE_SERVER_H_
@@ -1,35 +1,98 @@
+#include <cinttypes>
 #include <cstring>
 
+#include "src/batch.h"
 #include "src/ca-table.h"
+#include "src/explain.h"
+#include "src/facet.h"
+#include "src/prepare.h"
 #include "src/query.h"
+#include "src/schema.h"
 #include "src/select.h"
+#include "src/warmup.h"
 
 #include <kj/debug.h>
 
 namespace cantera {
 namespace table {
 
+namespace {
+
+void PrintWarmUpProgress(FILE* output, RuntimeParameterValue format,
+                         const WarmUpProgress& progress) {
+  if (format == CA_PARAM_VALUE_JSON) {
+    fprintf(output,
+            "{\"tables-done\":%zu,\"tables\":%zu,\"index-bytes\":%" PRIu64
+            ",\"rows\":%" PRIu64 ",\"row-bytes\":%" PRIu64 "}\n",
+            progress.tables_done, progress.tables_total, progress.index_bytes,
+            progress.rows, progress.row_bytes);
+  } else {
+    fprintf(output, "%zu,%zu,%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+            progress.tables_done, progress.tables_total, progress.index_bytes,
+            progress.rows, progress.row_bytes);
+  }
+  fflush(output);
+}
+
+}  // namespace
+
 void CA_process_statement(QueryParseContext* context, Statement* stmt) {
+  // Keep the current schema generation alive until the statement finishes,
+  // even if it is replaced meanwhile.
+  const auto schema = context->schemas->Current();
+
+  // Parameters only get values when a prepared statement is executed.
+  KJ_REQUIRE(!MaxParameter(stmt),
+             "parameters are only allowed in prepared statements");
+
   /* Execute the statement itself */
 
   switch (stmt->type) {
     case kStatementQuery:
-      ca_schema_query(context->schema.get(), stmt->u.query);
+      ca_schema_query(schema.get(), stmt->u.query);
       break;
 
     case kStatementCorrelate:
-      ca_schema_query_correlate(context->schema.get(),
+      ca_schema_query_correlate(schema.get(),
                                 stmt->u.query_correlate.query_A,
                                 stmt->u.query_correlate.query_B);
       break;
 
+    case kStatementPrepare:
+      Prepare(context, stmt->u.prepare);
+      break;
+
+    case kStatementExecute:
+      Execute(context, stmt->u.execute);
+      break;
+
+    case kStatementDeallocate:
+      Deallocate(context, stmt->u.deallocate);
+      break;
+
+    case kStatementExplain:
+      ExplainAnalyze(schema.get(), stmt->u.query);
+      break;
+
+    case kStatementFacet:
+      Facet(schema.get(), stmt->u.facet);
+      break;
+
     case kStatementParse:
       PrintQuery(stmt->u.parse.query);
-      printf("\n");
+      fprintf(CA_output, "\n");
       break;
 
+    case kStatementReload: {
+      const auto generation = context->schemas->Reload();
+      if (CA_output_format == CA_PARAM_VALUE_JSON)
+        fprintf(CA_output, "{\"generation\":%" PRIu64 "}\n", generation);
+      else
+        fprintf(CA_output, "%" PRIu64 "\n", generation);
+    } break;
+
     case kStatementSelect:
-      Select(context->schema.get(), stmt->u.select);
+      Select(schema.get(), stmt->u.select);
       break;
 
     case kStatementSet:
@@ -45,10 +108,57 @@ void CA_process_statement(QueryParseContext* context, Statement* stmt) {
           strcpy(CA_time_format, stmt->u.set.v.string_value);
 
           break;
+
+        case CA_PARAM_MEMORY_LIMIT:
+          KJ_REQUIRE(stmt->u.set.v.integer_value >= 0,
+                     "memory limit must not be negative");
+          CA_memory_limit = stmt->u.set.v.integer_value;
+          break;
+
+        case CA_PARAM_TIMEOUT:
+          KJ_REQUIRE(stmt->u.set.v.integer_value >= 0,
+                     "timeout must not be negative");
+          CA_timeout = stmt->u.set.v.integer_value;
+          break;
       }
       break;
+
+    case kStatementWarmUp: {
+      auto options = context->schemas->GetWarmUpOptions();
+      if (stmt->u.warmup.keys) {
+        options.keys.clear();
+        for (auto key = stmt->u.warmup.keys; key; key = key->next)
+          options.keys.emplace_back(key->value);
+      }
+
+      // Progress is reported from the worker threads, which have their own
+      // session parameters.
+      const auto output = CA_output;
+      const auto format = CA_output_format;
+      const auto total =
+          WarmUp(schema.get(), options,
+                 [output, format](const WarmUpProgress& progress) {
+                   PrintWarmUpProgress(output, format, progress);
+                 });
+
+      // Always report something, even without any tables.
+      if (!total.tables_total) PrintWarmUpProgress(output, format, total);
+    } break;
   }
 }
 
+void CA_dispatch_statement(QueryParseContext* context, Statement* stmt) {
+  if (context->batch) {
+    context->batch->Submit(stmt);
+  } else {
+    CA_process_statement(context, stmt);
+    fflush(CA_output);
+  }
+
+  // The parser doesn't read ahead of the semicolon ending a statement, so
+  // nothing that is still being parsed lives in the old arena.
+  context->arena = std::make_shared<kj::Arena>();
+}
+
 }  // namespace table
 }  // namespace cantera
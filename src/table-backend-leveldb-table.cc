@@ -114,6 +114,8 @@ class LevelDBBuilder final : public TableBuilder {
         KJ_FAIL_REQUIRE(
             "LevelDB tables do not support given compression method");
     }
+    if (options.GetBlockSize())
+      leveldb_options.block_size = options.GetBlockSize();
 
     writable_file_ = std::make_unique<LevelDBWriter>(
         path, options.GetFileFlags(), options.GetFileMode());
@@ -145,25 +147,63 @@ class LevelDBBuilder final : public TableBuilder {
 
 /*****************************************************************************/
 
-class LevelDBTable final : public Table, private leveldb::RandomAccessFile {
+class LevelDBFile final : public leveldb::RandomAccessFile {
  public:
-  LevelDBTable(const char* path, kj::AutoCloseFd fd, const struct stat& st)
-      : Table(st), fd_(std::move(fd)) {
-    leveldb::Table* table;
+  LevelDBFile(kj::AutoCloseFd fd) : fd_(std::move(fd)) {}
+
+  ~LevelDBFile() noexcept {
+    try {
+      fd_ = nullptr;
+    } catch (...) {
+    }
+  }
+
+  leveldb::Status Read(uint64_t offset, size_t n, leveldb::Slice* result,
+                       char* scratch) const override {
+    auto amount_read = pread(fd_, scratch, n, offset);
+    if (amount_read < 0)
+      return leveldb::Status::IOError("pread failed", strerror(errno));
+    ThreadTableIOStats().bytes_read += amount_read;
+    *result = leveldb::Slice(scratch, static_cast<size_t>(n));
+    return leveldb::Status::OK();
+  }
+
+ private:
+  kj::AutoCloseFd fd_;
+};
+
+// The open table, shared by all cursors.  LevelDB tables are safe to read
+// from several threads at once, as long as each thread uses its own iterator.
+struct LevelDBSharedTable {
+  LevelDBSharedTable(kj::AutoCloseFd fd, const struct stat& st)
+      : file(std::move(fd)) {
+    leveldb::Table* result;
     CHECK_STATUS(
-        leveldb::Table::Open(leveldb::Options(), this, st.st_size, &table));
-    table_.reset(table);
+        leveldb::Table::Open(leveldb::Options(), &file, st.st_size, &result));
+    table.reset(result);
+  }
 
-    iterator_.reset(table_->NewIterator(leveldb::ReadOptions()));
+  // Declared before `table', so that the table is destroyed first.
+  LevelDBFile file;
+  std::unique_ptr<leveldb::Table> table;
+};
+
+class LevelDBTable final : public Table {
+ public:
+  LevelDBTable(kj::AutoCloseFd fd, const struct stat& st)
+      : LevelDBTable(std::make_shared<LevelDBSharedTable>(std::move(fd), st),
+                     st) {}
+
+  LevelDBTable(std::shared_ptr<const LevelDBSharedTable> shared,
+               const struct stat& st)
+      : Table(st), shared_(std::move(shared)) {
+    iterator_.reset(shared_->table->NewIterator(leveldb::ReadOptions()));
     iterator_->SeekToFirst();
     if (!iterator_->Valid()) eof_ = true;
   }
 
-  ~LevelDBTable() noexcept {
-    try {
-      fd_ = nullptr;
-    } catch (...) {
-    }
+  std::unique_ptr<Table> NewCursor() override {
+    return std::make_unique<LevelDBTable>(shared_, st);
   }
 
   int IsSorted() override { return true; }
@@ -224,17 +264,7 @@ class LevelDBTable final : public Table, private leveldb::RandomAccessFile {
     return 0 == key.compare(iterator_->key());
   }
 
-  leveldb::Status Read(uint64_t offset, size_t n, leveldb::Slice* result,
-                       char* scratch) const override {
-    auto amount_read = pread(fd_, scratch, n, offset);
-    if (amount_read < 0)
-      return leveldb::Status::IOError("pread failed", strerror(errno));
-    *result = leveldb::Slice(scratch, static_cast<size_t>(n));
-    return leveldb::Status::OK();
-  }
-
-  kj::AutoCloseFd fd_;
-  std::unique_ptr<leveldb::Table> table_;
+  std::shared_ptr<const LevelDBSharedTable> shared_;
   std::unique_ptr<leveldb::Iterator> iterator_;
   bool need_seek_ = false;
   bool eof_ = false;
@@ -252,7 +282,7 @@ std::unique_ptr<TableBuilder> LevelDBTableBackend::Create(
 std::unique_ptr<Table> LevelDBTableBackend::Open(const char* path,
                                                  kj::AutoCloseFd fd,
                                                  const struct stat& st) {
-  return std::make_unique<LevelDBTable>(path, std::move(fd), st);
+  return std::make_unique<LevelDBTable>(std::move(fd), st);
 }
 
 std::unique_ptr<SeekableTable> LevelDBTableBackend::OpenSeekable(
@@ -24,6 +24,7 @@
 #include "src/table-backend-writeonce.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cerrno>
 #include <climits>
@@ -31,8 +32,14 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <future>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <numeric>
+#include <queue>
+#include <thread>
 
 #include <err.h>
 #include <fcntl.h>
@@ -46,14 +53,22 @@
 #include <kj/debug.h>
 
 #include <lz4.h>
-
+#include <lz4hc.h>
+#include <zdict.h>
+#include <zstd.h>
+
+#include "src/batch-reader.h"
+#include "src/block-cache.h"
+#include "src/bloom-filter.h"
+#include "src/key-search-tree.h"
+#include "src/thread-pool.h"
 #include "src/util.h"
 
 #include "third_party/oroch/oroch/integer_codec.h"
 
 #define MAGIC UINT64_C(0x6c6261742e692e70)
 #define MAJOR_VERSION 4
-#define MINOR_VERSION 0
+#define MINOR_VERSION 1
 
 namespace cantera {
 namespace table {
@@ -69,6 +84,9 @@ enum CA_wo_flags {
   // v4 flags
   CA_WO_FLAG_SEEKABLE = 0x01,
   CA_WO_FLAG_EXTENDED = 0x02,
+  // The blocks are compressed with a dictionary, stored right before the
+  // index.  Its size is in `data_reserved'.
+  CA_WO_FLAG_DICTIONARY = 0x04,
 };
 
 struct CA_wo_header {
@@ -81,19 +99,115 @@ struct CA_wo_header {
   uint64_t index_offset;
 };
 
+// Follows the header of v4 tables with CA_WO_FLAG_EXTENDED set.  The table
+// data starts right after it.
+struct CA_wo_header_ext {
+  // The size of this structure, so that fields can be added.
+  uint32_t size;
+
+  // The block size the table was built for.
+  uint32_t block_size;
+
+  // The size of the Bloom filter stored before the compression dictionary,
+  // or zero if the table has no filter.
+  uint64_t filter_size;
+
+  // The size of the restart points of seekable blocks, stored before the
+  // Bloom filter, or zero if there are none.
+  uint64_t restarts_size;
+};
+
+// The regions of a v4 table.  In file order, these are the header, the
+// blocks, the restart points of seekable blocks, the Bloom filter, the
+// compression dictionary and the index.
+struct WriteOnceLayout {
+  uint64_t dictionary_offset() const { return index_offset - dictionary_size; }
+
+  uint64_t filter_offset() const { return dictionary_offset() - filter_size; }
+
+  uint64_t restarts_offset() const { return filter_offset() - restarts_size; }
+
+  // Since v4.1, the keys of the index and of non-seekable blocks are
+  // front-coded.
+  bool front_coded() const { return minor_version >= 1; }
+
+  uint8_t minor_version = 0;
+  TableCompression compression = kTableCompressionNone;
+  uint64_t data_offset = sizeof(struct CA_wo_header);
+  uint64_t filter_size = 0;
+  uint64_t restarts_size = 0;
+  uint64_t dictionary_size = 0;
+  uint64_t index_offset = 0;
+};
+
+/*****************************************************************************/
+
+// The block size used unless the table options say otherwise.  Tables record
+// their block size in the header extension.
+static constexpr size_t kDefaultBlockSize = 32 * 1024;
+
+static constexpr size_t kMinBlockSize = 512;
+static constexpr size_t kMaxBlockSize = 64 * 1024 * 1024;
+
+// Limits on the size of blocks, derived from the block size.
+struct BlockSizeLimits {
+  explicit BlockSizeLimits(size_t block_size)
+      : max(block_size), entry_limit(block_size - 4), min(block_size / 8 * 3) {
+    KJ_REQUIRE(block_size >= kMinBlockSize && block_size <= kMaxBlockSize,
+               "unsupported block size", block_size);
+  }
+
+  // If a block gets larger than this value then it is closed.
+  size_t max;
+
+  // If an entry is larger than this limit then it is stored in a separate
+  // block unless the preceding block is too small.
+  size_t entry_limit;
+
+  // If a block is larger than this value and the next entry is larger than
+  // the limit above then this block is closed and the next entry will be
+  // really stored in a separate block.
+  size_t min;
+};
+
+// The amount of block data used to train a compression dictionary, relative
+// to the size of the dictionary.  The zstd documentation recommends about
+// 100 times the dictionary size.
+static constexpr size_t kDictionarySampleRatio = 100;
+
+// The number of blocks per worker thread that may be waiting for compression
+// or for being written, when blocks are compressed in parallel.
+static constexpr size_t kPendingBlocksPerThread = 2;
+
+// The memory used for sorting unsorted input unless the table options say
+// otherwise, and the least memory given to reading back each sorted run.
+static constexpr size_t kDefaultSortBufferSize = 256 * 1024 * 1024;
+static constexpr size_t kMinRunBufferSize = 64 * 1024;
+
 /*****************************************************************************/
 
-// If a block gets larger than this value then it is closed.
-static constexpr size_t kBlockSizeMax = 32 * 1024;
+// Locks the memory holding the elements of `v', so that it is never paged out.
+template <typename T>
+void LockVector(const std::vector<T>& v) {
+  if (v.empty()) return;
+  KJ_SYSCALL(mlock(v.data(), v.size() * sizeof(T)));
+}
 
-// If an entry is larger than this limit then it is stored in a separate
-// block unless the preceding block is too small.
-static constexpr size_t kEntrySizeLimit = kBlockSizeMax - 4;
+// Reads one byte from every page of a memory mapped range, so that the whole
+// range is paged in.
+void FaultIn(const void* data, size_t size) {
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  auto ptr = static_cast<const volatile char*>(data);
+  for (size_t i = 0; i < size; i += page_size) ptr[i];
+}
 
-// If a block is larger than this value and the next entry is larger than
-// the limit above then this block is closed and the next entry will be
-// really stored in a separate block.
-static constexpr size_t kBlockSizeMin = 12 * 1024;
+// Returns the length of the longest common prefix of `a' and `b'.
+size_t SharedPrefixSize(const string_view& a, const string_view& b) {
+  const size_t limit = std::min(a.size(), b.size());
+  size_t result = 0;
+  while (result < limit && a[result] == b[result]) ++result;
+  return result;
+}
 
 /*****************************************************************************/
 
@@ -234,48 +348,231 @@ class FileIO {
 
 /*****************************************************************************/
 
-class Lz4Compressor {
+// A block compression method.  Compressed blocks start with the size of the
+// uncompressed data, as a 32-bit integer in host byte order.  Codecs keep
+// compression contexts between blocks, so each thread needs its own.
+class BlockCodec {
+ public:
+  virtual ~BlockCodec() {}
+
+  virtual void Compress(DataBuffer& dst, const DataBuffer& src) = 0;
+
+  virtual void Decompress(DataBuffer& dst, const DataBuffer& src) = 0;
+
+ protected:
+  static constexpr size_t kHeaderSize = sizeof(uint32_t);
+
+  // Makes room for `bound' bytes of compressed data after the header, and
+  // returns a pointer to it.
+  static char* StartCompress(DataBuffer& dst, const DataBuffer& src,
+                             size_t bound) {
+    KJ_REQUIRE(src.size() <= UINT32_MAX, src.size());
+    const uint32_t size = src.size();
+    dst.resize(kHeaderSize + bound);
+    memcpy(dst.data(), &size, kHeaderSize);
+    return dst.data() + kHeaderSize;
+  }
+
+  // Makes room for the uncompressed data in `dst', and returns the size of
+  // the compressed data following the header of `src'.
+  static size_t StartDecompress(DataBuffer& dst, const DataBuffer& src) {
+    KJ_REQUIRE(src.size() >= kHeaderSize, "truncated compressed block");
+    uint32_t size;
+    memcpy(&size, src.data(), kHeaderSize);
+    dst.resize(size);
+    return src.size() - kHeaderSize;
+  }
+};
+
+// LZ4.  Level 0 selects the fast compressor, and higher levels, up to
+// LZ4HC_CLEVEL_MAX, the slower high compression compressor.  Both produce
+// the same format.
+class Lz4Codec final : public BlockCodec {
+ public:
+  explicit Lz4Codec(int level) : level_(level) {
+    KJ_REQUIRE(level_ <= LZ4HC_CLEVEL_MAX, "unsupported LZ4 level", level_);
+  }
+
+  void Compress(DataBuffer& dst, const DataBuffer& src) override {
+    KJ_REQUIRE(src.size() <= LZ4_MAX_INPUT_SIZE, src.size());
+    const int bound = LZ4_compressBound(src.size());
+    char* output = StartCompress(dst, src, bound);
+
+    const int size =
+        level_ ? LZ4_compress_HC(src.data(), output, src.size(), bound, level_)
+               : LZ4_compress_default(src.data(), output, src.size(), bound);
+    KJ_REQUIRE(size > 0, "LZ4 compression error");
+
+    dst.resize(kHeaderSize + size);
+  }
+
+  void Decompress(DataBuffer& dst, const DataBuffer& src) override {
+    const size_t input_size = StartDecompress(dst, src);
+    const int size = LZ4_decompress_safe(src.data() + kHeaderSize, dst.data(),
+                                         input_size, dst.size());
+    KJ_REQUIRE(size >= 0 && size_t(size) == dst.size(),
+               "LZ4 decompression error");
+  }
+
+ private:
+  const int level_;
+};
+
+// A zstd dictionary trained on the blocks of a table.  Decompression state
+// derived from it is shared by all cursors of the table.
+class ZstdDictionary {
  public:
-  void Go(DataBuffer& dst, const DataBuffer& src, int level) {
-    dst.reserve(LZ4_compressBound(src.size())+4);
-    uint32_t l = src.size();
-    memcpy(dst.data(), &l, 4);
-    const int size = LZ4_compress_default(src.data(), dst.data()+4, src.size(), dst.capacity()-4);
-    if (size < 0)
-      KJ_FAIL_REQUIRE("zstd compression error");
-    dst.resize(size+4);
+  explicit ZstdDictionary(std::string data)
+      : data_(std::move(data)),
+        ddict_(ZSTD_createDDict(data_.data(), data_.size())) {
+    KJ_REQUIRE(ddict_ != nullptr, "invalid zstd dictionary");
   }
 
+  KJ_DISALLOW_COPY(ZstdDictionary);
+
+  ~ZstdDictionary() { ZSTD_freeDDict(ddict_); }
+
+  const std::string& data() const { return data_; }
+
+  const ZSTD_DDict* ddict() const { return ddict_; }
+
+ private:
+  const std::string data_;
+  ZSTD_DDict* const ddict_;
 };
 
-class Lz4Decompressor {
+// Zstandard.  Level 0 selects the library's default level.
+class ZstdCodec final : public BlockCodec {
  public:
-  void Go(DataBuffer& dst, const DataBuffer& src) {
-    uint32_t l;
-    memcpy(&l, src.data(), 4);
-    dst.resize(l);
-    const int size = LZ4_decompress_fast(src.data()+4, dst.data(), l);
-    if (size < 0)
-      KJ_FAIL_REQUIRE("decompression error");
+  ZstdCodec(int level, std::shared_ptr<const ZstdDictionary> dictionary)
+      : level_(level), dictionary_(std::move(dictionary)) {
+    KJ_REQUIRE(level_ <= ZSTD_maxCLevel(), "unsupported zstd level", level_);
+  }
+
+  KJ_DISALLOW_COPY(ZstdCodec);
+
+  ~ZstdCodec() {
+    ZSTD_freeCCtx(cctx_);
+    ZSTD_freeDCtx(dctx_);
+    ZSTD_freeCDict(cdict_);
+  }
+
+  void Compress(DataBuffer& dst, const DataBuffer& src) override {
+    if (!cctx_) cctx_ = ZSTD_createCCtx();
+    KJ_REQUIRE(cctx_ != nullptr, "ZSTD_createCCtx failed");
+
+    if (dictionary_ && !cdict_) {
+      const auto& data = dictionary_->data();
+      cdict_ = ZSTD_createCDict(data.data(), data.size(), level_);
+      KJ_REQUIRE(cdict_ != nullptr, "ZSTD_createCDict failed");
+    }
+
+    const size_t bound = ZSTD_compressBound(src.size());
+    char* output = StartCompress(dst, src, bound);
+
+    const size_t size =
+        cdict_ ? ZSTD_compress_usingCDict(cctx_, output, bound, src.data(),
+                                          src.size(), cdict_)
+               : ZSTD_compressCCtx(cctx_, output, bound, src.data(),
+                                   src.size(), level_);
+    KJ_REQUIRE(!ZSTD_isError(size), "zstd compression error",
+               ZSTD_getErrorName(size));
+
+    dst.resize(kHeaderSize + size);
+  }
+
+  void Decompress(DataBuffer& dst, const DataBuffer& src) override {
+    if (!dctx_) dctx_ = ZSTD_createDCtx();
+    KJ_REQUIRE(dctx_ != nullptr, "ZSTD_createDCtx failed");
+
+    const size_t input_size = StartDecompress(dst, src);
+    const size_t size =
+        dictionary_
+            ? ZSTD_decompress_usingDDict(dctx_, dst.data(), dst.size(),
+                                         src.data() + kHeaderSize, input_size,
+                                         dictionary_->ddict())
+            : ZSTD_decompressDCtx(dctx_, dst.data(), dst.size(),
+                                  src.data() + kHeaderSize, input_size);
+    KJ_REQUIRE(!ZSTD_isError(size), "zstd decompression error",
+               ZSTD_getErrorName(size));
+    KJ_REQUIRE(size == dst.size(), "zstd decompression error");
   }
+
+ private:
+  const int level_;
+  const std::shared_ptr<const ZstdDictionary> dictionary_;
+
+  ZSTD_CCtx* cctx_ = nullptr;
+  ZSTD_DCtx* dctx_ = nullptr;
+  ZSTD_CDict* cdict_ = nullptr;
 };
 
+// Returns a codec for the compression method stored in a table header, or
+// null for uncompressed tables.  The level only affects compression.
+std::unique_ptr<BlockCodec> NewBlockCodec(
+    TableCompression compression, int level = 0,
+    std::shared_ptr<const ZstdDictionary> dictionary = nullptr) {
+  KJ_REQUIRE(!dictionary || compression == kTableCompressionZSTD,
+             "compression dictionaries are only supported with zstd");
+
+  switch (compression) {
+    case kTableCompressionNone:
+      return nullptr;
+
+    case kTableCompressionLZ4:
+      return std::make_unique<Lz4Codec>(level);
+
+    case kTableCompressionZSTD:
+      return std::make_unique<ZstdCodec>(level, std::move(dictionary));
+
+    case kTableCompressionDefault:
+      break;
+  }
+
+  KJ_FAIL_REQUIRE("unsupported compression method", compression);
+}
 
 /*****************************************************************************/
 
+// The encodings of v4 blocks.
+enum class WriteOnceBlockFormat {
+  // The sizes of all keys, then of all values, then all keys, then all
+  // values.  Used by non-seekable v4.0 tables.
+  kColumns,
+
+  // Like kColumns, but each key only stores what differs from the preceding
+  // key, preceded by the sizes of the prefixes shared with it.  Every
+  // kRestartInterval-th key is stored in full.  Used by non-seekable tables
+  // since v4.1.
+  kFrontCoded,
+
+  // Each row as its key size, value size, key and value, so that rows can be
+  // read in order from the start of any row.  Used by seekable tables.
+  kRows,
+};
+
 class WriteOnceBlock {
  public:
   using array_codec = oroch::varint_codec<uint32_t>;
   using value_codec = oroch::varint_codec<uint32_t>;
 
+  // The interval between restart points: the keys stored in full in
+  // kFrontCoded blocks, and the rows whose offsets are recorded for kRows
+  // blocks.
+  static constexpr size_t kRestartInterval = 16;
+
   bool empty() const { return !num_entries(); }
 
   size_t num_entries() const { return key_size_.size(); }
 
-  size_t EstimateSize() const {
+  size_t EstimateSize(WriteOnceBlockFormat format) const {
     size_t size = key_data_.size() + value_data_.size();
     size += array_codec::space(key_size_.begin(), key_size_.end());
     size += array_codec::space(value_size_.begin(), value_size_.end());
+    if (format == WriteOnceBlockFormat::kFrontCoded) {
+      size -= shared_total_;
+      size += array_codec::space(shared_size_.begin(), shared_size_.end());
+    }
     return size;
   }
 
@@ -294,6 +591,12 @@ class WriteOnceBlock {
   }
 
   void Add(const string_view& key, const string_view& value) {
+    size_t shared = 0;
+    if (num_entries() % kRestartInterval)
+      shared = SharedPrefixSize(GetLaskKey(), key);
+    shared_size_.push_back(shared);
+    shared_total_ += shared;
+
     key_size_.push_back(key.size());
     key_data_.insert(key_data_.end(), key.begin(), key.end());
     value_size_.push_back(value.size());
@@ -301,26 +604,46 @@ class WriteOnceBlock {
   }
 
   void Clear() {
+    shared_size_.clear();
+    shared_total_ = 0;
     key_size_.clear();
     key_data_.clear();
     value_size_.clear();
     value_data_.clear();
   }
 
-  void Marshal(DataBuffer& buffer, bool seekable) const {
+  void Marshal(DataBuffer& buffer, WriteOnceBlockFormat format) const {
     buffer.clear();
 
     const size_t num = num_entries();
     if (!num) return;
 
-    buffer.reserve(EstimateSize());
-    if (!seekable) {
+    buffer.reserve(EstimateSize(format));
+    if (format == WriteOnceBlockFormat::kColumns) {
       unsigned char* ptr = buffer.udata();
       array_codec::encode(ptr, key_size_.begin(), key_size_.end());
       array_codec::encode(ptr, value_size_.begin(), value_size_.end());
       buffer.resize(ptr - buffer.udata());
       buffer.append(key_data_);
       buffer.append(value_data_);
+    } else if (format == WriteOnceBlockFormat::kFrontCoded) {
+      std::vector<uint32_t> suffix_size(num);
+      for (size_t i = 0; i < num; i++)
+        suffix_size[i] = key_size_[i] - shared_size_[i];
+
+      unsigned char* ptr = buffer.udata();
+      array_codec::encode(ptr, shared_size_.begin(), shared_size_.end());
+      array_codec::encode(ptr, suffix_size.begin(), suffix_size.end());
+      array_codec::encode(ptr, value_size_.begin(), value_size_.end());
+      buffer.resize(ptr - buffer.udata());
+
+      size_t k_offset = 0;
+      for (size_t i = 0; i < num; i++) {
+        buffer.append(key_data_.data() + k_offset + shared_size_[i],
+                      suffix_size[i]);
+        k_offset += key_size_[i];
+      }
+      buffer.append(value_data_);
     } else {
       size_t k_offset = 0, v_offset = 0;
       for (size_t i = 0; i < num; i++) {
@@ -337,27 +660,30 @@ class WriteOnceBlock {
     }
   }
 
-  void Unmarshal(DataBuffer& buffer, size_t num, bool seekable) {
+  void Unmarshal(DataBuffer& buffer, size_t num, WriteOnceBlockFormat format) {
     Clear();
 
     if (!num) return;
 
     const unsigned char* ptr = buffer.udata();
-    if (!seekable) {
-      key_size_.resize(num);
-      value_size_.resize(num);
+    const unsigned char* end = buffer.udata() + buffer.size();
+    if (format != WriteOnceBlockFormat::kRows) {
+      std::vector<uint32_t> shared_size;
+      DecodeSizes(ptr, num, format, shared_size, key_size_, value_size_);
 
-      array_codec::decode(key_size_.begin(), key_size_.end(), ptr);
-      array_codec::decode(value_size_.begin(), value_size_.end(), ptr);
+      if (format == WriteOnceBlockFormat::kFrontCoded) {
+        ptr = DecodeKeys(ptr, end, shared_size, key_size_, key_data_);
+      } else {
+        size_t k_total =
+            std::accumulate(key_size_.begin(), key_size_.end(), size_t(0));
+        KJ_REQUIRE(k_total <= size_t(end - ptr));
+        key_data_.insert(key_data_.end(), ptr, ptr + k_total);
+        ptr += k_total;
+      }
 
-      size_t k_total =
-          std::accumulate(key_size_.begin(), key_size_.end(), size_t(0));
       size_t v_total =
           std::accumulate(value_size_.begin(), value_size_.end(), size_t(0));
-      KJ_REQUIRE((ptr + k_total + v_total) <= (buffer.udata() + buffer.size()));
-
-      key_data_.insert(key_data_.end(), ptr, ptr + k_total);
-      ptr += k_total;
+      KJ_REQUIRE(v_total <= size_t(end - ptr));
       value_data_.insert(value_data_.end(), ptr, ptr + v_total);
     } else {
       for (size_t i = 0; i < num; i++) {
@@ -373,6 +699,24 @@ class WriteOnceBlock {
     }
   }
 
+  size_t MemoryUsage() const {
+    return shared_size_.capacity() * sizeof(uint32_t) +
+           key_size_.capacity() * sizeof(uint32_t) + key_data_.capacity() +
+           value_size_.capacity() * sizeof(uint32_t) + value_data_.capacity();
+  }
+
+  // Appends the offsets of every kRestartInterval-th row of the block, in the
+  // kRows format, to `offsets'.
+  void GetRestartOffsets(std::vector<uint32_t>& offsets) const {
+    size_t offset = 0;
+    for (size_t i = 0; i < num_entries(); i++) {
+      if (i % kRestartInterval == 0) offsets.push_back(offset);
+      uint32_t ks = key_size_[i], vs = value_size_[i];
+      offset += value_codec::value_space(ks) + ks;
+      offset += value_codec::value_space(vs) + vs;
+    }
+  }
+
   // NB: This requires seekable block format.
   size_t GetEntryOffset(uint32_t num) {
     size_t offset = 0;
@@ -396,6 +740,56 @@ class WriteOnceBlock {
   }
 
  private:
+  // Decodes the sizes that start kColumns and kFrontCoded blocks of `num'
+  // entries, and advances `ptr' to the key data.  For kFrontCoded blocks,
+  // `key_size' receives the sizes of the stored key suffixes.
+  static void DecodeSizes(const unsigned char*& ptr, size_t num,
+                          WriteOnceBlockFormat format,
+                          std::vector<uint32_t>& shared_size,
+                          std::vector<uint32_t>& key_size,
+                          std::vector<uint32_t>& value_size) {
+    shared_size.resize(num);
+    key_size.resize(num);
+    value_size.resize(num);
+
+    if (format == WriteOnceBlockFormat::kFrontCoded)
+      array_codec::decode(shared_size.begin(), shared_size.end(), ptr);
+    array_codec::decode(key_size.begin(), key_size.end(), ptr);
+    array_codec::decode(value_size.begin(), value_size.end(), ptr);
+  }
+
+  // Rebuilds front-coded keys from their shared prefix sizes and the key
+  // suffixes at `ptr', appending them to `key_data'.  Replaces the suffix
+  // sizes in `key_size' with full key sizes, and returns the end of the
+  // suffixes.
+  static const unsigned char* DecodeKeys(
+      const unsigned char* ptr, const unsigned char* end,
+      const std::vector<uint32_t>& shared_size,
+      std::vector<uint32_t>& key_size, std::vector<char>& key_data) {
+    size_t prev_offset = key_data.size(), prev_size = 0;
+    for (size_t i = 0; i < key_size.size(); i++) {
+      const size_t shared = shared_size[i], suffix = key_size[i];
+      KJ_REQUIRE(shared <= prev_size && suffix <= size_t(end - ptr),
+                 "corrupt front-coded key", i, shared, suffix);
+
+      const size_t offset = key_data.size();
+      key_data.resize(offset + shared + suffix);
+      std::copy_n(key_data.begin() + prev_offset, shared,
+                  key_data.begin() + offset);
+      std::copy_n(ptr, suffix, key_data.begin() + offset + shared);
+      ptr += suffix;
+
+      key_size[i] = shared + suffix;
+      prev_offset = offset;
+      prev_size = key_size[i];
+    }
+    return ptr;
+  }
+
+  // Sizes of the prefixes keys share with the preceding keys, and their sum.
+  std::vector<uint32_t> shared_size_;
+  size_t shared_total_ = 0;
+
   // Accumulated key data.
   std::vector<uint32_t> key_size_;
   std::vector<char> key_data_;
@@ -409,72 +803,156 @@ class WriteOnceBlock {
    public:
     Cache(const WriteOnceBlock& block) : block_(block) {}
 
-    void Clear() {
-      keys_.clear();
-      values_.clear();
+    void Initialize() {
+      keys_ = MakeViews(block_.key_size_, block_.key_data_.data());
+      values_ = MakeViews(block_.value_size_, block_.value_data_.data());
     }
 
-    uint32_t FindEntryByKey(const string_view& key) {
-      if (keys_.empty()) InitializeKeys();
-      auto pos = std::lower_bound(keys_.begin(), keys_.end(), key);
-      return std::distance(keys_.begin(), pos);
-    }
+    // Initializes the cache from the `size' bytes of kColumns or kFrontCoded
+    // block data at `data' instead of from the block.  Only the sizes, and
+    // front-coded keys, are decoded; the rest is used in place, so `data'
+    // must outlive the cache.
+    void Initialize(const unsigned char* data, size_t size, size_t num,
+                    WriteOnceBlockFormat format) {
+      if (!num) return;
+
+      std::vector<uint32_t> shared_size;
+      std::vector<uint32_t> key_size;
+      std::vector<uint32_t> value_size;
+
+      const unsigned char* ptr = data;
+      const unsigned char* end = data + size;
+      DecodeSizes(ptr, num, format, shared_size, key_size, value_size);
+
+      if (format == WriteOnceBlockFormat::kFrontCoded) {
+        ptr = DecodeKeys(ptr, end, shared_size, key_size, key_data_);
+        keys_ = MakeViews(key_size, key_data_.data());
+      } else {
+        size_t k_total =
+            std::accumulate(key_size.begin(), key_size.end(), size_t(0));
+        KJ_REQUIRE(k_total <= size_t(end - ptr));
+        keys_ = MakeViews(key_size, reinterpret_cast<const char*>(ptr));
+        ptr += k_total;
+      }
 
-    string_view GetKey(uint32_t num) {
-      if (keys_.empty()) InitializeKeys();
-      return keys_[num];
+      size_t v_total =
+          std::accumulate(value_size.begin(), value_size.end(), size_t(0));
+      KJ_REQUIRE(v_total <= size_t(end - ptr));
+      values_ = MakeViews(value_size, reinterpret_cast<const char*>(ptr));
     }
 
-    string_view GetValue(uint32_t num) {
-      if (values_.empty()) InitializeValues();
-      return values_[num];
+    size_t num_entries() const { return keys_.size(); }
+
+    uint32_t FindEntryByKey(const string_view& key) const {
+      auto pos = std::lower_bound(keys_.begin(), keys_.end(), key);
+      return std::distance(keys_.begin(), pos);
     }
 
-   private:
-    void InitializeKeys() {
-      size_t num = block_.num_entries();
-      if (num == 0) return;
+    string_view GetKey(uint32_t num) const { return keys_[num]; }
 
-      keys_.resize(num);
+    string_view GetValue(uint32_t num) const { return values_[num]; }
 
-      size_t offset = 0;
-      for (size_t i = 0; i < num; i++) {
-        size_t size = block_.key_size_[i];
-        keys_[i] = string_view(block_.key_data_.data() + offset, size);
-        offset += size;
-      }
+    size_t MemoryUsage() const {
+      return (keys_.capacity() + values_.capacity()) * sizeof(string_view) +
+             key_data_.capacity();
     }
 
-    void InitializeValues() {
-      size_t num = block_.num_entries();
-      if (num == 0) return;
-
-      values_.resize(num);
+   private:
+    static std::vector<string_view> MakeViews(
+        const std::vector<uint32_t>& sizes, const char* data) {
+      std::vector<string_view> result(sizes.size());
 
       size_t offset = 0;
-      for (size_t i = 0; i < num; i++) {
-        size_t size = block_.value_size_[i];
-        values_[i] = string_view(block_.value_data_.data() + offset, size);
-        offset += size;
+      for (size_t i = 0; i < sizes.size(); i++) {
+        result[i] = string_view(data + offset, sizes[i]);
+        offset += sizes[i];
       }
+
+      return result;
     }
 
     const WriteOnceBlock& block_;
 
+    // Keys rebuilt from front-coded block data.
+    std::vector<char> key_data_;
+
     std::vector<string_view> keys_;
     std::vector<string_view> values_;
   };
 };
 
+// A read-only memory map of the first `size' bytes of a file.
+class WriteOnceMapping {
+ public:
+  WriteOnceMapping(int fd, size_t size) : size_(size) {
+    data_ = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == data_) KJ_FAIL_SYSCALL("mmap", errno);
+  }
+
+  KJ_DISALLOW_COPY(WriteOnceMapping);
+
+  ~WriteOnceMapping() { munmap(data_, size_); }
+
+  const unsigned char* data() const {
+    return reinterpret_cast<const unsigned char*>(data_);
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  void* data_;
+  const size_t size_;
+};
+
+// A decoded block of a v4 table, as kept in the block cache.
+struct WriteOnceDecodedBlock {
+  // Decodes a copy of the block data in `data'.
+  WriteOnceDecodedBlock(DataBuffer& data, size_t num_entries,
+                        WriteOnceBlockFormat format)
+      : cache(block) {
+    block.Unmarshal(data, num_entries, format);
+    cache.Initialize();
+  }
+
+  // Decodes the `size' bytes of uncompressed block data at `offset' in
+  // `mapping' in place.  The mapping is kept as long as the block.
+  WriteOnceDecodedBlock(std::shared_ptr<const WriteOnceMapping> mapping,
+                        uint64_t offset, size_t size, size_t num_entries,
+                        WriteOnceBlockFormat format)
+      : cache(block), mapping(std::move(mapping)) {
+    KJ_REQUIRE(offset + size <= this->mapping->size(), offset, size);
+    cache.Initialize(this->mapping->data() + offset, size, num_entries,
+                     format);
+  }
+
+  // Mapped block data is not counted, since it is in the page cache, and
+  // the kernel can drop it at any time.  Keys rebuilt from it are.
+  size_t MemoryUsage() const {
+    return sizeof(*this) + block.MemoryUsage() + cache.MemoryUsage();
+  }
+
+  // Empty if the block is decoded in place.
+  WriteOnceBlock block;
+  WriteOnceBlock::Cache cache;
+
+  std::shared_ptr<const WriteOnceMapping> mapping;
+};
+
 /*****************************************************************************/
 
 class WriteOnceIndex {
  public:
+  // The interval between last keys of blocks stored in full.  The others
+  // only store what differs from the preceding key.
+  static constexpr size_t kRestartInterval = 16;
+
   void Clear() {
     size_.clear();
     num_entries_.clear();
+    key_shared_.clear();
     key_size_.clear();
     key_data_.clear();
+    last_key_.clear();
   }
 
   size_t num_blocks() const { return key_size_.size(); }
@@ -485,33 +963,47 @@ class WriteOnceIndex {
     size += oroch::varint_codec<size_t>::space(size_.begin(), size_.end());
     size += oroch::varint_codec<uint32_t>::space(num_entries_.begin(),
                                                  num_entries_.end());
+    size += oroch::varint_codec<uint32_t>::space(key_shared_.begin(),
+                                                 key_shared_.end());
     size += oroch::varint_codec<uint32_t>::space(key_size_.begin(),
                                                  key_size_.end());
     return size;
   }
 
+  // Sets the offset of the first block, which follows the table header.
+  void SetDataOffset(uint64_t offset) { data_offset_ = offset; }
+
   uint64_t GetIndexOffset() const {
-    uint64_t offset = sizeof(struct CA_wo_header);
-    return std::accumulate(size_.begin(), size_.end(), offset);
+    return std::accumulate(size_.begin(), size_.end(), data_offset_);
   }
 
   uint64_t GetBlockOffset(size_t num) const {
-    uint64_t offset = sizeof(struct CA_wo_header);
-    return std::accumulate(size_.begin(), size_.begin() + num, offset);
+    return std::accumulate(size_.begin(), size_.begin() + num, data_offset_);
   }
 
-  size_t GetBlockSize(size_t block) { return size_[block]; }
+  size_t GetBlockSize(size_t block) const { return size_[block]; }
 
-  uint32_t GetNumEntries(size_t block) { return num_entries_[block]; }
+  uint32_t GetNumEntries(size_t block) const { return num_entries_[block]; }
 
   void Add(const WriteOnceBlock& block, uint32_t size) {
-    string_view last_key = block.GetLaskKey();
+    Add(block.GetLaskKey(), block.num_entries(), size);
+  }
+
+  void Add(const string_view& last_key, uint32_t num_entries, uint32_t size) {
+    size_t shared = 0;
+    if (num_blocks() % kRestartInterval)
+      shared = SharedPrefixSize(last_key_, last_key);
+
     size_.push_back(size);
-    num_entries_.push_back(block.num_entries());
-    key_size_.push_back(last_key.size());
-    key_data_.insert(key_data_.end(), last_key.begin(), last_key.end());
+    num_entries_.push_back(num_entries);
+    key_shared_.push_back(shared);
+    key_size_.push_back(last_key.size() - shared);
+    key_data_.insert(key_data_.end(), last_key.begin() + shared,
+                     last_key.end());
+    last_key_.assign(last_key.data(), last_key.size());
   }
 
+  // Writes the index in the v4.1 format, with front-coded keys.
   void Marshal(DataBuffer& buffer) const {
     buffer.clear();
 
@@ -529,13 +1021,17 @@ class WriteOnceIndex {
     oroch::varint_codec<size_t>::encode(ptr, size_.begin(), size_.end());
     oroch::varint_codec<uint32_t>::encode(ptr, num_entries_.begin(),
                                           num_entries_.end());
+    oroch::varint_codec<uint32_t>::encode(ptr, key_shared_.begin(),
+                                          key_shared_.end());
     oroch::varint_codec<uint32_t>::encode(ptr, key_size_.begin(),
                                           key_size_.end());
     buffer.resize(ptr - buffer.udata());
     buffer.append(key_data_);
   }
 
-  void Unmarshal(DataBuffer& buffer) {
+  // Reads an index written with front-coded keys if `front_coded' is true,
+  // and with full keys otherwise.
+  void Unmarshal(DataBuffer& buffer, bool front_coded) {
     Clear();
 
     const unsigned char* ptr = buffer.udata();
@@ -544,45 +1040,120 @@ class WriteOnceIndex {
 
     size_.resize(num);
     num_entries_.resize(num);
+    key_shared_.resize(num);
     key_size_.resize(num);
 
     oroch::varint_codec<size_t>::decode(size_.begin(), size_.end(), ptr);
     oroch::varint_codec<uint32_t>::decode(num_entries_.begin(),
                                           num_entries_.end(), ptr);
+    if (front_coded) {
+      oroch::varint_codec<uint32_t>::decode(key_shared_.begin(),
+                                            key_shared_.end(), ptr);
+    }
     oroch::varint_codec<uint32_t>::decode(key_size_.begin(), key_size_.end(),
                                           ptr);
 
+    // The lookup tables need every restart key in full, and the others to
+    // share no more than the preceding keys hold.
+    size_t prev_size = 0;
+    for (size_t i = 0; i < num; i++) {
+      KJ_REQUIRE(key_shared_[i] <= prev_size &&
+                     (i % kRestartInterval || !key_shared_[i]),
+                 "corrupt block index", i);
+      prev_size = key_shared_[i] + key_size_[i];
+    }
+
     size_t key_size =
         std::accumulate(key_size_.begin(), key_size_.end(), size_t(0));
     KJ_REQUIRE((ptr + key_size) <= (buffer.udata() + buffer.size()));
     key_data_.insert(key_data_.end(), ptr, ptr + key_size);
   }
 
+  // Returns the number of bytes used by the index in memory.
+  size_t MemoryUsage() const {
+    return size_.size() * sizeof(size_[0]) +
+           num_entries_.size() * sizeof(num_entries_[0]) +
+           key_shared_.size() * sizeof(key_shared_[0]) +
+           key_size_.size() * sizeof(key_size_[0]) + key_data_.size();
+  }
+
+  void LockMemory() const {
+    LockVector(size_);
+    LockVector(num_entries_);
+    LockVector(key_shared_);
+    LockVector(key_size_);
+    LockVector(key_data_);
+  }
+
  private:
+  // Offset of the first block.
+  uint64_t data_offset_ = sizeof(struct CA_wo_header);
+
   // Block sizes.
   std::vector<size_t> size_;
 
   // Number of entries in blocks.
   std::vector<uint32_t> num_entries_;
 
-  // Last keys in blocks.
+  // Last keys in blocks, as the sizes of the prefixes they share with the
+  // preceding keys, and the sizes and data of the rest.
+  std::vector<uint32_t> key_shared_;
   std::vector<uint32_t> key_size_;
   std::vector<char> key_data_;
 
+  // The last key added, while building the index.
+  std::string last_key_;
+
  public:
+  // Lookup tables for the index.  Initialize() must be called once the index
+  // has been read; after that, the cache is immutable, and may be used from
+  // several threads at once.
   class Cache {
    public:
     Cache(const WriteOnceIndex& index) : index_(index) {}
 
-    uint64_t FindBlockByKey(const string_view& key) {
-      if (keys_.empty()) InitializeKeys();
-      auto pos = std::lower_bound(keys_.begin(), keys_.end(), key);
-      return std::distance(keys_.begin(), pos);
+    void Initialize() {
+      InitializeKeys();
+      InitializeBlocks();
     }
 
-    uint64_t GetBlockOffset(size_t num) {
-      if (blocks_.empty()) InitializeBlocks();
-      return blocks_[num];
+    // Returns the first block whose last key is not less than `key', or the
+    // number of blocks if there is none.  Searches the keys stored in full,
+    // and then rebuilds the keys following the last one less than `key', up
+    // to the next one.
+    uint64_t FindBlockByKey(const string_view& key) const {
+      const size_t restart = restart_keys_.LowerBound(key);
+      if (restart == 0) return 0;
+
+      const size_t first = (restart - 1) * kRestartInterval;
+      const size_t last =
+          std::min(first + kRestartInterval, index_.num_blocks());
+
+      std::string block_key = restart_keys_.key(restart - 1).to_string();
+      size_t offset = restart_offsets_[restart - 1] + block_key.size();
+      for (size_t i = first + 1; i < last; i++) {
+        const size_t suffix_size = index_.key_size_[i];
+        block_key.resize(index_.key_shared_[i]);
+        block_key.append(index_.key_data_.data() + offset, suffix_size);
+        offset += suffix_size;
+        if (string_view(block_key).compare(key) >= 0) return i;
+      }
+
+      return last;
+    }
+
+    uint64_t GetBlockOffset(size_t num) const { return blocks_[num]; }
+
+    size_t MemoryUsage() const {
+      return restart_keys_.MemoryUsage() +
+             restart_offsets_.size() * sizeof(restart_offsets_[0]) +
+             blocks_.size() * sizeof(blocks_[0]);
+    }
+
+    void LockMemory() const {
+      restart_keys_.LockMemory();
+      LockVector(restart_offsets_);
+      LockVector(blocks_);
     }
 
    private:
@@ -590,14 +1161,22 @@ class WriteOnceIndex {
       size_t num = index_.num_blocks();
       if (num == 0) return;
 
-      keys_.resize(num);
+      const size_t num_restarts = (num - 1) / kRestartInterval + 1;
+      std::vector<string_view> restart_keys(num_restarts);
+      restart_offsets_.resize(num_restarts);
 
       size_t offset = 0;
       for (size_t i = 0; i < num; i++) {
         size_t size = index_.key_size_[i];
-        keys_[i] = string_view(index_.key_data_.data() + offset, size);
+        if (i % kRestartInterval == 0) {
+          restart_keys[i / kRestartInterval] =
+              string_view(index_.key_data_.data() + offset, size);
+          restart_offsets_[i / kRestartInterval] = offset;
+        }
         offset += size;
       }
+
+      restart_keys_ = KeySearchTree(std::move(restart_keys));
     }
 
     void InitializeBlocks() {
@@ -606,14 +1185,17 @@ class WriteOnceIndex {
 
       blocks_.resize(num);
 
-      blocks_[0] = sizeof(struct CA_wo_header);
+      blocks_[0] = index_.data_offset_;
       for (size_t i = 1; i < num; i++)
         blocks_[i] = blocks_[i - 1] + index_.size_[i - 1];
     }
 
     const WriteOnceIndex& index_;
 
-    std::vector<string_view> keys_;
+    // The keys stored in full, and their offsets in the key data.
+    KeySearchTree restart_keys_;
+    std::vector<size_t> restart_offsets_;
+
     std::vector<uint64_t> blocks_;
   };
 };
@@ -624,7 +1206,12 @@ class WriteOnceBuilder : private PendingFile, public TableBuilder {
  public:
   WriteOnceBuilder(const char* path, const TableOptions& options)
       : PendingFile(path, options.GetFileFlags(), options.GetFileMode()),
+        block_size_(options.GetBlockSize() ? options.GetBlockSize()
+                                           : kDefaultBlockSize),
+        limits_(block_size_),
         seekable_(options.GetOutputSeekable()),
+        block_format_(seekable_ ? WriteOnceBlockFormat::kRows
+                                : WriteOnceBlockFormat::kFrontCoded),
         no_fsync_(options.GetNoFSync()) {
     KJ_REQUIRE((options.GetFileFlags() & ~(O_EXCL | O_CLOEXEC)) == 0);
 
@@ -635,8 +1222,30 @@ class WriteOnceBuilder : private PendingFile, public TableBuilder {
                "unsupported compression method");
 
     compression_level_ = options.GetCompressionLevel();
-    if (compression_level_ == 0 && compression_ != kTableCompressionNone)
-      compression_level_ = 3;
+    codec_ = NewBlockCodec(compression_, compression_level_);
+
+    dictionary_size_ = options.GetCompressionDictionarySize();
+    if (dictionary_size_) {
+      KJ_REQUIRE(compression_ == kTableCompressionZSTD,
+                 "compression dictionaries are only supported with zstd");
+      KJ_REQUIRE(!seekable_, "seekable tables are not compressed");
+    }
+
+    if (options.GetBloomFilterFalsePositiveRate() > 0) {
+      KJ_REQUIRE(!seekable_, "seekable tables can't have Bloom filters");
+      filter_builder_ = std::make_unique<BloomFilterBuilder>(
+          options.GetBloomFilterFalsePositiveRate());
+    }
+
+    index_.SetDataOffset(sizeof(struct CA_wo_header) +
+                         sizeof(struct CA_wo_header_ext));
+
+    size_t threads = options.GetCompressionThreads();
+    if (!threads) threads = std::max(std::thread::hardware_concurrency(), 1U);
+    if (codec_ && !seekable_ && threads > 1) {
+      pool_ = std::make_unique<ThreadPool>(threads);
+      max_pending_ = threads * kPendingBlocksPerThread;
+    }
 
     WriteHeader(0);
   }
@@ -646,22 +1255,43 @@ class WriteOnceBuilder : private PendingFile, public TableBuilder {
                "unsorted input data " + block_.GetLaskKey().to_string() + " >= " + key.to_string());
 
     const size_t size = key.size() + value.size();
-    const size_t block_size = block_.EstimateSize();
-    if ((block_size > kBlockSizeMax) ||
-        (block_size > kBlockSizeMin && size > kEntrySizeLimit)) {
+    const size_t block_size = block_.EstimateSize(block_format_);
+    if ((block_size > limits_.max) ||
+        (block_size > limits_.min && size > limits_.entry_limit)) {
       WriteBlock(block_, index_);
       block_.Clear();
     }
 
     block_.Add(key, value);
+    if (filter_builder_) filter_builder_->AddKey(key);
   }
 
   void Sync() override {
     WriteBlock(block_, index_);
+    if (dictionary_size_ && !dictionary_trained_) TrainDictionary();
+    while (!pending_.empty()) WritePendingBlock();
     WriteIndex(index_);
   }
 
+  TableCompressionStats GetCompressionStats() const override {
+    return stats_;
+  }
+
  private:
+  // A block held back until the compression dictionary is trained.
+  struct SampleBlock {
+    std::string last_key;
+    uint32_t num_entries;
+  };
+
+  // A block handed over to a worker thread, which marshals and compresses it
+  // into `data', and returns its marshaled size.
+  struct PendingBlock {
+    WriteOnceBlock block;
+    DataBuffer data;
+    std::future<size_t> marshaled_size;
+  };
+
   void WriteHeader(uint64_t index_offset) {
     struct CA_wo_header header;
     header.magic = MAGIC;  // Will implicitly store endianness
@@ -670,32 +1300,182 @@ class WriteOnceBuilder : private PendingFile, public TableBuilder {
     header.flags = seekable_ ? CA_WO_FLAG_SEEKABLE : 0;
     header.compression = compression_;
     header.data_reserved = 0;
+    if (dictionary_) {
+      header.flags |= CA_WO_FLAG_DICTIONARY;
+      header.data_reserved = dictionary_->data().size();
+    }
+    // Front-coded v4.1 tables always have a header extension, since readers
+    // from before v4.1 ignore the minor version but reject the extension.
+    header.flags |= CA_WO_FLAG_EXTENDED;
     header.index_offset = index_offset;
 
     KJ_SYSCALL(lseek(get(), 0, SEEK_SET));
     FileIO(get()).Write(&header, sizeof(header));
+
+    struct CA_wo_header_ext header_ext;
+    header_ext.size = sizeof(header_ext);
+    header_ext.block_size = block_size_;
+    header_ext.filter_size = filter_.size();
+    header_ext.restarts_size = restarts_.size() * sizeof(restarts_[0]);
+    FileIO(get()).Write(&header_ext, sizeof(header_ext));
   }
 
-  void WriteBlock(const WriteOnceBlock& block, WriteOnceIndex& index) {
-    block.Marshal(marshal_buffer_, seekable_);
+  // Writes `block', or with worker threads, hands it over to them, leaving
+  // `block' empty.  Blocks held back for training the compression dictionary
+  // are always marshaled here.
+  void WriteBlock(WriteOnceBlock& block, WriteOnceIndex& index) {
+    if (pool_ && (!dictionary_size_ || dictionary_trained_)) {
+      LaunchBlock(block);
+      return;
+    }
+
+    block.Marshal(marshal_buffer_, block_format_);
     if (!marshal_buffer_.size()) return;
 
-    DataBuffer& buffer = seekable_ ? marshal_buffer_ : GetWriteBuffer();
+    if (dictionary_size_ && !dictionary_trained_) {
+      samples_.emplace_back(SampleBlock{block.GetLaskKey().to_string(),
+                                        uint32_t(block.num_entries())});
+      sample_data_.append(marshal_buffer_.data(), marshal_buffer_.size());
+      sample_sizes_.push_back(marshal_buffer_.size());
+      if (sample_data_.size() >= dictionary_size_ * kDictionarySampleRatio)
+        TrainDictionary();
+      return;
+    }
+
+    stats_.uncompressed_bytes += marshal_buffer_.size();
+
+    DataBuffer& buffer =
+        seekable_ ? marshal_buffer_ : GetWriteBuffer(GetBlockCodec());
     FileIO(get()).Write(buffer);
 
+    stats_.compressed_bytes += buffer.size();
+
     index.Add(block, buffer.size());
+    if (seekable_) block.GetRestartOffsets(restarts_);
 
     // KJ_DBG(block.num_entries(), buffer.size());
   }
 
+  // Queues `block' for compression, after writing the oldest pending blocks
+  // if too many are in flight.  This bounds the memory used by the pipeline.
+  void LaunchBlock(WriteOnceBlock& block) {
+    if (block.empty()) return;
+
+    while (pending_.size() >= max_pending_) WritePendingBlock();
+
+    pending_.emplace_back();
+    auto& pending = pending_.back();
+    std::swap(pending.block, block);
+    pending.marshaled_size = pool_->Launch([this, &pending] {
+      return CompressBlock(pending.block, pending.data);
+    });
+  }
+
+  // Marshals and compresses `block' into `data', and returns its marshaled
+  // size.  Runs in worker threads, which share a pool of compression contexts.
+  size_t CompressBlock(const WriteOnceBlock& block, DataBuffer& data) {
+    std::unique_ptr<BlockCodec> codec;
+    {
+      std::unique_lock<std::mutex> lock(idle_codecs_mutex_);
+      if (!idle_codecs_.empty()) {
+        codec = std::move(idle_codecs_.back());
+        idle_codecs_.pop_back();
+      }
+    }
+    if (!codec)
+      codec = NewBlockCodec(compression_, compression_level_, dictionary_);
+
+    DataBuffer marshal_buffer;
+    block.Marshal(marshal_buffer, block_format_);
+    codec->Compress(data, marshal_buffer);
+
+    std::unique_lock<std::mutex> lock(idle_codecs_mutex_);
+    idle_codecs_.emplace_back(std::move(codec));
+
+    return marshal_buffer.size();
+  }
+
+  // Waits for the oldest pending block to be compressed, then writes it and
+  // adds it to the index.
+  void WritePendingBlock() {
+    auto& pending = pending_.front();
+    const size_t marshaled_size = pending.marshaled_size.get();
+
+    FileIO(get()).Write(pending.data);
+    stats_.uncompressed_bytes += marshaled_size;
+    stats_.compressed_bytes += pending.data.size();
+
+    index_.Add(pending.block, pending.data.size());
+    pending_.pop_front();
+  }
+
+  // Trains a dictionary on the blocks held back so far, and writes them
+  // compressed with it.  If training fails, which happens if there are too
+  // few blocks, the table is compressed without a dictionary.
+  void TrainDictionary() {
+    dictionary_trained_ = true;
+
+    if (!samples_.empty()) {
+      std::string dictionary(dictionary_size_, 0);
+      const size_t size = ZDICT_trainFromBuffer(
+          &dictionary[0], dictionary.size(), sample_data_.data(),
+          sample_sizes_.data(), sample_sizes_.size());
+      if (!ZDICT_isError(size)) {
+        dictionary.resize(size);
+        dictionary_ = std::make_shared<ZstdDictionary>(std::move(dictionary));
+        dictionary_codec_ =
+            NewBlockCodec(compression_, compression_level_, dictionary_);
+        stats_.dictionary_bytes = size;
+      }
+    }
+
+    size_t offset = 0;
+    for (size_t i = 0; i < samples_.size(); ++i) {
+      marshal_buffer_.clear();
+      marshal_buffer_.append(sample_data_.data() + offset, sample_sizes_[i]);
+      offset += sample_sizes_[i];
+
+      stats_.uncompressed_bytes += marshal_buffer_.size();
+
+      if (dictionary_) {
+        stats_.sample_bytes_without_dictionary +=
+            GetWriteBuffer(codec_.get()).size();
+      }
+
+      DataBuffer& buffer = GetWriteBuffer(GetBlockCodec());
+      FileIO(get()).Write(buffer);
+
+      stats_.compressed_bytes += buffer.size();
+      if (dictionary_) stats_.sample_bytes_with_dictionary += buffer.size();
+
+      index_.Add(samples_[i].last_key, samples_[i].num_entries, buffer.size());
+    }
+
+    samples_.clear();
+    sample_data_.clear();
+    sample_sizes_.clear();
+  }
+
   uint64_t WriteIndex(const WriteOnceIndex& index) {
+    const size_t restarts_size = restarts_.size() * sizeof(restarts_[0]);
+    if (restarts_size) FileIO(get()).Write(restarts_.data(), restarts_size);
+    if (filter_builder_) {
+      filter_ = filter_builder_->Finish();
+      FileIO(get()).Write(filter_);
+    }
+    if (dictionary_) FileIO(get()).Write(dictionary_->data());
+
     index.Marshal(marshal_buffer_);
     if (!marshal_buffer_.size()) return 0;
 
-    DataBuffer& buffer = GetWriteBuffer();
+    // The index is compressed without the dictionary, which is trained on
+    // blocks.
+    DataBuffer& buffer = GetWriteBuffer(codec_.get());
     FileIO(get()).Write(buffer);
 
-    uint64_t index_offset = index.GetIndexOffset();
+    uint64_t index_offset =
+        index.GetIndexOffset() + restarts_size + filter_.size();
+    if (dictionary_) index_offset += dictionary_->data().size();
     WriteHeader(index_offset);
     PendingFile::Finish();
 
@@ -708,11 +1488,14 @@ class WriteOnceBuilder : private PendingFile, public TableBuilder {
     return index_offset;
   }
 
-  DataBuffer& GetWriteBuffer() {
-    if (compression_ == TableCompression::kTableCompressionNone)
-      return marshal_buffer_;
+  BlockCodec* GetBlockCodec() const {
+    return dictionary_codec_ ? dictionary_codec_.get() : codec_.get();
+  }
+
+  DataBuffer& GetWriteBuffer(BlockCodec* codec) {
+    if (!codec) return marshal_buffer_;
 
-    compressor_.Go(compress_buffer_, marshal_buffer_, compression_level_);
+    codec->Compress(compress_buffer_, marshal_buffer_);
 
     // if (compress_buffer_.size() > marshal_buffer_.size())
     //  KJ_DBG(compress_buffer_.size() - marshal_buffer_.size());
@@ -723,7 +1506,11 @@ class WriteOnceBuilder : private PendingFile, public TableBuilder {
   // Saved table creation options.
   TableCompression compression_ = TableCompression::kTableCompressionNone;
   int compression_level_ = 0;
+  size_t dictionary_size_ = 0;
+  const size_t block_size_;
+  const BlockSizeLimits limits_;
   const bool seekable_;
+  const WriteOnceBlockFormat block_format_;
   const bool no_fsync_;
 
   // Result data.
@@ -734,28 +1521,62 @@ class WriteOnceBuilder : private PendingFile, public TableBuilder {
   DataBuffer marshal_buffer_;
   // A buffer for block compression.
   DataBuffer compress_buffer_;
-  // Compression context.
-  Lz4Compressor compressor_;
+  // Compression context, if the table is compressed.
+  std::unique_ptr<BlockCodec> codec_;
+
+  // Blocks held back for training the compression dictionary.
+  bool dictionary_trained_ = false;
+  std::vector<SampleBlock> samples_;
+  std::string sample_data_;
+  std::vector<size_t> sample_sizes_;
+
+  // The trained dictionary, and a compression context using it.
+  std::shared_ptr<const ZstdDictionary> dictionary_;
+  std::unique_ptr<BlockCodec> dictionary_codec_;
+
+  // The offsets of the restart points of seekable blocks, relative to their
+  // blocks.
+  std::vector<uint32_t> restarts_;
+
+  // The Bloom filter of the keys, and once written, its serialized form.
+  std::unique_ptr<BloomFilterBuilder> filter_builder_;
+  std::string filter_;
+
+  TableCompressionStats stats_;
+
+  // Blocks being compressed by worker threads, in file order, and the
+  // compression contexts not in use by any of them.
+  std::deque<PendingBlock> pending_;
+  size_t max_pending_ = 0;
+  std::mutex idle_codecs_mutex_;
+  std::vector<std::unique_ptr<BlockCodec>> idle_codecs_;
+
+  // The worker threads, if blocks are compressed in parallel.  Destroyed
+  // first, so that no worker outlives the state above.
+  std::unique_ptr<ThreadPool> pool_;
 };
 
 /*****************************************************************************/
 
+// Builds a table from rows inserted in any order, with an external merge sort.
+//
+// Rows are buffered in memory until they fill the sort buffer, then sorted and
+// spilled to a temporary file as a run.  Sync() merges the runs into the table,
+// streaming each of them through a small read buffer.  If there are too many
+// runs for their buffers to fit in the sort buffer, they are first merged into
+// fewer, longer runs.  Tables whose rows fit in the sort buffer never touch the
+// temporary file.
 class WriteOnceSortingBuilder final : public WriteOnceBuilder {
  public:
   WriteOnceSortingBuilder(const char* path, const TableOptions& options)
-      : WriteOnceBuilder(path, options) {
-    std::string dir(".");
+      : WriteOnceBuilder(path, options),
+        sort_buffer_size_(options.GetSortBufferSize()
+                              ? options.GetSortBufferSize()
+                              : kDefaultSortBufferSize) {
     if (const char* last_slash = strrchr(path, '/')) {
       KJ_REQUIRE(path != last_slash);
-      dir = std::string(path, last_slash);
+      temp_directory_ = std::string(path, last_slash);
     }
-
-    raw_fd_ = AnonTemporaryFile(dir.c_str());
-
-    raw_stream_ = fdopen(raw_fd_.get(), "w");
-    if (!raw_stream_) KJ_FAIL_SYSCALL("fdopen", errno, path);
-
-    index_.reserve(12 * 1024 * 1024);
   }
 
   virtual ~WriteOnceSortingBuilder() noexcept {
@@ -767,123 +1588,243 @@ class WriteOnceSortingBuilder final : public WriteOnceBuilder {
   }
 
   void InsertRow(const string_view& key, const string_view& value) override {
-    AddEntry(key, value);
-    WriteEntryData(key, value);
-  }
+    KJ_REQUIRE(key.size() <= std::numeric_limits<uint32_t>::max(),
+               "too long key");
+    KJ_REQUIRE(value.size() <= std::numeric_limits<uint32_t>::max(),
+               "too long value");
 
-  void Sync() override {
-    FlushEntryData();
-    SortEntries();
+    entries_.emplace_back(
+        Entry{row_data_.size(), uint32_t(key.size()), uint32_t(value.size())});
+    row_data_.append(key.data(), key.size());
+    row_data_.append(value.data(), value.size());
 
-    DataBuffer buffer;
-    for (const Entry& entry : index_) {
-      buffer.resize(entry.key_size + entry.value_size);
-      FileIO(raw_fd_).Read(buffer, entry.offset);
+    if (row_data_.size() + entries_.size() * sizeof(Entry) >= sort_buffer_size_)
+      WriteRun();
+  }
 
-      const char* data = buffer.data();
-      const string_view key(data, entry.key_size);
-      const string_view value(data + entry.key_size, entry.value_size);
-      WriteOnceBuilder::InsertRow(key, value);
+  void Sync() override {
+    if (runs_.empty()) {
+      SortEntries();
+      for (const Entry& entry : entries_)
+        WriteOnceBuilder::InsertRow(EntryKey(entry), EntryValue(entry));
+    } else {
+      if (!entries_.empty()) WriteRun();
+      MergeRuns();
     }
 
     WriteOnceBuilder::Sync();
   }
 
  private:
+  // A row in the sort buffer.
   struct Entry {
     uint64_t offset;
-    uint32_t value_size;
     uint32_t key_size;
-    char prefix[24];
+    uint32_t value_size;
   };
 
-  void AddEntry(const string_view& key, const string_view& value) {
-    KJ_REQUIRE(key.size() <= std::numeric_limits<uint32_t>::max(),
-               "too long key");
-    KJ_REQUIRE(value.size() <= std::numeric_limits<uint32_t>::max(),
-               "too long value");
+  // A sorted run in the temporary file, holding rows as key size, value size,
+  // key and value.
+  struct Run {
+    uint64_t offset;
+    uint64_t end;
+  };
 
-    struct Entry entry;
-    size_t count = std::min(sizeof entry.prefix, key.size());
-    entry.offset = offset_;
-    entry.key_size = key.size();
-    entry.value_size = value.size();
-    std::copy_n(key.begin(), count, entry.prefix);
-    index_.push_back(entry);
+  // Reads the rows of a run back, through a buffer of its own.
+  class RunReader {
+   public:
+    RunReader(int fd, const Run& run, size_t buffer_size)
+        : fd_(fd), offset_(run.offset), end_(run.end), buffer_(buffer_size) {}
 
-    offset_ += key.size() + value.size();
-    if (key_size_max_ < key.size()) key_size_max_ = key.size();
-  }
+    // Moves to the next row of the run, and returns false if there is none.
+    // Invalidates the key and value of the previous row.
+    bool Next() {
+      if (begin_ == size_ && offset_ == end_) return false;
 
-  void WriteEntryData(const string_view& key, const string_view& value) {
-    KJ_REQUIRE(raw_stream_ != nullptr);
+      Fill(2 * sizeof(uint32_t));
+      uint32_t sizes[2];
+      memcpy(sizes, buffer_.data() + begin_, sizeof(sizes));
+      begin_ += sizeof(sizes);
 
-    if (0 == fwrite(key.data(), key.size(), 1, raw_stream_) ||
-        0 == fwrite(value.data(), value.size(), 1, raw_stream_))
-      KJ_FAIL_SYSCALL("fwrite", errno);
-  }
+      Fill(size_t{sizes[0]} + sizes[1]);
+      key_ = string_view(buffer_.data() + begin_, sizes[0]);
+      value_ = string_view(buffer_.data() + begin_ + sizes[0], sizes[1]);
+      begin_ += size_t{sizes[0]} + sizes[1];
 
-  void FlushEntryData() {
-    KJ_REQUIRE(raw_stream_ != nullptr);
-    int ret = fflush(raw_stream_);
-    if (ret) KJ_FAIL_SYSCALL("fflush", errno);
-  }
+      return true;
+    }
+
+    const string_view& key() const { return key_; }
+    const string_view& value() const { return value_; }
+
+   private:
+    // Makes sure that at least `size' bytes of the run are buffered.
+    void Fill(size_t size) {
+      if (size_ - begin_ >= size) return;
+
+      std::copy(buffer_.begin() + begin_, buffer_.begin() + size_,
+                buffer_.begin());
+      size_ -= begin_;
+      begin_ = 0;
+      if (buffer_.size() < size) buffer_.resize(size);
+
+      const size_t length =
+          std::min<uint64_t>(buffer_.size() - size_, end_ - offset_);
+      KJ_REQUIRE(size_ + length >= size, "truncated sort run");
+      FileIO(fd_).Read(buffer_.data() + size_, offset_, length);
+      offset_ += length;
+      size_ += length;
+    }
+
+    int fd_;
 
-  bool Compare(const Entry& lhs, const Entry& rhs) {
-    size_t lhs_count = std::min(sizeof lhs.prefix, size_t{lhs.key_size});
-    size_t rhs_count = std::min(sizeof rhs.prefix, size_t{rhs.key_size});
-    const string_view lhs_prefix(lhs.prefix, lhs_count);
-    const string_view rhs_prefix(rhs.prefix, rhs_count);
+    // The part of the run not read into the buffer yet.
+    uint64_t offset_;
+    uint64_t end_;
 
-    int fast_result = lhs_prefix.compare(rhs_prefix);
-    if (fast_result) return fast_result < 0;
+    // The buffered data not consumed yet is from `begin_' to `size_'.
+    std::vector<char> buffer_;
+    size_t begin_ = 0;
+    size_t size_ = 0;
 
-    FileIO fd(raw_fd_.get());
-    fd.Read(lhs_buffer_.get(), lhs.offset, lhs.key_size);
-    fd.Read(rhs_buffer_.get(), rhs.offset, rhs.key_size);
-    read_count_ += 2;
+    string_view key_;
+    string_view value_;
+  };
+
+  string_view EntryKey(const Entry& entry) const {
+    return string_view(row_data_.data() + entry.offset, entry.key_size);
+  }
 
-    string_view lhs_view(lhs_buffer_.get(), lhs.key_size);
-    string_view rhs_view(rhs_buffer_.get(), rhs.key_size);
-    return lhs_view < rhs_view;
+  string_view EntryValue(const Entry& entry) const {
+    return string_view(row_data_.data() + entry.offset + entry.key_size,
+                       entry.value_size);
   }
 
+  // Sorts the rows in the sort buffer, keeping rows with equal keys in
+  // insertion order.
   void SortEntries() {
-    lhs_buffer_ = std::make_unique<char[]>(key_size_max_);
-    rhs_buffer_ = std::make_unique<char[]>(key_size_max_);
-
-    // Use stable_sort here. It is usually implemented using merge sort
-    // algorithm that is preferred over quick sort when disk access is
-    // involved.
-    std::stable_sort(index_.begin(), index_.end(),
-                     [this](const auto& lhs, const auto& rhs) {
-                       return this->Compare(lhs, rhs);
+    std::stable_sort(entries_.begin(), entries_.end(),
+                     [this](const Entry& lhs, const Entry& rhs) {
+                       return EntryKey(lhs) < EntryKey(rhs);
                      });
+  }
+
+  // Sorts the rows in the sort buffer, appends them to the temporary file as
+  // a new run, and empties the sort buffer.
+  void WriteRun() {
+    if (!raw_stream_) {
+      raw_fd_ = AnonTemporaryFile(temp_directory_.c_str());
+      raw_stream_ = fdopen(raw_fd_.get(), "w");
+      if (!raw_stream_) KJ_FAIL_SYSCALL("fdopen", errno);
+    }
 
-    // KJ_LOG(DBG, index_.size(), read_count_);
+    SortEntries();
+
+    Run run{run_end_, run_end_};
+    for (const Entry& entry : entries_)
+      AppendRow(run, EntryKey(entry), EntryValue(entry));
+    runs_.push_back(run);
 
-    lhs_buffer_.reset();
-    rhs_buffer_.reset();
+    entries_.clear();
+    row_data_.clear();
   }
 
-  // Temporary file for all added key/value pairs.
-  kj::AutoCloseFd raw_fd_;
-  FILE* raw_stream_ = nullptr;
+  // Appends a row to `run', which must end where the temporary file does.
+  void AppendRow(Run& run, const string_view& key, const string_view& value) {
+    const uint32_t sizes[2] = {uint32_t(key.size()), uint32_t(value.size())};
+    if (1 != fwrite(sizes, sizeof(sizes), 1, raw_stream_) ||
+        (!key.empty() && 1 != fwrite(key.data(), key.size(), 1, raw_stream_)) ||
+        (!value.empty() &&
+         1 != fwrite(value.data(), value.size(), 1, raw_stream_)))
+      KJ_FAIL_SYSCALL("fwrite", errno);
+    run.end += sizeof(sizes) + key.size() + value.size();
+    run_end_ = run.end;
+  }
+
+  // Merges all runs into the table.  Rows with equal keys are taken from
+  // earlier runs first, so that they stay in insertion order.
+  void MergeRuns() {
+    // Release the sort buffer before the read buffers take its place.
+    std::vector<Entry>().swap(entries_);
+    std::string().swap(row_data_);
+
+    // The number of runs whose read buffers fit in the sort buffer.  At least
+    // two runs are always merged at once, even if their buffers do not fit.
+    const size_t max_runs =
+        std::max<size_t>(sort_buffer_size_ / kMinRunBufferSize, 2);
+
+    // Merging neighbouring runs keeps rows with equal keys in insertion order.
+    while (runs_.size() > max_runs) {
+      std::vector<Run> merged_runs;
+      for (size_t i = 0; i < runs_.size(); i += max_runs) {
+        const size_t count = std::min(max_runs, runs_.size() - i);
+        if (count == 1) {
+          merged_runs.push_back(runs_[i]);
+          continue;
+        }
+
+        Run run{run_end_, run_end_};
+        MergeRunRange(i, count, [this, &run](const string_view& key,
+                                             const string_view& value) {
+          AppendRow(run, key, value);
+        });
+        merged_runs.push_back(run);
+      }
+      runs_.swap(merged_runs);
+    }
+
+    MergeRunRange(0, runs_.size(),
+                  [this](const string_view& key, const string_view& value) {
+                    WriteOnceBuilder::InsertRow(key, value);
+                  });
+  }
+
+  // Merges `count' runs starting at `runs_[first]', passing their rows to
+  // `output' in order.
+  template <typename Output>
+  void MergeRunRange(size_t first, size_t count, Output&& output) {
+    if (fflush(raw_stream_)) KJ_FAIL_SYSCALL("fflush", errno);
+
+    const size_t buffer_size =
+        std::max(sort_buffer_size_ / count, kMinRunBufferSize);
+    std::vector<RunReader> readers;
+    readers.reserve(count);
+    for (size_t i = first; i < first + count; ++i)
+      readers.emplace_back(raw_fd_.get(), runs_[i], buffer_size);
+
+    auto greater = [&readers](size_t lhs, size_t rhs) {
+      const int result = readers[lhs].key().compare(readers[rhs].key());
+      return result ? result > 0 : lhs > rhs;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(
+        greater);
+    for (size_t i = 0; i < readers.size(); ++i)
+      if (readers[i].Next()) heap.push(i);
+
+    while (!heap.empty()) {
+      const size_t i = heap.top();
+      heap.pop();
+      output(readers[i].key(), readers[i].value());
+      if (readers[i].Next()) heap.push(i);
+    }
+  }
 
-  // Index of all added key/value pairs.
-  std::vector<Entry> index_;
+  // The memory to use for sorting rows, approximately.
+  const size_t sort_buffer_size_;
 
-  // Running file offset.
-  uint64_t offset_ = 0;
+  // The directory of the table, where the temporary file is created.
+  std::string temp_directory_ = ".";
 
-  // Longest encountered key size.
-  uint32_t key_size_max_ = 0;
-  // Buffers for key comparison.
-  std::unique_ptr<char[]> lhs_buffer_;
-  std::unique_ptr<char[]> rhs_buffer_;
+  // The rows not yet written to a run.
+  std::vector<Entry> entries_;
+  std::string row_data_;
 
-  // Read statistics.
-  uint64_t read_count_ = 0;
+  // Temporary file for the sorted runs.
+  kj::AutoCloseFd raw_fd_;
+  FILE* raw_stream_ = nullptr;
+
+  std::vector<Run> runs_;
+  uint64_t run_end_ = 0;
 };
 
 /*****************************************************************************/
@@ -891,19 +1832,36 @@ class WriteOnceSortingBuilder final : public WriteOnceBuilder {
 class WriteOnceTableBase {
  public:
   WriteOnceTableBase(kj::AutoCloseFd fd, uint64_t index_offset)
-      : fd_(std::move(fd)), index_offset_(index_offset) {}
+      : file_(std::make_shared<File>(std::move(fd))),
+        fd_(file_->fd.get()),
+        index_offset_(index_offset) {}
 
-  virtual ~WriteOnceTableBase() noexcept {
-    try {
-      fd_ = nullptr;
-    } catch (...) {
+  // Creates a cursor sharing the file of `table'.
+  WriteOnceTableBase(const WriteOnceTableBase& table) = default;
+
+  virtual ~WriteOnceTableBase() noexcept {}
+
+ private:
+  struct File {
+    File(kj::AutoCloseFd fd) : fd(std::move(fd)) {}
+
+    ~File() noexcept {
+      try {
+        fd = nullptr;
+      } catch (...) {
+      }
     }
-  }
+
+    kj::AutoCloseFd fd;
+  };
+
+  // Closes the file once the table and all its cursors are gone.
+  std::shared_ptr<File> file_;
 
  protected:
-  kj::AutoCloseFd fd_;
+  const int fd_;
 
-  uint64_t index_offset_;
+  const uint64_t index_offset_;
 };
 
 class WriteOnceTable : public WriteOnceTableBase, public Table {
@@ -911,22 +1869,36 @@ class WriteOnceTable : public WriteOnceTableBase, public Table {
   WriteOnceTable(kj::AutoCloseFd fd, const struct stat& st,
                  uint64_t index_offset)
       : WriteOnceTableBase(std::move(fd), index_offset), Table(st) {}
+
+  WriteOnceTable(const WriteOnceTable& table)
+      : WriteOnceTableBase(table), Table(table.st) {}
 };
 
 class WriteOnceSeekableTable : public WriteOnceTableBase, public SeekableTable {
  public:
   WriteOnceSeekableTable(kj::AutoCloseFd fd, const struct stat& st,
-                         uint64_t index_offset)
-      : WriteOnceTableBase(std::move(fd), index_offset), SeekableTable(st) {}
+                         uint64_t index_offset,
+                         uint64_t data_offset = sizeof(struct CA_wo_header))
+      : WriteOnceTableBase(std::move(fd), index_offset),
+        SeekableTable(st),
+        data_offset_(data_offset),
+        offset_(data_offset) {}
 
-  off_t Offset() final { return offset_ - sizeof(struct CA_wo_header); }
+  // Creates a cursor sharing the file of `table', positioned at the first row.
+  WriteOnceSeekableTable(const WriteOnceSeekableTable& table)
+      : WriteOnceTableBase(table),
+        SeekableTable(table.st),
+        data_offset_(table.data_offset_),
+        offset_(data_offset_) {}
 
-  void SeekToFirst() final { offset_ = sizeof(struct CA_wo_header); }
+  off_t Offset() final { return offset_ - data_offset_; }
+
+  void SeekToFirst() final { offset_ = data_offset_; }
 
   void Seek(off_t offset, int whence) final {
     switch (whence) {
       case SEEK_SET:
-        offset += sizeof(struct CA_wo_header);
+        offset += data_offset_;
         break;
 
       case SEEK_CUR:
@@ -941,7 +1913,7 @@ class WriteOnceSeekableTable : public WriteOnceTableBase, public SeekableTable {
         KJ_FAIL_REQUIRE(!"Invalid 'whence' value");
     }
 
-    KJ_REQUIRE(offset >= sizeof(struct CA_wo_header),
+    KJ_REQUIRE(offset >= data_offset_,
                "attempt to seek before start of table");
     KJ_REQUIRE(offset <= index_offset_, "attempt to seek past end of table");
 
@@ -957,25 +1929,89 @@ class WriteOnceSeekableTable : public WriteOnceTableBase, public SeekableTable {
   }
 
  protected:
+  // Offset of the first row.
+  const uint64_t data_offset_;
+
   // Used for read, seek, offset.
-  uint64_t offset_ = sizeof(struct CA_wo_header);
+  uint64_t offset_;
 };
 
 /*****************************************************************************/
 
+// The block index of a v4 table.  It is read once when the table is opened,
+// and shared by all cursors of the table.
+struct WriteOnceSharedIndex {
+  WriteOnceSharedIndex() : cache(index) {}
+
+  // Blocks of closed tables are never looked up again, but would stay cached
+  // until evicted, and mapped blocks would keep the file mapped meanwhile.
+  ~WriteOnceSharedIndex() {
+    BlockCache::Default().Erase(cache_id, index.num_blocks());
+  }
+
+  // The index is always in memory once read, so warming it up only means
+  // locking it, if requested.
+  uint64_t WarmUp(bool lock) const {
+    if (lock) {
+      index.LockMemory();
+      cache.LockMemory();
+      filter.LockMemory();
+    }
+    return index.MemoryUsage() + cache.MemoryUsage() + filter.MemoryUsage();
+  }
+
+  WriteOnceIndex index;
+  WriteOnceIndex::Cache cache;
+
+  // The keys of the table.  Contains every key if the table has no filter.
+  BloomFilter filter;
+
+  // The compression dictionary of the blocks, if any.
+  std::shared_ptr<const ZstdDictionary> dictionary;
+
+  // Identifies the blocks of the table in the block cache.
+  const uint64_t cache_id = BlockCache::Default().NewId();
+};
+
 class WriteOnceTable_v4 final : public WriteOnceTable {
  public:
   WriteOnceTable_v4(kj::AutoCloseFd fd, const struct stat& st,
-                    uint64_t index_offset, TableCompression compression)
-      : WriteOnceTable(std::move(fd), st, index_offset),
-        compression_(compression),
-        index_cache_(index_),
-        block_cache_(block_) {
-    ReadIndex();
+                    const WriteOnceLayout& layout)
+      : WriteOnceTable(std::move(fd), st, layout.index_offset),
+        compression_(layout.compression),
+        block_format_(layout.front_coded() ? WriteOnceBlockFormat::kFrontCoded
+                                           : WriteOnceBlockFormat::kColumns),
+        shared_index_(ReadIndex(layout)),
+        index_(shared_index_->index),
+        index_cache_(shared_index_->cache) {
+    codec_ = NewBlockCodec(compression_, 0, shared_index_->dictionary);
+
+    // Uncompressed blocks are used in place, instead of being read and
+    // copied.
+    if (compression_ == kTableCompressionNone)
+      mapping_ = std::make_shared<WriteOnceMapping>(fd_, index_offset_);
+  }
+
+  // Creates a cursor sharing the file and block index of `table', positioned
+  // at the first row.
+  WriteOnceTable_v4(const WriteOnceTable_v4& table)
+      : WriteOnceTable(table),
+        compression_(table.compression_),
+        block_format_(table.block_format_),
+        codec_(NewBlockCodec(compression_, 0, table.shared_index_->dictionary)),
+        shared_index_(table.shared_index_),
+        index_(shared_index_->index),
+        index_cache_(shared_index_->cache),
+        mapping_(table.mapping_) {}
+
+  std::unique_ptr<Table> NewCursor() override {
+    return std::make_unique<WriteOnceTable_v4>(*this);
   }
 
   int IsSorted() override { return 1; }
 
+  uint64_t WarmUp(bool lock) override { return shared_index_->WarmUp(lock); }
+
   void SeekToFirst() override {
     block_num_ = 0;
     entry_num_ = 0;
@@ -984,11 +2020,21 @@ class WriteOnceTable_v4 final : public WriteOnceTable {
   bool SeekToKey(const string_view& key) override {
     uint64_t block_num = index_cache_.FindBlockByKey(key);
     if (block_num >= index_.num_blocks()) return NotFound();
+
+    // Keys rejected by the Bloom filter are absent, so their block is not
+    // read.  The cursor stops at the start of the block, before any larger
+    // keys, so that prefix scans still work.
+    if (!shared_index_->filter.MayContain(key)) {
+      block_num_ = block_num;
+      entry_num_ = 0;
+      return false;
+    }
+
     if (block_num != block_read_num_) ReadBlock(block_num);
 
     block_num_ = block_num;
-    entry_num_ = block_cache_.FindEntryByKey(key);
-    return block_cache_.GetKey(entry_num_) == key;
+    entry_num_ = block_->cache.FindEntryByKey(key);
+    return block_->cache.GetKey(entry_num_) == key;
   }
 
   bool Skip(size_t count) override {
@@ -1018,13 +2064,66 @@ class WriteOnceTable_v4 final : public WriteOnceTable {
     return true;
   }
 
+  // Reads every block containing one of the keys that is not in the block
+  // cache with a single batch of reads, and decodes the blocks as their reads
+  // complete.  Blocks of uncompressed tables are decoded in place instead.
+  void LookupKeys(const std::vector<string_view>& keys,
+                  const std::function<void(size_t, const string_view&)>&
+                      callback) override {
+    // The positions in `keys' of the keys that may be in each block.
+    std::map<uint64_t, std::vector<size_t>> block_keys;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      if (!shared_index_->filter.MayContain(keys[i])) continue;
+      const auto block_num = index_cache_.FindBlockByKey(keys[i]);
+      if (block_num < index_.num_blocks()) block_keys[block_num].push_back(i);
+    }
+
+    struct PendingBlock {
+      uint64_t num;
+      std::vector<size_t> keys;
+      DataBuffer data;
+    };
+
+    std::deque<PendingBlock> blocks;
+    std::mutex callback_mutex;
+    BatchReader reader;
+
+    for (auto& entry : block_keys) {
+      auto cached = BlockCache::Default().Lookup<WriteOnceDecodedBlock>(
+          shared_index_->cache_id, entry.first);
+      if (!cached && mapping_) {
+        cached = BlockCache::Default().Insert(
+            shared_index_->cache_id, entry.first, MapBlock(entry.first));
+      }
+      if (cached) {
+        FindKeys(*cached, entry.second, keys, callback, callback_mutex);
+        continue;
+      }
+
+      blocks.emplace_back();
+      auto& block = blocks.back();
+      block.num = entry.first;
+      block.keys = std::move(entry.second);
+      block.data.resize(index_.GetBlockSize(block.num));
+
+      reader.Add(fd_, index_cache_.GetBlockOffset(block.num), block.data.size(),
+                 block.data.data(),
+                 [this, &block, &keys, &callback, &callback_mutex] {
+                   DecodeBlock(block.num, block.data, block.keys, keys,
+                               callback, callback_mutex);
+                 });
+    }
+
+    reader.Run();
+  }
+
   bool ReadRow(string_view& key, string_view& value) override {
     if (block_num_ == UINT64_MAX) SeekToFirst();
     if (block_num_ >= index_.num_blocks()) return false;
     if (block_num_ != block_read_num_) ReadBlock(block_num_);
 
-    key = block_cache_.GetKey(entry_num_);
-    value = block_cache_.GetValue(entry_num_);
+    key = block_->cache.GetKey(entry_num_);
+    value = block_->cache.GetValue(entry_num_);
 
     if (++entry_num_ >= index_.GetNumEntries(block_num_)) {
       ++block_num_;
@@ -1035,23 +2134,113 @@ class WriteOnceTable_v4 final : public WriteOnceTable {
   }
 
  private:
-  void ReadIndex() {
+  std::shared_ptr<const WriteOnceSharedIndex> ReadIndex(
+      const WriteOnceLayout& layout) {
+    auto result = std::make_shared<WriteOnceSharedIndex>();
+
+    if (layout.filter_size) {
+      std::string filter(layout.filter_size, 0);
+      FileIO(fd_).Read(&filter[0], layout.filter_offset(), filter.size());
+      result->filter = BloomFilter(filter);
+    }
+
+    if (layout.dictionary_size) {
+      std::string dictionary(layout.dictionary_size, 0);
+      FileIO(fd_).Read(&dictionary[0], layout.dictionary_offset(),
+                       dictionary.size());
+      result->dictionary =
+          std::make_shared<ZstdDictionary>(std::move(dictionary));
+    }
+
+    // The index is compressed without the dictionary.
     uint64_t size = st.st_size - index_offset_;
-    bool compressed = (compression_ != kTableCompressionNone);
-    index_.Unmarshal(Read(index_offset_, size, compressed));
+    result->index.Unmarshal(
+        Read(index_offset_, size, NewBlockCodec(compression_).get()),
+        layout.front_coded());
+    result->index.SetDataOffset(layout.data_offset);
+    result->cache.Initialize();
+
+    return result;
   }
 
   void ReadBlock(size_t num) {
     KJ_REQUIRE(num < index_.num_blocks());
 
-    uint64_t offset = index_cache_.GetBlockOffset(num);
-    size_t size = index_.GetBlockSize(num);
-    uint32_t num_entries = index_.GetNumEntries(num);
-    bool compressed = (compression_ != kTableCompressionNone);
-    block_.Unmarshal(Read(offset, size, compressed), num_entries, false);
+    auto& block_cache = BlockCache::Default();
+    block_ = block_cache.Lookup<WriteOnceDecodedBlock>(shared_index_->cache_id,
+                                                       num);
+    if (!block_) {
+      std::unique_ptr<WriteOnceDecodedBlock> block;
+      if (mapping_) {
+        block = MapBlock(num);
+      } else {
+        uint64_t offset = index_cache_.GetBlockOffset(num);
+        size_t size = index_.GetBlockSize(num);
+        uint32_t num_entries = index_.GetNumEntries(num);
+        block = std::make_unique<WriteOnceDecodedBlock>(
+            Read(offset, size, codec_.get()), num_entries, block_format_);
+      }
+      block_ = block_cache.Insert(shared_index_->cache_id, num,
+                                  std::move(block));
+    }
 
     block_read_num_ = num;
-    block_cache_.Clear();
+  }
+
+  // Decodes block `num' of an uncompressed table in place.
+  std::unique_ptr<WriteOnceDecodedBlock> MapBlock(size_t num) const {
+    const size_t size = index_.GetBlockSize(num);
+    ThreadTableIOStats().bytes_read += size;
+    return std::make_unique<WriteOnceDecodedBlock>(
+        mapping_, index_cache_.GetBlockOffset(num), size,
+        index_.GetNumEntries(num), block_format_);
+  }
+
+  // Decodes block `num', whose data has just been read into `data', adds it
+  // to the block cache, and finds the keys at the given positions of `keys' in
+  // it.  Uses no cursor state, since reads may complete in several threads at
+  // once.
+  void DecodeBlock(
+      size_t num, DataBuffer& data, const std::vector<size_t>& positions,
+      const std::vector<string_view>& keys,
+      const std::function<void(size_t, const string_view&)>& callback,
+      std::mutex& callback_mutex) const {
+    auto& io_stats = ThreadTableIOStats();
+    io_stats.bytes_read += data.size();
+
+    DataBuffer decompress_buffer;
+    DataBuffer* block_data = &data;
+    if (compression_ != kTableCompressionNone) {
+      NewBlockCodec(compression_, 0, shared_index_->dictionary)
+          ->Decompress(decompress_buffer, data);
+      io_stats.bytes_decompressed += decompress_buffer.size();
+      block_data = &decompress_buffer;
+    }
+
+    auto block = BlockCache::Default().Insert(
+        shared_index_->cache_id, num,
+        std::make_unique<WriteOnceDecodedBlock>(
+            *block_data, index_.GetNumEntries(num), block_format_));
+
+    FindKeys(*block, positions, keys, callback, callback_mutex);
+  }
+
+  // Reports the values of the keys at the given positions of `keys' found in
+  // `block'.
+  static void FindKeys(
+      const WriteOnceDecodedBlock& block, const std::vector<size_t>& positions,
+      const std::vector<string_view>& keys,
+      const std::function<void(size_t, const string_view&)>& callback,
+      std::mutex& callback_mutex) {
+    for (const auto i : positions) {
+      const auto entry_num = block.cache.FindEntryByKey(keys[i]);
+      if (entry_num >= block.cache.num_entries() ||
+          block.cache.GetKey(entry_num) != keys[i])
+        continue;
+
+      std::unique_lock<std::mutex> lock(callback_mutex);
+      callback(i, block.cache.GetValue(entry_num));
+    }
   }
 
   bool NotFound() {
@@ -1060,72 +2249,116 @@ class WriteOnceTable_v4 final : public WriteOnceTable {
     return false;
   }
 
-  DataBuffer& Read(uint64_t offset, size_t size, bool compressed) {
+  DataBuffer& Read(uint64_t offset, size_t size, BlockCodec* codec) {
     read_buffer_.resize(size);
     FileIO(fd_).Read(read_buffer_, offset);
 
-    if (!compressed) return read_buffer_;
+    auto& io_stats = ThreadTableIOStats();
+    io_stats.bytes_read += size;
+
+    if (!codec) return read_buffer_;
 
-    decompressor_.Go(decompress_buffer_, read_buffer_);
+    codec->Decompress(decompress_buffer_, read_buffer_);
+    io_stats.bytes_decompressed += decompress_buffer_.size();
 
     return decompress_buffer_;
   }
 
   const TableCompression compression_;
+  const WriteOnceBlockFormat block_format_;
 
-  WriteOnceIndex index_;
-  WriteOnceIndex::Cache index_cache_;
+  // Per-cursor buffers and decompression context.  The buffers are declared
+  // before the shared index, because the constructor uses them to read the
+  // index.
+  DataBuffer read_buffer_;
+  DataBuffer decompress_buffer_;
+  std::unique_ptr<BlockCodec> codec_;
 
-  WriteOnceBlock block_;
-  WriteOnceBlock::Cache block_cache_;
+  std::shared_ptr<const WriteOnceSharedIndex> shared_index_;
+  const WriteOnceIndex& index_;
+  const WriteOnceIndex::Cache& index_cache_;
+
+  // The data region of the file, if the table is uncompressed.
+  std::shared_ptr<const WriteOnceMapping> mapping_;
+
+  // The block at `block_read_num_', pinned in the block cache.
+  BlockCache::Pin<WriteOnceDecodedBlock> block_;
 
   uint64_t block_read_num_ = UINT64_MAX;
   uint64_t block_num_ = UINT64_MAX;
   uint32_t entry_num_ = UINT32_MAX;
-
-  DataBuffer read_buffer_;
-  DataBuffer decompress_buffer_;
-  // Decompression context.
-  Lz4Decompressor decompressor_;
 };
 
 /*****************************************************************************/
 
 class WriteOnceSeekableTable_v4 final : public WriteOnceSeekableTable {
  public:
+  // The rows end where the restart points begin, so that is where
+  // WriteOnceSeekableTable sees the end of the table.
   WriteOnceSeekableTable_v4(const std::string& path, kj::AutoCloseFd fd,
-                            const struct stat& st, uint64_t index_offset,
-                            TableCompression compression)
-      : WriteOnceSeekableTable(std::move(fd), st, index_offset),
-        index_cache_(index_) {
-    uint64_t size = st.st_size - index_offset_;
+                            const struct stat& st,
+                            const WriteOnceLayout& layout)
+      : WriteOnceSeekableTable(std::move(fd), st, layout.restarts_offset(),
+                               layout.data_offset),
+        shared_(std::make_shared<Shared>()),
+        index_(shared_->index),
+        index_cache_(shared_->cache) {
+    uint64_t size = st.st_size - layout.index_offset;
 
     DataBuffer read_buffer;
     read_buffer.resize(size);
-    FileIO(fd_).Read(read_buffer, index_offset_);
+    FileIO(fd_).Read(read_buffer, layout.index_offset);
 
-    if (compression == kTableCompressionNone) {
-      index_.Unmarshal(read_buffer);
+    if (layout.compression == kTableCompressionNone) {
+      shared_->index.Unmarshal(read_buffer, layout.front_coded());
     } else {
       DataBuffer decompress_buffer;
       decompress_buffer.reserve(1024*1024*256);
 
-      Lz4Decompressor decompressor;
-      decompressor.Go(decompress_buffer, read_buffer);
+      NewBlockCodec(layout.compression)
+          ->Decompress(decompress_buffer, read_buffer);
 
-      index_.Unmarshal(decompress_buffer);
+      shared_->index.Unmarshal(decompress_buffer, layout.front_coded());
     }
 
-    map_ = mmap(NULL, index_offset_, PROT_READ, MAP_SHARED, fd_, 0);
-    if (MAP_FAILED == map_) KJ_FAIL_SYSCALL("mmap", errno, path);
+    shared_->index.SetDataOffset(data_offset_);
+    shared_->cache.Initialize();
+
+    if (layout.restarts_size) InitializeRestarts(layout.restarts_size);
+
+    // The mapping covers the rows and their restart points.
+    const uint64_t map_size = index_offset_ + layout.restarts_size;
+    shared_->map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd_, 0);
+    if (MAP_FAILED == shared_->map) KJ_FAIL_SYSCALL("mmap", errno, path);
+    shared_->map_size = map_size;
+
+    map_ = shared_->map;
   }
 
-  virtual ~WriteOnceSeekableTable_v4() {
-    if (map_ != MAP_FAILED) munmap(map_, index_offset_);
+  // Creates a cursor sharing the memory map and block index of `table',
+  // positioned at the first row.
+  WriteOnceSeekableTable_v4(const WriteOnceSeekableTable_v4& table)
+      : WriteOnceSeekableTable(table),
+        shared_(table.shared_),
+        index_(shared_->index),
+        index_cache_(shared_->cache),
+        map_(shared_->map) {}
+
+  std::unique_ptr<SeekableTable> NewSeekableCursor() override {
+    return std::make_unique<WriteOnceSeekableTable_v4>(*this);
   }
 
   int IsSorted() override { return 1; }
 
+  uint64_t WarmUp(bool lock) override {
+    if (lock) LockVector(shared_->block_restarts);
+    return shared_->WarmUp(lock) +
+           shared_->block_restarts.size() * sizeof(uint64_t);
+  }
+
+  // Binary searches the restart points of the block that may hold `key', if
+  // the table has them, and then reads rows from the last restart point
+  // before `key'.
   bool SeekToKey(const string_view& key) override {
     uint64_t block_num = index_cache_.FindBlockByKey(key);
 
@@ -1133,6 +2366,8 @@ class WriteOnceSeekableTable_v4 final : public WriteOnceSeekableTable {
       const unsigned char* base = reinterpret_cast<unsigned char*>(map_);
       const unsigned char* ptr = base + index_cache_.GetBlockOffset(block_num);
       const unsigned char* end = base + index_offset_;
+      if (!shared_->block_restarts.empty())
+        ptr += FindRestart(block_num, ptr, key);
 
       while (ptr < end) {
         const unsigned char* start_ptr = ptr;
@@ -1169,6 +2404,8 @@ class WriteOnceSeekableTable_v4 final : public WriteOnceSeekableTable {
     value = string_view(reinterpret_cast<const char*>(ptr), v_size);
     ptr += v_size;
 
+    ThreadTableIOStats().bytes_read += ptr - (base + offset_);
+
     offset_ = ptr - base;
     KJ_REQUIRE(offset_ <= index_offset_);
 
@@ -1176,10 +2413,77 @@ class WriteOnceSeekableTable_v4 final : public WriteOnceSeekableTable {
   }
 
  private:
-  void* map_ = MAP_FAILED;
+  // State shared by all cursors of a table.
+  struct Shared : WriteOnceSharedIndex {
+    ~Shared() {
+      if (map != MAP_FAILED) munmap(map, map_size);
+    }
 
-  WriteOnceIndex index_;
-  WriteOnceIndex::Cache index_cache_;
+    void* map = MAP_FAILED;
+    size_t map_size = 0;
+
+    // The number of the first restart point of each block, followed by the
+    // number of restart points.  Empty if the table has none.
+    std::vector<uint64_t> block_restarts;
+  };
+
+  // Numbers the restart points of the blocks.  Each block has one for every
+  // WriteOnceBlock::kRestartInterval rows, starting with the first.
+  void InitializeRestarts(uint64_t restarts_size) {
+    auto& block_restarts = shared_->block_restarts;
+    block_restarts.resize(index_.num_blocks() + 1);
+    for (size_t i = 0; i < index_.num_blocks(); i++) {
+      const uint64_t num_entries = index_.GetNumEntries(i);
+      block_restarts[i + 1] =
+          block_restarts[i] +
+          (num_entries + WriteOnceBlock::kRestartInterval - 1) /
+              WriteOnceBlock::kRestartInterval;
+    }
+    KJ_REQUIRE(block_restarts.back() * sizeof(uint32_t) == restarts_size,
+               "corrupt restart points", restarts_size);
+  }
+
+  // Returns the offset within block `num', which starts at `block', of its
+  // last restart point whose key is less than `key', or zero if there is
+  // none.
+  size_t FindRestart(size_t num, const unsigned char* block,
+                     const string_view& key) const {
+    const auto restarts = reinterpret_cast<const unsigned char*>(map_) +
+                          index_offset_ +
+                          shared_->block_restarts[num] * sizeof(uint32_t);
+    const size_t block_size = index_.GetBlockSize(num);
+
+    auto restart_offset = [restarts, block_size](size_t i) {
+      uint32_t offset;
+      memcpy(&offset, restarts + i * sizeof(offset), sizeof(offset));
+      KJ_REQUIRE(offset < block_size, "corrupt restart point", offset);
+      return offset;
+    };
+
+    // Find the first restart point whose key is not less than `key'.  The
+    // first restart point is the start of the block, so it is skipped.
+    size_t left = 1;
+    size_t right =
+        shared_->block_restarts[num + 1] - shared_->block_restarts[num];
+    while (left < right) {
+      const size_t mid = left + (right - left) / 2;
+      const unsigned char* ptr = block + restart_offset(mid);
+      const uint32_t k_size = oroch::varint_codec<uint32_t>::value_decode(ptr);
+      oroch::varint_codec<uint32_t>::value_decode(ptr);
+      if (string_view(reinterpret_cast<const char*>(ptr), k_size) < key)
+        left = mid + 1;
+      else
+        right = mid;
+    }
+
+    return left == 1 ? 0 : restart_offset(left - 1);
+  }
+
+  std::shared_ptr<Shared> shared_;
+  const WriteOnceIndex& index_;
+  const WriteOnceIndex::Cache& index_cache_;
+
+  void* map_ = MAP_FAILED;
 };
 
 /*****************************************************************************/
@@ -1200,16 +2504,46 @@ class WriteOnceTable_v3 final : public WriteOnceSeekableTable {
     MemoryMap(path);
   }
 
-  virtual ~WriteOnceTable_v3() {
-    if (buffer_ != MAP_FAILED) munmap(buffer_, buffer_size_);
+  // Creates a cursor sharing the memory map of `table', positioned at the
+  // first row.
+  WriteOnceTable_v3(const WriteOnceTable_v3& table)
+      : WriteOnceSeekableTable(table),
+        mapping_(table.mapping_),
+        buffer_(table.buffer_),
+        buffer_size_(table.buffer_size_),
+        buffer_fill_(table.buffer_fill_),
+        header_(table.header_),
+        index_(table.index_),
+        index_size_(table.index_size_),
+        index_bits_(table.index_bits_) {}
+
+  std::unique_ptr<SeekableTable> NewSeekableCursor() override {
+    return std::make_unique<WriteOnceTable_v3>(*this);
   }
 
   int IsSorted() override {
     return 0 != (header_->flags & CA_WO_FLAG_ASCENDING);
   }
 
+  // Pages in the hash table.  The rows are left alone.
+  uint64_t WarmUp(bool lock) override {
+    if (!mapping_->index_advised.load(std::memory_order_relaxed))
+      MAdviseIndex();
+
+    const auto index = reinterpret_cast<char*>(buffer_) + header_->index_offset;
+    const auto size = buffer_fill_ - header_->index_offset;
+
+    if (lock)
+      KJ_SYSCALL(mlock(index, size));
+    else
+      FaultIn(index, size);
+
+    return size;
+  }
+
   bool SeekToKey(const string_view& key) override {
-    if (!has_madvised_index_) MAdviseIndex();
+    if (!mapping_->index_advised.load(std::memory_order_relaxed))
+      MAdviseIndex();
 
     uint64_t hash, tmp_offset;
 
@@ -1310,6 +2644,8 @@ class WriteOnceTable_v3 final : public WriteOnceSeekableTable {
       KJ_FAIL_SYSCALL("mmap", errno, path);
     }
 
+    mapping_ = std::make_shared<Mapping>(buffer_, buffer_size_);
+
     header_ = (struct CA_wo_header*)buffer_;
 
     if (header_->major_version >= 3)
@@ -1337,9 +2673,24 @@ class WriteOnceTable_v3 final : public WriteOnceSeekableTable {
     KJ_SYSCALL(
         madvise(reinterpret_cast<void*>(base), end - base, MADV_WILLNEED), base,
         end, (ptrdiff_t)buffer_, buffer_size_);
-    has_madvised_index_ = true;
+    mapping_->index_advised.store(true, std::memory_order_relaxed);
   }
 
+  // The mmap()-ed file, shared by all cursors of the table.
+  struct Mapping {
+    Mapping(void* data, size_t size) : data(data), size(size) {}
+
+    ~Mapping() { munmap(data, size); }
+
+    void* const data;
+    const size_t size;
+
+    // Concurrent cursors may both advise the kernel, which is harmless.
+    std::atomic<bool> index_advised{false};
+  };
+
+  std::shared_ptr<Mapping> mapping_;
+
   // Entire mmap()-ed file.
   void* buffer_ = MAP_FAILED;
   size_t buffer_size_ = 0, buffer_fill_ = 0;
@@ -1354,27 +2705,60 @@ class WriteOnceTable_v3 final : public WriteOnceSeekableTable {
 
   uint64_t index_size_ = 0;
   unsigned int index_bits_ = 0;
-
-  bool has_madvised_index_ = false;
 };
 
 /*****************************************************************************/
 
-void ReadHeader(struct CA_wo_header& header, int fd) {
+// Reads the header of a table, and returns the layout of the table.
+WriteOnceLayout ReadHeader(struct CA_wo_header& header, int fd) {
   FileIO(fd).Read(&header, sizeof header);
   KJ_REQUIRE(header.magic == MAGIC, header.magic, MAGIC);
   KJ_REQUIRE(header.major_version <= MAJOR_VERSION ||
              header.major_version >= 2);
 
+  WriteOnceLayout result;
+  result.minor_version = header.minor_version;
+  result.index_offset = header.index_offset;
+
   if (header.major_version <= 3) {
     KJ_REQUIRE(header.compression == 0, "unsupported compression method",
                header.compression);
-  } else {
-    KJ_REQUIRE(header.compression <= kTableCompressionLast,
-               "unsupported compression method", header.compression);
-    if ((header.flags & CA_WO_FLAG_EXTENDED) != 0)
-      KJ_UNIMPLEMENTED("extended write-once tables are not supported yet");
-  }
+    return result;
+  }
+
+  KJ_REQUIRE(header.minor_version <= MINOR_VERSION,
+             "unsupported write-once table version", header.major_version,
+             header.minor_version);
+  KJ_REQUIRE(header.compression <= kTableCompressionLast,
+             "unsupported compression method", header.compression);
+  result.compression = TableCompression(header.compression);
+
+  if ((header.flags & CA_WO_FLAG_DICTIONARY) != 0)
+    result.dictionary_size = header.data_reserved;
+
+  if ((header.flags & CA_WO_FLAG_EXTENDED) != 0) {
+    // Extensions written by older versions lack the later fields, which are
+    // then zero.
+    struct CA_wo_header_ext header_ext;
+    memset(&header_ext, 0, sizeof header_ext);
+    FileIO(fd).Read(&header_ext.size, sizeof header_ext.size);
+    KJ_REQUIRE(header_ext.size >= sizeof header_ext.size &&
+                   header_ext.size <= header.index_offset,
+               "corrupt extended header", header_ext.size);
+    FileIO(fd).Read(&header_ext.block_size,
+                    std::min<size_t>(header_ext.size, sizeof header_ext) -
+                        sizeof header_ext.size);
+    result.data_offset = sizeof(header) + header_ext.size;
+    result.filter_size = header_ext.filter_size;
+    result.restarts_size = header_ext.restarts_size;
+  }
+
+  KJ_REQUIRE(result.data_offset + result.restarts_size + result.filter_size +
+                     result.dictionary_size <=
+                 result.index_offset,
+             "corrupt table layout");
+
+  return result;
 }
 
 }  // namespace
@@ -1392,25 +2776,23 @@ std::unique_ptr<Table> WriteOnceTableBackend::Open(const char* path,
                                                    kj::AutoCloseFd fd,
                                                    const struct stat& st) {
   struct CA_wo_header header;
-  ReadHeader(header, fd);
+  const auto layout = ReadHeader(header, fd);
 
   if (header.major_version <= 3)
     return std::make_unique<WriteOnceTable_v3>(path, std::move(fd), st,
                                                header.index_offset);
 
-  TableCompression compression = TableCompression(header.compression);
   if ((header.flags & CA_WO_FLAG_SEEKABLE) == 0)
-    return std::make_unique<WriteOnceTable_v4>(
-        std::move(fd), st, header.index_offset, compression);
+    return std::make_unique<WriteOnceTable_v4>(std::move(fd), st, layout);
 
-  return std::make_unique<WriteOnceSeekableTable_v4>(
-      path, std::move(fd), st, header.index_offset, compression);
+  return std::make_unique<WriteOnceSeekableTable_v4>(path, std::move(fd), st,
+                                                     layout);
 }
 
 std::unique_ptr<SeekableTable> WriteOnceTableBackend::OpenSeekable(
     const char* path, kj::AutoCloseFd fd, const struct stat& st) {
   struct CA_wo_header header;
-  ReadHeader(header, fd);
+  const auto layout = ReadHeader(header, fd);
 
   if (header.major_version <= 3)
     return std::make_unique<WriteOnceTable_v3>(path, std::move(fd), st,
@@ -1419,9 +2801,8 @@ std::unique_ptr<SeekableTable> WriteOnceTableBackend::OpenSeekable(
   if ((header.flags & CA_WO_FLAG_SEEKABLE) == 0)
     KJ_FAIL_REQUIRE("the write-once table is not seekable", path);
 
-  TableCompression compression = TableCompression(header.compression);
-  return std::make_unique<WriteOnceSeekableTable_v4>(
-      path, std::move(fd), st, header.index_offset, compression);
+  return std::make_unique<WriteOnceSeekableTable_v4>(path, std::move(fd), st,
+                                                     layout);
 }
 
 }  // namespace internal
@@ -0,0 +1,131 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "src/ca-table.h"
+
+namespace ca_table = cantera::table;
+
+namespace {
+
+// Index keys, in sorted order.
+std::string MakeKey(size_t i) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "name:%010zu", i);
+  return buffer;
+}
+
+// Values of varying length, about as compressible as index offset lists.
+std::string MakeValue(std::mt19937& rng) {
+  std::string result;
+  const size_t count = 1 + rng() % 64;
+  for (size_t i = 0; i < count; ++i) {
+    result += std::to_string(rng() % 100000);
+    result += ',';
+  }
+  return result;
+}
+
+template <typename Function>
+double Measure(Function&& f) {
+  const auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+}  // namespace
+
+// Usage: table-backend-writeonce_benchmark [ROWS] [LOOKUPS] [CACHE-MB]
+//
+// Builds the same table with a range of block sizes, with and without
+// compression, and measures random point lookups and full scans.  The block
+// cache is disabled by default, so that every lookup decodes a block.
+int main(int argc, char** argv) {
+  const size_t rows = (argc > 1) ? strtoul(argv[1], nullptr, 0) : 1000000;
+  const size_t lookups = (argc > 2) ? strtoul(argv[2], nullptr, 0) : 200000;
+  const size_t cache_mb = (argc > 3) ? strtoul(argv[3], nullptr, 0) : 0;
+
+  ca_table::SetBlockCacheCapacity(cache_mb << 20);
+
+  char directory[] = "/tmp/ca-table-benchmark-XXXXXX";
+  if (!mkdtemp(directory)) {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+  const std::string path = std::string(directory) + "/table";
+
+  printf("%-6s %-10s %10s %10s %12s %12s\n", "Codec", "Block size",
+         "Build (s)", "Size (MB)", "Lookups/s", "Scan (MB/s)");
+
+  for (const auto compression :
+       {ca_table::kTableCompressionNone, ca_table::kTableCompressionZSTD}) {
+    for (const size_t block_size :
+         {1024, 4096, 16384, 32768, 65536, 262144}) {
+      std::mt19937 rng(1);
+      uint64_t data_size = 0;
+
+      const auto build_time = Measure([&] {
+        auto builder = ca_table::TableFactory::Create(
+            "write-once", path.c_str(), ca_table::TableOptions()
+                                            .SetCompression(compression)
+                                            .SetBlockSize(block_size)
+                                            .SetNoFSync());
+        for (size_t i = 0; i < rows; ++i) {
+          const auto key = MakeKey(i);
+          const auto value = MakeValue(rng);
+          data_size += key.size() + value.size();
+          builder->InsertRow(key, value);
+        }
+        builder->Sync();
+      });
+
+      struct stat st;
+      if (-1 == stat(path.c_str(), &st)) {
+        perror("stat");
+        return EXIT_FAILURE;
+      }
+
+      auto table = ca_table::TableFactory::Open("write-once", path.c_str());
+
+      size_t found = 0;
+      const auto lookup_time = Measure([&] {
+        std::mt19937 lookup_rng(2);
+        cantera::string_view key, value;
+        for (size_t i = 0; i < lookups; ++i) {
+          if (table->SeekToKey(MakeKey(lookup_rng() % rows)) &&
+              table->ReadRow(key, value))
+            ++found;
+        }
+      });
+
+      const auto scan_time = Measure([&] {
+        auto cursor = table->NewCursor();
+        cantera::string_view key, value;
+        while (cursor->ReadRow(key, value)) ++found;
+      });
+
+      printf("%-6s %-10zu %10.2f %10.1f %12.0f %12.1f\n",
+             compression == ca_table::kTableCompressionNone ? "none" : "zstd",
+             block_size, build_time, st.st_size / 1048576.0,
+             lookups / lookup_time, data_size / 1048576.0 / scan_time);
+
+      if (found != lookups + rows) {
+        fprintf(stderr, "Expected %zu rows, found %zu\n", lookups + rows,
+                found);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  unlink(path.c_str());
+  rmdir(directory);
+}
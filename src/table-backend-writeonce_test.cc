@@ -1,6 +1,12 @@
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <vector>
+
 #include "src/ca-table.h"
 #include "third_party/gtest/gtest.h"
 
@@ -9,6 +15,18 @@
 using namespace cantera::table;
 static constexpr char name_template[] = "/tmp/ca-table-test-XXXXXX";
 
+// Inserts the two-letter keys from "aa" to "zz", in order, with the values
+// `make_value' returns for them.
+template <typename MakeValue>
+void InsertTwoLetterKeys(TableBuilder& builder, MakeValue make_value) {
+  char str[3];
+  str[2] = 0;
+  for (str[0] = 'a'; str[0] <= 'z'; ++str[0]) {
+    for (str[1] = 'a'; str[1] <= 'z'; ++str[1])
+      builder.InsertRow(str, make_value(str));
+  }
+}
+
 struct WriteOnceTest : testing::Test {
 
  public:
@@ -56,13 +74,8 @@ TEST_F(WriteOnceTest, CanWriteThenRead) {
 TEST_F(WriteOnceTest, CanWriteThenReadMany) {
   auto builder = TableFactory::Create(
       "write-once", (temp_directory_ + "/table_00").c_str(), TableOptions());
-  char str[3];
-  str[2] = 0;
-  for (str[0] = 'a'; str[0] <= 'z'; ++str[0]) {
-    for (str[1] = 'a'; str[1] <= 'z'; ++str[1]) {
-      builder->InsertRow(str, "xxx");
-    }
-  }
+  InsertTwoLetterKeys(*builder,
+                      [](const std::string&) { return std::string("xxx"); });
 
   builder->Sync();
   builder.reset();
@@ -71,6 +84,8 @@ TEST_F(WriteOnceTest, CanWriteThenReadMany) {
       TableFactory::Open("write-once", (temp_directory_ + "/table_00").c_str());
   EXPECT_TRUE(table_handle->IsSorted());
 
+  char str[3];
+  str[2] = 0;
   for (str[0] = 'a'; str[0] <= 'z'; ++str[0]) {
     for (str[1] = 'a'; str[1] <= 'z'; ++str[1]) {
       EXPECT_EQ(1, table_handle->SeekToKey(str));
@@ -111,6 +126,631 @@ TEST_F(WriteOnceTest, CanWriteThenReadUnsorted) {
   EXPECT_TRUE(table_handle->SeekToKey("b"));
 }
 
+// Input larger than the sort buffer is sorted in runs, which are merged.  The
+// runs are too many to merge at once within the sort buffer, so they are
+// merged in several passes.
+TEST_F(WriteOnceTest, CanWriteThenReadUnsortedRuns) {
+  const auto path = temp_directory_ + "/table_00";
+  auto builder = TableFactory::Create(
+      "write-once", path.c_str(),
+      TableOptions().SetInputUnsorted(true).SetSortBufferSize(4096));
+  // Keys sharing a long prefix, in pseudo-random order.
+  const std::string prefix(40, 'k');
+  const size_t count = 10007;
+  for (size_t i = 0; i < count; ++i) {
+    const size_t n = i * 7919 % count;
+    builder->InsertRow(prefix + std::to_string(100000 + n), std::to_string(n));
+  }
+  builder->InsertRow("", "empty");
+  builder->Sync();
+  builder.reset();
+
+  auto table_handle = TableFactory::Open("write-once", path.c_str());
+  EXPECT_TRUE(table_handle->IsSorted());
+
+  cantera::string_view key, value;
+  ASSERT_TRUE(table_handle->ReadRow(key, value));
+  EXPECT_EQ("", key);
+  EXPECT_EQ("empty", value);
+  for (size_t n = 0; n < count; ++n) {
+    ASSERT_TRUE(table_handle->ReadRow(key, value));
+    EXPECT_EQ(prefix + std::to_string(100000 + n), key);
+    EXPECT_EQ(std::to_string(n), value);
+  }
+  EXPECT_FALSE(table_handle->ReadRow(key, value));
+}
+
+TEST_F(WriteOnceTest, CursorsAreIndependent) {
+  auto builder = TableFactory::Create(
+      "write-once", (temp_directory_ + "/table_00").c_str(), TableOptions());
+  builder->InsertRow("a", "xxx");
+  builder->InsertRow("b", "yyy");
+  builder->InsertRow("c", "zzz");
+  builder->Sync();
+  builder.reset();
+
+  auto table_handle =
+      TableFactory::Open("write-once", (temp_directory_ + "/table_00").c_str());
+  EXPECT_TRUE(table_handle->SeekToKey("c"));
+
+  auto cursor = table_handle->NewCursor();
+  table_handle.reset();
+
+  cantera::string_view key, value;
+  ASSERT_TRUE(cursor->ReadRow(key, value));
+  EXPECT_EQ("a", key);
+  EXPECT_EQ("xxx", value);
+
+  EXPECT_TRUE(cursor->SeekToKey("b"));
+  auto other_cursor = cursor->NewCursor();
+  ASSERT_TRUE(other_cursor->ReadRow(key, value));
+  EXPECT_EQ("a", key);
+  ASSERT_TRUE(cursor->ReadRow(key, value));
+  EXPECT_EQ("b", key);
+}
+
+TEST_F(WriteOnceTest, ConcurrentCursors) {
+  auto builder = TableFactory::Create(
+      "write-once", (temp_directory_ + "/table_00").c_str(), TableOptions());
+  InsertTwoLetterKeys(*builder, [](const std::string& key) { return key; });
+  builder->Sync();
+  builder.reset();
+
+  auto table_handle =
+      TableFactory::Open("write-once", (temp_directory_ + "/table_00").c_str());
+
+  std::vector<std::thread> threads;
+  std::vector<size_t> found(4);
+  for (size_t i = 0; i < found.size(); ++i) {
+    threads.emplace_back([&table_handle, &found, i] {
+      auto cursor = table_handle->NewCursor();
+      char key[3];
+      key[2] = 0;
+      for (key[0] = 'z'; key[0] >= 'a'; --key[0]) {
+        for (key[1] = 'a'; key[1] <= 'z'; ++key[1]) {
+          cantera::string_view row_key, value;
+          if (cursor->SeekToKey(key) && cursor->ReadRow(row_key, value) &&
+              value == key)
+            ++found[i];
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  for (const auto count : found) EXPECT_EQ(26U * 26U, count);
+}
+
+TEST_F(WriteOnceTest, LookupKeysFindsKeysInManyBlocks) {
+  auto builder = TableFactory::Create(
+      "write-once", (temp_directory_ + "/table_00").c_str(), TableOptions());
+  const std::string filler(1000, 'x');
+  InsertTwoLetterKeys(*builder,
+                      [&](const std::string& key) { return key + filler; });
+  builder->Sync();
+  builder.reset();
+
+  auto table_handle =
+      TableFactory::Open("write-once", (temp_directory_ + "/table_00").c_str());
+
+  const std::vector<cantera::string_view> keys{"zz", "aa", "a", "mm", "zzz",
+                                               "aa"};
+  std::vector<std::string> values(keys.size());
+  table_handle->LookupKeys(
+      keys, [&values](size_t i, const cantera::string_view& value) {
+        values[i] = value.to_string();
+      });
+
+  EXPECT_EQ("zz" + filler, values[0]);
+  EXPECT_EQ("aa" + filler, values[1]);
+  EXPECT_EQ("", values[2]);
+  EXPECT_EQ("mm" + filler, values[3]);
+  EXPECT_EQ("", values[4]);
+  EXPECT_EQ("aa" + filler, values[5]);
+}
+
+// Uncompressed tables, the default, use their blocks in place, while
+// compressed tables decode copies of them.
+TEST_F(WriteOnceTest, CompressedAndUncompressedTablesMatch) {
+  const std::string filler(1000, 'x');
+  const std::vector<std::pair<TableCompression, uint8_t>> methods{
+      {kTableCompressionNone, 0}, {kTableCompressionLZ4, 0},
+      {kTableCompressionLZ4, 9},  {kTableCompressionZSTD, 0},
+      {kTableCompressionZSTD, 19}};
+  for (size_t method = 0; method < methods.size(); ++method) {
+    const auto path = temp_directory_ + "/table_" + std::to_string(method);
+    auto builder = TableFactory::Create(
+        "write-once", path.c_str(),
+        TableOptions()
+            .SetCompression(methods[method].first)
+            .SetCompressionLevel(methods[method].second));
+    InsertTwoLetterKeys(*builder,
+                      [&](const std::string& key) { return key + filler; });
+    builder->Sync();
+    builder.reset();
+
+    auto table_handle = TableFactory::Open("write-once", path.c_str());
+
+    cantera::string_view key, value;
+    ASSERT_TRUE(table_handle->SeekToKey("mm"));
+    ASSERT_TRUE(table_handle->ReadRow(key, value));
+    EXPECT_EQ("mm", key);
+    EXPECT_EQ("mm" + filler, value);
+    ASSERT_TRUE(table_handle->ReadRow(key, value));
+    EXPECT_EQ("mn", key);
+
+    const std::vector<cantera::string_view> keys{"zz", "ab"};
+    std::vector<std::string> values(keys.size());
+    table_handle->LookupKeys(
+        keys, [&values](size_t i, const cantera::string_view& value) {
+          values[i] = value.to_string();
+        });
+    EXPECT_EQ("zz" + filler, values[0]);
+    EXPECT_EQ("ab" + filler, values[1]);
+  }
+}
+
+TEST_F(WriteOnceTest, HigherCompressionLevelsAreSmaller) {
+  std::vector<off_t> sizes;
+  for (const uint8_t level : {1, 19}) {
+    const auto path = temp_directory_ + "/table_" + std::to_string(level);
+    const auto options = TableOptions()
+                             .SetCompression(kTableCompressionZSTD)
+                             .SetCompressionLevel(level);
+    auto builder = TableFactory::Create("write-once", path.c_str(), options);
+    // Highly regular values can compress better at low levels, so the links
+    // are pseudo-random.
+    uint32_t state = 1;
+    for (size_t i = 0; i < 10000; ++i) {
+      const auto key = std::to_string(100000 + i);
+      std::string links;
+      for (size_t j = 0; j < 8; ++j) {
+        state = state * 1103515245 + 12345;
+        links += std::to_string(state >> 20) + ",";
+      }
+      builder->InsertRow(
+          key, "{\"name\":\"" + key + "\",\"links\":[" + links + "]}");
+    }
+    builder->Sync();
+    builder.reset();
+
+    struct stat st;
+    ASSERT_EQ(0, stat(path.c_str(), &st));
+    sizes.push_back(st.st_size);
+  }
+
+  EXPECT_LT(sizes[1], sizes[0]);
+}
+
+TEST_F(WriteOnceTest, CompressionDictionary) {
+  const auto path = temp_directory_ + "/table_00";
+  const auto options = TableOptions()
+                           .SetCompression(kTableCompressionZSTD)
+                           .SetCompressionDictionarySize(4096);
+  auto builder = TableFactory::Create("write-once", path.c_str(), options);
+  auto make_value = [](size_t i) {
+    return "{\"name\":\"item " + std::to_string(i) + "\",\"links\":[\"links:" +
+           std::to_string(i * 7 % 1000) + "\"]}";
+  };
+  for (size_t i = 0; i < 30000; ++i)
+    builder->InsertRow("name:" + std::to_string(100000 + i), make_value(i));
+  builder->Sync();
+
+  const auto stats = builder->GetCompressionStats();
+  builder.reset();
+
+  EXPECT_GT(stats.dictionary_bytes, 0U);
+  EXPECT_LE(stats.dictionary_bytes, 4096U);
+  EXPECT_LT(stats.compressed_bytes, stats.uncompressed_bytes);
+
+  auto table_handle = TableFactory::Open("write-once", path.c_str());
+  for (const size_t i : {0, 12345, 29999}) {
+    cantera::string_view key, value;
+    ASSERT_TRUE(table_handle->SeekToKey("name:" + std::to_string(100000 + i)));
+    ASSERT_TRUE(table_handle->ReadRow(key, value));
+    EXPECT_EQ(make_value(i), value);
+  }
+}
+
+// Blocks compressed by worker threads are written in order, so the table is
+// the same whatever the number of threads.
+TEST_F(WriteOnceTest, ParallelCompression) {
+  auto make_value = [](size_t i) {
+    return "{\"name\":\"item " + std::to_string(i) + "\",\"links\":[\"links:" +
+           std::to_string(i * 7 % 1000) + "\"]}";
+  };
+  auto read_file = [](const std::string& path) {
+    std::ifstream input(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(input), {});
+  };
+
+  for (const size_t dictionary_size : {0, 4096}) {
+    std::vector<std::string> tables;
+    for (const size_t threads : {1, 4}) {
+      const auto path = temp_directory_ + "/table_" + std::to_string(threads);
+      auto builder = TableFactory::Create(
+          "write-once", path.c_str(),
+          TableOptions()
+              .SetCompression(kTableCompressionZSTD)
+              .SetCompressionDictionarySize(dictionary_size)
+              .SetCompressionThreads(threads)
+              .SetBlockSize(4096));
+      for (size_t i = 0; i < 30000; ++i)
+        builder->InsertRow("name:" + std::to_string(100000 + i), make_value(i));
+      builder->Sync();
+      builder.reset();
+
+      auto table_handle = TableFactory::Open("write-once", path.c_str());
+      for (const size_t i : {0, 12345, 29999}) {
+        cantera::string_view key, value;
+        ASSERT_TRUE(
+            table_handle->SeekToKey("name:" + std::to_string(100000 + i)));
+        ASSERT_TRUE(table_handle->ReadRow(key, value));
+        EXPECT_EQ(make_value(i), value);
+      }
+
+      tables.emplace_back(read_file(path));
+    }
+
+    EXPECT_FALSE(tables[0].empty());
+    EXPECT_TRUE(tables[0] == tables[1]) << dictionary_size;
+  }
+}
+
+// Readers from before v4.1 ignore the minor version, but reject tables with a
+// header extension, which v4.1 tables therefore always have.
+TEST_F(WriteOnceTest, FrontCodedTablesAreExtended) {
+  for (const bool seekable : {false, true}) {
+    const auto path = temp_directory_ + "/table_" + std::to_string(seekable);
+    auto builder = TableFactory::Create(
+        "write-once", path.c_str(), TableOptions().SetOutputSeekable(seekable));
+    builder->InsertRow("a", "xxx");
+    builder->Sync();
+    builder.reset();
+
+    // The magic number, then the major and minor versions and the flags.
+    uint8_t header[11];
+    const int fd = open(path.c_str(), O_RDONLY);
+    ASSERT_NE(-1, fd);
+    ASSERT_EQ(ssize_t(sizeof(header)), read(fd, header, sizeof(header)));
+    close(fd);
+    EXPECT_EQ(4, header[8]);
+    EXPECT_EQ(1, header[9]);
+    EXPECT_NE(0, header[10] & 0x02);
+
+    auto table_handle = TableFactory::Open("write-once", path.c_str());
+    EXPECT_TRUE(table_handle->SeekToKey("a"));
+  }
+}
+
+// Keys are front-coded in non-seekable blocks and in the block index, so
+// long shared prefixes take little space.
+TEST_F(WriteOnceTest, FrontCodedKeys) {
+  const std::string prefix(200, 'k');
+  for (const auto compression : {kTableCompressionNone, kTableCompressionLZ4}) {
+    const auto path = temp_directory_ + "/table_" + std::to_string(compression);
+    auto builder = TableFactory::Create(
+        "write-once", path.c_str(),
+        TableOptions().SetCompression(compression).SetBlockSize(1024));
+    size_t key_bytes = 0;
+    for (size_t i = 0; i < 5000; ++i) {
+      const auto key = prefix + std::to_string(100000 + 2 * i);
+      key_bytes += key.size();
+      builder->InsertRow(key, std::to_string(i));
+    }
+    builder->Sync();
+    builder.reset();
+
+    struct stat st;
+    ASSERT_EQ(0, stat(path.c_str(), &st));
+    EXPECT_LT(st.st_size, key_bytes / 4);
+
+    auto table_handle = TableFactory::Open("write-once", path.c_str());
+    cantera::string_view key, value;
+    for (size_t i = 0; i < 5000; i += 13) {
+      const auto row_key = prefix + std::to_string(100000 + 2 * i);
+      ASSERT_TRUE(table_handle->SeekToKey(row_key));
+      ASSERT_TRUE(table_handle->ReadRow(key, value));
+      EXPECT_EQ(std::to_string(i), value);
+      ASSERT_TRUE(table_handle->ReadRow(key, value));
+      EXPECT_EQ(prefix + std::to_string(100000 + 2 * i + 2), key);
+    }
+    EXPECT_FALSE(table_handle->SeekToKey(prefix + "100001"));
+    EXPECT_FALSE(table_handle->SeekToKey(prefix));
+
+    size_t count = 0;
+    std::string last_key;
+    table_handle->SeekToFirst();
+    while (table_handle->ReadRow(key, value)) {
+      EXPECT_LT(last_key, key.to_string());
+      last_key = key.to_string();
+      ++count;
+    }
+    EXPECT_EQ(5000U, count);
+  }
+}
+
+TEST_F(WriteOnceTest, CustomBlockSizes) {
+  for (const bool seekable : {false, true}) {
+    for (const size_t block_size : {1024, 32 * 1024, 256 * 1024}) {
+      const auto path = temp_directory_ + "/table_" + std::to_string(seekable) +
+                        "_" + std::to_string(block_size);
+      auto builder = TableFactory::Create("write-once", path.c_str(),
+                                          TableOptions()
+                                              .SetBlockSize(block_size)
+                                              .SetOutputSeekable(seekable));
+      for (size_t i = 0; i < 5000; ++i)
+        builder->InsertRow(std::to_string(100000 + i), std::to_string(i));
+      builder->Sync();
+      builder.reset();
+
+      auto table_handle = TableFactory::Open("write-once", path.c_str());
+      cantera::string_view key, value;
+      for (const size_t i : {0, 1234, 4999}) {
+        ASSERT_TRUE(table_handle->SeekToKey(std::to_string(100000 + i)));
+        ASSERT_TRUE(table_handle->ReadRow(key, value));
+        EXPECT_EQ(std::to_string(i), value);
+      }
+
+      size_t count = 0;
+      table_handle->SeekToFirst();
+      while (table_handle->ReadRow(key, value)) ++count;
+      EXPECT_EQ(5000U, count);
+
+      if (seekable) {
+        auto seekable_handle =
+            TableFactory::OpenSeekable("write-once", path.c_str());
+        EXPECT_EQ(0, seekable_handle->Offset());
+        ASSERT_TRUE(seekable_handle->ReadRow(key, value));
+        EXPECT_EQ("100000", key);
+      }
+    }
+  }
+}
+
+// Seekable tables record restart points within their blocks, so that seeks
+// binary search blocks instead of reading them from the start.
+TEST_F(WriteOnceTest, SeekableTableSeeksToRowOffsets) {
+  const auto path = temp_directory_ + "/table_00";
+  auto builder = TableFactory::Create(
+      "write-once", path.c_str(),
+      TableOptions().SetOutputSeekable().SetBlockSize(4096));
+  for (size_t i = 0; i < 5000; ++i) {
+    builder->InsertRow(std::to_string(100000 + 2 * i),
+                       std::string(i % 40, 'v'));
+  }
+  builder->Sync();
+  builder.reset();
+
+  auto table_handle = TableFactory::OpenSeekable("write-once", path.c_str());
+
+  std::vector<off_t> offsets;
+  cantera::string_view key, value;
+  for (;;) {
+    offsets.push_back(table_handle->Offset());
+    if (!table_handle->ReadRow(key, value)) break;
+  }
+  ASSERT_EQ(5001U, offsets.size());
+
+  for (size_t i = 0; i < 5000; ++i) {
+    ASSERT_TRUE(table_handle->SeekToKey(std::to_string(100000 + 2 * i)));
+    EXPECT_EQ(offsets[i], table_handle->Offset());
+    ASSERT_FALSE(table_handle->SeekToKey(std::to_string(100000 + 2 * i + 1)));
+    EXPECT_EQ(offsets[i + 1], table_handle->Offset());
+  }
+
+  EXPECT_FALSE(table_handle->SeekToKey("0"));
+  EXPECT_EQ(0, table_handle->Offset());
+  EXPECT_FALSE(table_handle->SeekToKey("2"));
+  EXPECT_EQ(offsets.back(), table_handle->Offset());
+}
+
+TEST_F(WriteOnceTest, InvalidBlockSizeThrows) {
+  ASSERT_THROW(TableFactory::Create("write-once",
+                                    (temp_directory_ + "/table_00").c_str(),
+                                    TableOptions().SetBlockSize(16)),
+               kj::Exception);
+}
+
+TEST_F(WriteOnceTest, BloomFilter) {
+  for (const size_t block_size : {0, 1024}) {
+    const auto path = temp_directory_ + "/table_" + std::to_string(block_size);
+    auto builder = TableFactory::Create(
+        "write-once", path.c_str(),
+        TableOptions()
+            .SetCompression(kTableCompressionZSTD)
+            .SetCompressionDictionarySize(block_size ? 4096 : 0)
+            .SetBlockSize(block_size)
+            .SetBloomFilterFalsePositiveRate(0.01));
+    for (size_t i = 0; i < 5000; ++i)
+      builder->InsertRow(std::to_string(100000 + 2 * i), std::to_string(i));
+    builder->Sync();
+    builder.reset();
+
+    auto table_handle = TableFactory::Open("write-once", path.c_str());
+    cantera::string_view key, value;
+    for (size_t i = 0; i < 5000; i += 7) {
+      ASSERT_TRUE(table_handle->SeekToKey(std::to_string(100000 + 2 * i)));
+      ASSERT_TRUE(table_handle->ReadRow(key, value));
+      EXPECT_EQ(std::to_string(i), value);
+    }
+    EXPECT_FALSE(table_handle->SeekToKey("100001"));
+    EXPECT_FALSE(table_handle->SeekToKey("x"));
+
+    const std::vector<cantera::string_view> keys{"109998", "100003", "100000",
+                                                 "104001"};
+    std::vector<std::string> values(keys.size());
+    table_handle->LookupKeys(
+        keys, [&values](size_t i, const cantera::string_view& value) {
+          values[i] = value.to_string();
+        });
+    EXPECT_EQ("4999", values[0]);
+    EXPECT_EQ("", values[1]);
+    EXPECT_EQ("0", values[2]);
+    EXPECT_EQ("", values[3]);
+
+    size_t count = 0;
+    table_handle->SeekToFirst();
+    while (table_handle->ReadRow(key, value)) ++count;
+    EXPECT_EQ(5000U, count);
+  }
+
+  ASSERT_THROW(TableFactory::Create("write-once",
+                                    (temp_directory_ + "/table_s").c_str(),
+                                    TableOptions()
+                                        .SetOutputSeekable()
+                                        .SetBloomFilterFalsePositiveRate(0.01)),
+               kj::Exception);
+}
+
+// Seeks to keys the Bloom filter rejects leave the cursor before the next
+// larger key, which prefix scans rely on.
+TEST_F(WriteOnceTest, BloomFilterSeekKeepsPosition) {
+  const auto path = temp_directory_ + "/table_00";
+  auto builder = TableFactory::Create(
+      "write-once", path.c_str(),
+      TableOptions().SetBlockSize(1024).SetBloomFilterFalsePositiveRate(0.01));
+  const std::string filler(100, 'x');
+  InsertTwoLetterKeys(*builder,
+                      [&](const std::string& key) { return key + filler; });
+  builder->Sync();
+  builder.reset();
+
+  auto table_handle = TableFactory::Open("write-once", path.c_str());
+
+  size_t filtered = 0;
+  for (char c = 'a'; c <= 'z'; ++c) {
+    for (const auto& suffix : {"", "a0", "m0", "zz"}) {
+      const std::string sought = std::string(1, c) + suffix;
+      // The next larger two-letter key, if any.
+      std::string expected;
+      if (sought.size() < 2)
+        expected = sought + "a";
+      else if (sought[1] < 'z')
+        expected = std::string{c, char(sought[1] + 1)};
+      else if (c < 'z')
+        expected = std::string{char(c + 1), 'a'};
+
+      auto cursor = table_handle->NewCursor();
+      const auto before = ThreadTableIOStats();
+      EXPECT_FALSE(cursor->SeekToKey(sought));
+      const auto after = ThreadTableIOStats();
+      if (after.block_cache_hits + after.block_cache_misses ==
+          before.block_cache_hits + before.block_cache_misses)
+        ++filtered;
+
+      cantera::string_view key, value;
+      bool found = false;
+      while (cursor->ReadRow(key, value)) {
+        if (key < sought) continue;
+        found = true;
+        break;
+      }
+      if (expected.empty()) {
+        EXPECT_FALSE(found) << sought;
+      } else {
+        ASSERT_TRUE(found) << sought;
+        EXPECT_EQ(expected, key) << sought;
+        EXPECT_EQ(expected + filler, value);
+      }
+    }
+  }
+  EXPECT_GT(filtered, 0U);
+}
+
+TEST_F(WriteOnceTest, BlockCacheIsSharedByCursors) {
+  auto builder = TableFactory::Create(
+      "write-once", (temp_directory_ + "/table_00").c_str(), TableOptions());
+  const std::string filler(1000, 'x');
+  InsertTwoLetterKeys(*builder,
+                      [&](const std::string& key) { return key + filler; });
+  builder->Sync();
+  builder.reset();
+
+  auto table_handle =
+      TableFactory::Open("write-once", (temp_directory_ + "/table_00").c_str());
+
+  const auto before = GetBlockCacheStats();
+
+  // Alternate between blocks at both ends of the table, with a new cursor
+  // each time.
+  for (size_t i = 0; i < 10; ++i) {
+    auto cursor = table_handle->NewCursor();
+    cantera::string_view key, value;
+    for (const auto& expected : {"aa", "zz"}) {
+      ASSERT_TRUE(cursor->SeekToKey(expected));
+      ASSERT_TRUE(cursor->ReadRow(key, value));
+      EXPECT_EQ(expected + filler, value);
+    }
+  }
+
+  const auto after = GetBlockCacheStats();
+  EXPECT_GE(after.hits - before.hits, 18U);
+  EXPECT_GT(after.usage, 0U);
+  EXPECT_LE(after.usage, after.capacity);
+}
+
+TEST_F(WriteOnceTest, ClosedTablesLeaveBlockCache) {
+  auto builder = TableFactory::Create(
+      "write-once", (temp_directory_ + "/table_00").c_str(), TableOptions());
+  const std::string filler(1000, 'x');
+  InsertTwoLetterKeys(*builder,
+                      [&](const std::string& key) { return key + filler; });
+  builder->Sync();
+  builder.reset();
+
+  const auto before = GetBlockCacheStats();
+
+  auto table_handle =
+      TableFactory::Open("write-once", (temp_directory_ + "/table_00").c_str());
+  auto cursor = table_handle->NewCursor();
+  cantera::string_view key, value;
+  while (cursor->ReadRow(key, value)) {
+  }
+  EXPECT_GT(GetBlockCacheStats().usage, before.usage);
+
+  cursor.reset();
+  table_handle.reset();
+  EXPECT_EQ(before.usage, GetBlockCacheStats().usage);
+}
+
+// Destroyed after the block cache would be, if it were a function-local
+// static, as tools keeping tables in globals do.
+std::unique_ptr<Table> global_table;
+
+TEST_F(WriteOnceTest, TablesMayOutliveStaticDestructors) {
+  auto builder = TableFactory::Create(
+      "write-once", (temp_directory_ + "/table_00").c_str(), TableOptions());
+  InsertTwoLetterKeys(*builder, [](const std::string& key) { return key; });
+  builder->Sync();
+  builder.reset();
+
+  global_table =
+      TableFactory::Open("write-once", (temp_directory_ + "/table_00").c_str());
+  EXPECT_TRUE(global_table->SeekToKey("mm"));
+}
+
+TEST_F(WriteOnceTest, WarmUpKeepsCursorsWorking) {
+  auto builder = TableFactory::Create(
+      "write-once", (temp_directory_ + "/table_00").c_str(), TableOptions());
+  builder->InsertRow("a", "xxx");
+  builder->InsertRow("b", "yyy");
+  builder->Sync();
+  builder.reset();
+
+  auto table_handle =
+      TableFactory::Open("write-once", (temp_directory_ + "/table_00").c_str());
+  auto cursor = table_handle->NewCursor();
+  EXPECT_TRUE(cursor->SeekToKey("b"));
+
+  EXPECT_GT(table_handle->WarmUp(false), 0U);
+
+  cantera::string_view key, value;
+  EXPECT_TRUE(cursor->ReadRow(key, value));
+  EXPECT_EQ("b", key);
+  EXPECT_EQ("yyy", value);
+}
+
 TEST_F(WriteOnceTest, EmptyTableOK) {
   auto builder = TableFactory::Create(
       "write-once", (temp_directory_ + "/table_00").c_str(), TableOptions());
@@ -54,12 +54,33 @@ static Backend* get_backend(const char* backend_name, const char* path, int fd,
 
 }  // namespace
 
+TableIOStats& ThreadTableIOStats() {
+  static thread_local TableIOStats stats;
+  return stats;
+}
+
 TableBuilder::~TableBuilder() {}
 
 Table::Table(const struct stat& s) : st(s) {}
 
 Table::~Table() {}
 
+void Table::LookupKeys(
+    const std::vector<string_view>& keys,
+    const std::function<void(size_t, const string_view&)>& callback) {
+  auto cursor = NewCursor();
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (!cursor->SeekToKey(keys[i])) continue;
+
+    string_view key, value;
+    KJ_REQUIRE(cursor->ReadRow(key, value));
+    callback(i, value);
+  }
+}
+
+uint64_t Table::WarmUp(bool lock) { return 0; }
+
 SeekableTable::SeekableTable(const struct stat& s) : Table(s) {}
 
 Backend::~Backend() {}
@@ -0,0 +1,175 @@
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "src/thread-pool.h"
+
+#include <kj/debug.h>
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+namespace {
+
+// The pool and queue of the worker thread running the calling code, if any.
+thread_local ThreadPool* current_pool = nullptr;
+thread_local size_t current_queue = 0;
+
+}  // namespace
+
+ThreadPool::ThreadPool(size_t n, size_t max_backlog)
+    : max_backlog_(max_backlog) {
+  KJ_REQUIRE(n > 0, "a thread pool needs at least one thread");
+
+  for (size_t i = 0; i < n; ++i)
+    queues_.emplace_back(std::make_unique<Queue>());
+
+  for (size_t i = 0; i < n; ++i)
+    threads_.emplace_back(std::thread(&ThreadPool::ThreadMain, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+  std::unique_lock<std::mutex> lock(idle_mutex_);
+  done_ = true;
+  work_cv_.notify_all();
+  lock.unlock();
+
+  while (!threads_.empty()) {
+    threads_.back().join();
+    threads_.pop_back();
+  }
+}
+
+ThreadPool& ThreadPool::Default() {
+  static ThreadPool pool;
+  return pool;
+}
+
+void ThreadPool::Push(Task&& task) {
+  const auto index = (current_pool == this)
+                         ? current_queue
+                         : next_queue_++ % queues_.size();
+  auto& queue = *queues_[index];
+
+  std::unique_lock<std::mutex> lock(queue.mutex);
+
+  // If we've reached the backlog limit, we just execute in the context of the
+  // calling thread.
+  if (queue.tasks.size() >= max_backlog_) {
+    lock.unlock();
+    task();
+    return;
+  }
+
+  // The counters are updated before the task can be taken by another thread,
+  // so that they never drop below zero.
+  ++outstanding_;
+  ++queued_;
+  queue.tasks.emplace_back(std::move(task));
+  lock.unlock();
+
+  // A worker increments `sleeping_', and a waiting thread `waiting_', before
+  // it checks `queued_' for the last time, so either it sees the new task, or
+  // we see it sleeping.  A thread waiting for a task group, possibly from
+  // within a task, would otherwise sit idle while the new task is queued.
+  const auto sleeping = sleeping_.load();
+  const auto waiting = waiting_.load();
+  if (sleeping > 0 || waiting > 0) {
+    std::unique_lock<std::mutex> idle_lock(idle_mutex_);
+    if (sleeping > 0)
+      work_cv_.notify_one();
+    else
+      completion_cv_.notify_one();
+  }
+}
+
+bool ThreadPool::TryPop(size_t own, Task& task) {
+  if (!queued_.load()) return false;
+
+  const auto start = (own == kNoQueue) ? next_queue_.load() : own;
+
+  for (size_t i = 0; i < queues_.size(); ++i) {
+    const auto index = (start + i) % queues_.size();
+    auto& queue = *queues_[index];
+
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) continue;
+
+    // Our own queue is used as a stack, for locality.  Other queues are
+    // robbed of their oldest tasks, which their owners will not touch soon.
+    if (index == own) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+
+    --queued_;
+
+    return true;
+  }
+
+  return false;
+}
+
+void ThreadPool::Run(Task& task) {
+  task();
+
+  // Release the task's captured state before reporting completion.
+  task.reset();
+
+  if (--outstanding_ == 0) NotifyCompletion();
+}
+
+void ThreadPool::WaitFor(const std::atomic<size_t>& counter) {
+  const auto own = (current_pool == this) ? current_queue : kNoQueue;
+
+  Task task;
+
+  while (counter.load() > 0) {
+    if (TryPop(own, task)) {
+      Run(task);
+      continue;
+    }
+
+    // The remaining tasks are running in other threads.
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    ++waiting_;
+    completion_cv_.wait(lock, [this, &counter] {
+      return counter.load() == 0 || queued_.load() > 0;
+    });
+    --waiting_;
+  }
+}
+
+void ThreadPool::NotifyCompletion() {
+  std::unique_lock<std::mutex> lock(idle_mutex_);
+  completion_cv_.notify_all();
+}
+
+void ThreadPool::ThreadMain(size_t index) {
+  current_pool = this;
+  current_queue = index;
+
+  Task task;
+
+  for (;;) {
+    if (TryPop(index, task)) {
+      Run(task);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    ++sleeping_;
+    work_cv_.wait(lock, [this] { return done_ || queued_.load() > 0; });
+    --sleeping_;
+
+    if (done_) break;
+  }
+}
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
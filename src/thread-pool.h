@@ -1,14 +1,20 @@
 #ifndef BASE_THREAD_POOL_H_
 #define BASE_THREAD_POOL_H_ 1
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #include <cstdlib>
 #include <deque>
+#include <exception>
 #include <future>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <vector>
 
+#include <kj/common.h>
+
 #include "src/delegate.h"
 
 namespace cantera {
@@ -25,38 +31,33 @@ namespace internal {
 //
 //   printf("Result: %d %d\n", a.get(), b.get());
 //
-// This is basically a replacement for std::async(std::launch::async, ...),
-// which creates a thread on every invocation, which doesn't scale well.
+// Every worker thread has its own task queue.  Tasks launched from a worker
+// go to the back of its own queue, and tasks launched from other threads are
+// spread over the queues round-robin.  Workers take tasks from the back of
+// their own queue, and steal from the front of the other queues once theirs
+// is empty, so that threads rarely contend for the same lock.
 class ThreadPool {
  public:
-  // Constructs a thread pool with the given number of threads.
-  ThreadPool(size_t n, size_t max_backlog = 256)
-      : max_backlog_(max_backlog) {
-    while (n-- > 0)
-      threads_.emplace_back(
-          std::thread(std::bind(&ThreadPool::ThreadMain, this, n)));
-  }
+  // Constructs a thread pool with the given number of threads, which must be
+  // at least one.  If a queue holds `max_backlog' tasks, further tasks
+  // launched to it are executed in the calling thread instead.
+  ThreadPool(size_t n, size_t max_backlog = 256);
 
   // Constructs a thread pool with the same number of threads as supported by
   // the hardware.
-  ThreadPool() : ThreadPool(std::thread::hardware_concurrency()) {}
+  ThreadPool()
+      : ThreadPool(std::max(std::thread::hardware_concurrency(), 1U)) {}
 
   KJ_DISALLOW_COPY(ThreadPool);
 
   // Instructs all worker threads to stop, waits for them to stop, then
   // destroys the thread pool.  Call Wait() before destruction if you want to
   // ensure all tasks have completed.
-  ~ThreadPool() {
-    std::unique_lock<std::mutex> lock(mutex_);
-    done_ = true;
-    queue_not_empty_cv_.notify_all();
-    lock.unlock();
+  ~ThreadPool();
 
-    while (!threads_.empty()) {
-      threads_.back().join();
-      threads_.pop_back();
-    }
-  }
+  // Returns a pool shared by the whole process, with one thread per hardware
+  // thread.  Its users must wait for their own tasks through a TaskGroup.
+  static ThreadPool& Default();
 
   // Schedules a void task for asynchronous execution.
   template <class Function,
@@ -64,22 +65,7 @@ class ThreadPool {
                 std::is_void<typename std::result_of<Function()>::type>::value,
                 void>::type* = nullptr>
   void Launch(Function&& f) {
-    std::unique_lock<std::mutex> lock(mutex_);
-
-    // If we've reached the backlog limit, we just execute in the context of
-    // the calling thread.
-    if (queued_calls_.size() >= max_backlog_) {
-      lock.unlock();
-      f();
-      return;
-    }
-
-    queued_calls_.emplace_back(std::move(f));
-
-    ++scheduled_tasks_;
-    lock.unlock();
-
-    queue_not_empty_cv_.notify_one();
+    Push(Task(std::forward<Function>(f)));
   }
 
   // Schedules a task for asynchronous execution.
@@ -91,33 +77,17 @@ class ThreadPool {
     std::promise<typename std::result_of<Function()>::type> promise;
     auto result = promise.get_future();
 
-    std::unique_lock<std::mutex> lock(mutex_);
-
-    // If we've reached the backlog limit, we just execute in the context of
-    // the calling thread.
-    if (queued_calls_.size() >= max_backlog_) {
-      lock.unlock();
-      promise.set_value(f());
-      return result;
-    }
-
-    queued_calls_.emplace_back(
-        [ f = std::move(f), promise = std::move(promise) ]() mutable {
-          try {
-            promise.set_value(f());
-          } catch (...) {
-            try {
-              promise.set_exception(std::current_exception());
-            } catch (...) {
-              std::terminate();
-            }
-          }
-        });
-
-    ++scheduled_tasks_;
-    lock.unlock();
-
-    queue_not_empty_cv_.notify_one();
+    Push(Task([ f = std::move(f), promise = std::move(promise) ]() mutable {
+      try {
+        promise.set_value(f());
+      } catch (...) {
+        try {
+          promise.set_exception(std::current_exception());
+        } catch (...) {
+          std::terminate();
+        }
+      }
+    }));
 
     return result;
   }
@@ -125,56 +95,140 @@ class ThreadPool {
   // Returns the number of threads in this thread pool.
   size_t Size() const { return threads_.size(); }
 
-  // Waits for completion of all scheduled tasks.
-  void Wait() {
-    std::unique_lock<std::mutex> lock(mutex_);
-    completion_cv_.wait(
-        lock, [this] { return completed_tasks_ == scheduled_tasks_; });
-  }
+  // Waits for completion of all scheduled tasks, running queued tasks in the
+  // calling thread meanwhile.  Must not be called from a task of this pool;
+  // use a TaskGroup for that.
+  void Wait() { WaitFor(outstanding_); }
 
  private:
-  // Worker thread entry point.  Runs tasks added to the queue until `done_' is
-  // set to true by the destructor.
-  void ThreadMain(size_t index) {
-    std::unique_lock<std::mutex> lock(mutex_);
+  friend class TaskGroup;
 
-    for (;;) {
-      queue_not_empty_cv_.wait(
-          lock, [this] { return done_ || !queued_calls_.empty(); });
-      if (done_) break;
+  using Task = Delegate<void()>;
 
-      Delegate<void()> call(std::move(queued_calls_.front()));
-      queued_calls_.pop_front();
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
 
-      lock.unlock();
+    // Keeps the locks of neighboring queues off the same cache line.
+    char padding[64];
+  };
 
-      call();
+  // Adds `task' to a queue, or runs it if the queue is full.
+  void Push(Task&& task);
 
-      lock.lock();
+  // Takes a task from the queue `own', or failing that, steals one from
+  // another queue.  `own' is the queue of the calling worker, or kNoQueue.
+  bool TryPop(size_t own, Task& task);
 
-      if (++completed_tasks_ == scheduled_tasks_) completion_cv_.notify_all();
-    }
-  }
+  // Runs and destroys a task taken from a queue.
+  void Run(Task& task);
 
-  // The number of tasks added with Launch().
-  size_t scheduled_tasks_ = 0;
+  // Runs queued tasks until `counter' reaches zero.
+  void WaitFor(const std::atomic<size_t>& counter);
 
-  // The number of completed tasks.
-  size_t completed_tasks_ = 0;
+  // Wakes the threads blocked in WaitFor(), so they can check their counter.
+  void NotifyCompletion();
 
-  // The maximum number of queued tasks, before we start running tasks in the
-  // calling thread.
-  size_t max_backlog_ = std::numeric_limits<size_t>::max();
+  // Worker thread entry point.  Runs tasks until `done_' is set to true by the
+  // destructor.
+  void ThreadMain(size_t index);
 
+  static constexpr size_t kNoQueue = static_cast<size_t>(-1);
+
+  // The maximum number of tasks in a queue, before we start running tasks in
+  // the calling thread.
+  const size_t max_backlog_;
+
+  std::vector<std::unique_ptr<Queue>> queues_;
   std::vector<std::thread> threads_;
 
-  std::condition_variable queue_not_empty_cv_;
+  // The queue receiving the next task launched from outside the pool.
+  std::atomic<size_t> next_queue_{0};
+
+  // The number of tasks in all queues.
+  std::atomic<size_t> queued_{0};
+
+  // The number of tasks queued or running.
+  std::atomic<size_t> outstanding_{0};
+
+  // The number of workers waiting for tasks.
+  std::atomic<size_t> sleeping_{0};
+
+  // The number of threads blocked in WaitFor(), which also run new tasks.
+  std::atomic<size_t> waiting_{0};
+
+  // Guards sleeping and waking up; the queues have their own locks.
+  std::mutex idle_mutex_;
+  std::condition_variable work_cv_;
   std::condition_variable completion_cv_;
-  std::mutex mutex_;
 
   bool done_ = false;
+};
 
-  std::deque<Delegate<void()>> queued_calls_;
+// A set of tasks running on a ThreadPool, which can be waited for without
+// waiting for the other tasks of the pool.  Wait() may be called from a task
+// of the same pool, and runs queued tasks while it waits.  Example use:
+//
+//   TaskGroup tasks(ThreadPool::Default());
+//
+//   for (auto& key : keys) tasks.Launch([&key] { Lookup(key); });
+//
+//   tasks.Wait();
+class TaskGroup {
+ public:
+  explicit TaskGroup(ThreadPool& pool) : pool_(pool) {}
+
+  KJ_DISALLOW_COPY(TaskGroup);
+
+  // Waits for the remaining tasks.  Their exceptions, if any, are discarded.
+  ~TaskGroup() { pool_.WaitFor(pending_); }
+
+  // Schedules a void task for asynchronous execution.
+  template <class Function>
+  void Launch(Function&& f) {
+    ++pending_;
+
+    auto task = [ this, f = std::forward<Function>(f) ]() mutable {
+      {
+        auto body = std::move(f);
+        try {
+          body();
+        } catch (...) {
+          std::unique_lock<std::mutex> lock(mutex_);
+          if (!error_) error_ = std::current_exception();
+        }
+      }
+
+      // Once `pending_' reaches zero, the group may be destroyed by a waiting
+      // thread, so it must not be touched after the decrement.
+      auto& pool = pool_;
+      if (--pending_ == 0) pool.NotifyCompletion();
+    };
+
+    pool_.Push(ThreadPool::Task(std::move(task)));
+  }
+
+  // Waits for completion of all tasks launched so far.  If any of them threw
+  // an exception, the first exception is rethrown.
+  void Wait() {
+    pool_.WaitFor(pending_);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!error_) return;
+    auto error = std::move(error_);
+    error_ = nullptr;
+    lock.unlock();
+
+    std::rethrow_exception(error);
+  }
+
+ private:
+  ThreadPool& pool_;
+
+  std::atomic<size_t> pending_{0};
+
+  std::mutex mutex_;
+  std::exception_ptr error_;
 };
 
 }  // namespace internal
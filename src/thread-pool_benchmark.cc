@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "src/thread-pool.h"
+
+using namespace cantera::table::internal;
+
+namespace {
+
+// Roughly the amount of work done per index key by small correlate tasks.
+void TinyTask(std::atomic<uint64_t>& sink, uint64_t seed) {
+  uint64_t x = seed;
+  for (int i = 0; i < 16; ++i) x = x * 6364136223846793005ULL + 1;
+  sink.fetch_add(x & 1, std::memory_order_relaxed);
+}
+
+// Launches `count' tasks from a thread outside the pool, as correlate does.
+void LaunchFromOutside(ThreadPool& pool, size_t count,
+                       std::atomic<uint64_t>& sink) {
+  TaskGroup tasks(pool);
+  for (size_t i = 0; i < count; ++i)
+    tasks.Launch([&sink, i] { TinyTask(sink, i); });
+  tasks.Wait();
+}
+
+// Launches tasks recursively from inside the pool, `fanout' at a time, until
+// `count' tasks have been launched.
+void Spawn(TaskGroup& tasks, size_t count, size_t fanout,
+           std::atomic<uint64_t>& sink) {
+  if (count <= 1) {
+    TinyTask(sink, count);
+    return;
+  }
+
+  const auto parts = std::min(count, fanout);
+  const auto share = count / parts;
+  for (size_t i = 0; i < parts; ++i) {
+    const auto n = (i + 1 == parts) ? count - share * i : share;
+    tasks.Launch(
+        [&tasks, n, fanout, &sink] { Spawn(tasks, n, fanout, sink); });
+  }
+}
+
+void LaunchFromInside(ThreadPool& pool, size_t count,
+                      std::atomic<uint64_t>& sink) {
+  TaskGroup tasks(pool);
+  Spawn(tasks, count, 8, sink);
+  tasks.Wait();
+}
+
+template <typename Function>
+double Measure(Function&& f) {
+  const auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const size_t count = (argc > 1) ? strtoul(argv[1], nullptr, 0) : 2000000;
+  const size_t max_threads =
+      (argc > 2) ? strtoul(argv[2], nullptr, 0)
+                 : std::max(std::thread::hardware_concurrency(), 1U);
+
+  std::atomic<uint64_t> sink{0};
+
+  printf("%-8s %18s %18s\n", "Threads", "Outside (tasks/s)",
+         "Inside (tasks/s)");
+
+  for (size_t threads = 1; threads <= max_threads;
+       threads = (threads == max_threads) ? threads + 1
+                                          : std::min(threads * 2, max_threads)) {
+    ThreadPool pool(threads);
+
+    const auto outside =
+        Measure([&] { LaunchFromOutside(pool, count, sink); });
+    const auto inside = Measure([&] { LaunchFromInside(pool, count, sink); });
+
+    printf("%-8zu %18.0f %18.0f\n", threads, count / outside, count / inside);
+  }
+
+  // Keep the work from being optimized away.
+  return sink.load() == UINT64_MAX;
+}
@@ -0,0 +1,126 @@
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+
+#include <kj/debug.h>
+
+#include "src/thread-pool.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace cantera::table::internal;
+
+namespace {
+
+// Adds the numbers in [begin, end) to `sum', splitting the range over nested
+// task groups.
+void SumRange(ThreadPool& pool, size_t begin, size_t end,
+              std::atomic<size_t>& sum) {
+  if (end - begin <= 4) {
+    for (auto i = begin; i < end; ++i) sum += i;
+    return;
+  }
+
+  const auto middle = begin + (end - begin) / 2;
+
+  TaskGroup tasks(pool);
+  tasks.Launch([&pool, begin, middle, &sum] {
+    SumRange(pool, begin, middle, sum);
+  });
+  tasks.Launch([&pool, middle, end, &sum] {
+    SumRange(pool, middle, end, sum);
+  });
+  tasks.Wait();
+}
+
+}  // namespace
+
+TEST(ThreadPoolTest, NestedWaits) {
+  ThreadPool pool(2);
+
+  std::atomic<size_t> sum{0};
+  SumRange(pool, 0, 10000, sum);
+
+  EXPECT_EQ(10000U * 9999U / 2, sum.load());
+}
+
+TEST(ThreadPoolTest, WaitingThreadRunsNewTasks) {
+  ThreadPool pool(1);
+  TaskGroup tasks(pool);
+
+  std::promise<void> started;
+  std::promise<void> finished;
+  auto finished_future = finished.get_future();
+  bool ran_in_time = false;
+
+  // The only worker launches a task, and waits for it, while this thread
+  // waits for the group.  Only this thread is free to run the new task.
+  tasks.Launch([&] {
+    started.set_value();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    tasks.Launch([&finished] { finished.set_value(); });
+    ran_in_time = finished_future.wait_for(std::chrono::seconds(10)) ==
+                  std::future_status::ready;
+  });
+
+  started.get_future().wait();
+  tasks.Wait();
+
+  EXPECT_TRUE(ran_in_time);
+}
+
+TEST(ThreadPoolTest, TaskGroupRethrowsFirstException) {
+  ThreadPool pool(4);
+  TaskGroup tasks(pool);
+
+  std::atomic<size_t> completed{0};
+
+  for (size_t i = 0; i < 100; ++i) {
+    tasks.Launch([i, &completed] {
+      if (i % 10 == 3) KJ_FAIL_REQUIRE("task failed", i);
+      ++completed;
+    });
+  }
+
+  EXPECT_THROW(tasks.Wait(), kj::Exception);
+
+  // The failures don't stop the other tasks.
+  EXPECT_EQ(90U, completed.load());
+
+  // The exception is only reported once.
+  tasks.Launch([&completed] { ++completed; });
+  EXPECT_NO_THROW(tasks.Wait());
+  EXPECT_EQ(91U, completed.load());
+}
+
+TEST(ThreadPoolTest, RunsTasksInlineWhenQueueIsFull) {
+  ThreadPool pool(1, 1);
+  TaskGroup tasks(pool);
+
+  std::promise<void> started;
+  std::promise<void> release;
+  auto release_future = release.get_future().share();
+
+  // Keep the worker busy, so that the next task stays queued.
+  tasks.Launch([&started, release_future] {
+    started.set_value();
+    release_future.wait();
+  });
+  started.get_future().wait();
+
+  std::thread::id queued_thread;
+  tasks.Launch(
+      [&queued_thread] { queued_thread = std::this_thread::get_id(); });
+
+  // The queue is full, so this task runs before Launch() returns.
+  std::thread::id inline_thread;
+  tasks.Launch(
+      [&inline_thread] { inline_thread = std::this_thread::get_id(); });
+  EXPECT_EQ(std::this_thread::get_id(), inline_thread);
+
+  release.set_value();
+  tasks.Wait();
+
+  EXPECT_NE(std::thread::id(), queued_thread);
+}
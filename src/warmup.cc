@@ -0,0 +1,128 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "src/warmup.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#include <kj/debug.h>
+
+#include "src/ca-table.h"
+#include "src/schema.h"
+#include "src/thread-pool.h"
+#include "src/util.h"
+
+namespace cantera {
+namespace table {
+
+namespace {
+
+// Reads the rows of `key' from `table', or the rows starting with it if it
+// ends in '*'.  Adds the number of rows read and their size to `result'.
+void ReadHotKey(Table* cursor, string_view key, WarmUpProgress& result) {
+  const auto is_prefix = !key.empty() && key.back() == '*';
+  if (is_prefix) key.remove_suffix(1);
+
+  string_view row_key, data;
+
+  if (!is_prefix) {
+    if (!cursor->SeekToKey(key)) return;
+    KJ_REQUIRE(cursor->ReadRow(row_key, data));
+
+    ++result.rows;
+    result.row_bytes += row_key.size() + data.size();
+    return;
+  }
+
+  cursor->SeekToKey(key);
+
+  while (cursor->ReadRow(row_key, data)) {
+    if (!internal::HasPrefix(row_key, key)) {
+      if (row_key < key) continue;
+      break;
+    }
+
+    ++result.rows;
+    result.row_bytes += row_key.size() + data.size();
+  }
+}
+
+}  // namespace
+
+WarmUpProgress WarmUp(Schema* schema, const WarmUpOptions& options,
+                      std::function<void(const WarmUpProgress&)> progress) {
+  std::vector<Table*> tables;
+  for (const auto& summary_table : schema->summary_tables)
+    tables.emplace_back(summary_table.second.get());
+  for (const auto& table : schema->summary_override_tables)
+    tables.emplace_back(table.get());
+  for (const auto& table : schema->IndexTables())
+    tables.emplace_back(table.get());
+
+  WarmUpProgress total;
+  total.tables_total = tables.size();
+
+  std::mutex total_mutex;
+
+  internal::TaskGroup tasks(internal::ThreadPool::Default());
+
+  for (auto table : tables) {
+    tasks.Launch([table, &options, &progress, &total, &total_mutex] {
+      WarmUpProgress table_result;
+      table_result.index_bytes = table->WarmUp(options.lock);
+
+      if (!options.keys.empty()) {
+        // The table itself may be in use by running statements.
+        auto cursor = table->NewCursor();
+        for (const auto& key : options.keys)
+          ReadHotKey(cursor.get(), key, table_result);
+      }
+
+      std::unique_lock<std::mutex> lock(total_mutex);
+      ++total.tables_done;
+      total.index_bytes += table_result.index_bytes;
+      total.rows += table_result.rows;
+      total.row_bytes += table_result.row_bytes;
+
+      if (progress) progress(total);
+    });
+  }
+
+  tasks.Wait();
+
+  return total;
+}
+
+std::vector<std::string> ReadWarmUpKeys(const char* path) {
+  std::unique_ptr<FILE, decltype(&fclose)> file{fopen(path, "r"), fclose};
+  if (!file) KJ_FAIL_SYSCALL("fopen", errno, path);
+
+  std::vector<std::string> result;
+
+  char* line = nullptr;
+  size_t line_size = 0;
+  ssize_t length;
+
+  while (-1 != (length = getline(&line, &line_size, file.get()))) {
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+      --length;
+
+    if (!length || line[0] == '#') continue;
+
+    result.emplace_back(line, length);
+  }
+
+  const auto read_error = ferror(file.get());
+  free(line);
+  KJ_REQUIRE(!read_error, "failed to read hot keys", path);
+
+  return result;
+}
+
+}  // namespace table
+}  // namespace cantera
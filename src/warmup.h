@@ -0,0 +1,56 @@
+#ifndef STORAGE_CA_TABLE_WARMUP_H_
+#define STORAGE_CA_TABLE_WARMUP_H_ 1
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace cantera {
+namespace table {
+
+class Schema;
+
+// Describes what to bring into memory when the tables of a schema are warmed
+// up.
+struct WarmUpOptions {
+  // Keys to read from every index and summary table.  A key ending in '*' is a
+  // prefix, and every row starting with it is read.
+  std::vector<std::string> keys;
+
+  // If true, the lookup structures of the tables are locked in memory with
+  // mlock(), so that they are never paged out.
+  bool lock = false;
+};
+
+// Progress of a warm-up, reported once for every table.
+struct WarmUpProgress {
+  // The number of tables warmed up so far, and in total.
+  size_t tables_done = 0;
+  size_t tables_total = 0;
+
+  // The number of bytes of lookup structures brought into memory.
+  uint64_t index_bytes = 0;
+
+  // The number of hot rows read, and their total size in bytes.
+  uint64_t rows = 0;
+  uint64_t row_bytes = 0;
+};
+
+// Brings the block index and the hot keys of every index and summary table of
+// `schema' into memory, warming up several tables at once.  If `progress' is
+// set, it is called after each table with the totals so far; the calls may
+// come from different threads, but never at the same time.  Returns the final
+// totals.  May run concurrently with statements using the same schema.
+WarmUpProgress WarmUp(
+    Schema* schema, const WarmUpOptions& options,
+    std::function<void(const WarmUpProgress&)> progress = nullptr);
+
+// Reads hot keys from the file `path', one per line.  Empty lines and lines
+// starting with '#' are skipped.
+std::vector<std::string> ReadWarmUpKeys(const char* path);
+
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !STORAGE_CA_TABLE_WARMUP_H_